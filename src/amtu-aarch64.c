@@ -7,101 +7,73 @@
 #include <string.h>
 #include <signal.h>
 #include <sys/types.h>
-#include <sys/wait.h>
 #include <syslog.h>
 #include "amtu.h"
 
 #if defined(HAVE_AARCH64)
+#include <sys/auxv.h>
 
-/************************************************************************/
-/*                                                                      */
-/* FUNCTION: catchfault                                                 */
-/*                                                                      */
-/* PURPOSE: Signal handler to catch the segmentation violation which is */
-/*          expected when trying to execute privileged instructions     */
-/*          without privilege.                                          */
-/*                                                                      */
-/************************************************************************/
-void catchfault(int sig)
-{
-	if (debug) {
-		printf("caught the fault %d\n", sig);
-	}
-	exit(0);
-}
+/*
+ * Each instruction should be undefined at EL0, raising SIGILL with
+ * si_code ILL_ILLOPC, since they are privileged instructions.
+ */
 
+/* Try to halt the CPU. */
+PRIV_STUB(amtu_priv_hlt, "hlt #1");
 
-/************************************************************************/
-/*                                                                      */
-/* FUNCTION: amtu_priv                                                  */
-/*                                                                      */
-/* PURPOSE: Execute privileged instructions to ensure that they cannot  */
-/*	    legitimately be run in user mode.                           */
-/*                                                                      */
-/************************************************************************/
-int amtu_priv(int argc, char *argv[])
-{
-	struct sigaction sig;
-	pid_t pid;
-	int stat;
-
-	printf("Executing Supervisor Mode Instructions Test...\n");
+/*
+ * The expanded catalog: EL1 system register accesses, exception
+ * return, calls to the secure monitor and the hypervisor, TLB and
+ * cache invalidation.  DC IVAC is given x0, whatever it holds, so it
+ * may also be reported as a fault on that address.  With HWCAP_CPUID
+ * the kernel emulates MRS of the ID registers at EL0; MIDR_EL1 must
+ * then read as a real implementer, not leak or fault.
+ */
+PRIV_STUB(amtu_priv_mrs_sctlr, "mrs x0, sctlr_el1");
+PRIV_STUB(amtu_priv_mrs_ttbr1, "mrs x0, ttbr1_el1");
+PRIV_STUB(amtu_priv_msr_tpidr, "msr tpidr_el1, xzr");
+PRIV_STUB(amtu_priv_msr_daif, "msr daifset, #0xf");
+PRIV_STUB(amtu_priv_eret, "eret");
+PRIV_STUB(amtu_priv_smc, "smc #0");
+PRIV_STUB(amtu_priv_hvc, "hvc #0");
+PRIV_STUB(amtu_priv_tlbi, "tlbi vmalle1");
+PRIV_STUB(amtu_priv_dc_ivac, "dc ivac, x0");
 
-	/* Set up signal handler */
-	sig.sa_handler = catchfault;
-	sig.sa_flags = 0;
-	sigemptyset(&sig.sa_mask);
-	sigaction(SIGSEGV, &sig, NULL);
-	sigaction(SIGILL, &sig, NULL);
-	sigaction(SIGIOT, &sig, NULL);
-	sigaction(SIGIO, &sig, NULL);
-	sigaction(SIGINT, &sig, NULL);
-	sigaction(SIGABRT, &sig, NULL);
-	sigaction(SIGTERM, &sig, NULL);
-	sigaction(SIGQUIT, &sig, NULL);
-	sigaction(SIGBUS, &sig, NULL);
+static unsigned long priv_midr;
 
-	/* Each assembly directive should seg fault since they are */
-	/* privileged instructions.                                */
-	/* RDPMC can be used in user space if correct flags are    */
-	/* set but Linux does not set those flags.                 */
-	/* See Chapter 4 of Intel's Systems Programming Guide      */
+static void amtu_priv_mrs_midr(void)
+{
+	__asm__ volatile ("mrs %0, midr_el1" : "=r" (priv_midr));
+}
 
-	/*---------------------------------------------------------*/
-	/* Test One                                                */
-	/* Try to halt the CPU.                                    */
-	/*---------------------------------------------------------*/
-	pid = fork();
-	if (pid == 0) {
-		/* child */
-		if (debug) {
-			printf("HLT test: ");
-		}
-		__asm__ ("HLT 1\n\t");
-		return(-1);
-	} else if (pid == -1) {
-		/* error condition */
-		fprintf(stderr, "Privilege Separation Test FAILED (HLT)!\n");
-#ifdef HAVE_LIBLAUS
-		LAUS_LOG(("amtu failed privilege separation on HLT"))
-#else
-		AUDIT_LOG("amtu failed privilege separation on HLT", 0)
-#endif
-		exit(-1);
-	}
-	/* parent */
-	(void) wait(&stat);
-	if (!(WIFEXITED(stat) && (WEXITSTATUS(stat) == 0))) {
-		fprintf(stderr, "Privilege Separation Test FAILED on HLT!\n");
-#ifdef HAVE_LIBLAUS
-		LAUS_LOG(("amtu failed privilege separation on HLT"))
-#else
-		AUDIT_LOG("amtu failed privilege separation on HLT", 0)
-#endif
-		return(-1);
-	}
+static int cpu_hwcap_cpuid(void)
+{
+	return (getauxval(AT_HWCAP) & HWCAP_CPUID) != 0;
+}
 
-	printf("Privileged Instruction Test SUCCESS!\n");
-	return(0);
+static int midr_valid(void)
+{
+	/* Implementer, bits 31:24 */
+	return (priv_midr >> 24) & 0xff ? 0 : -1;
 }
+
+#define UD	PRIV_SIG(SIGILL), ILL_ILLOPC
+#define CAT	PRIV_PC | PRIV_BATCH
+
+const struct priv_insn priv_insns[] = {
+	{ "HLT",	amtu_priv_hlt,		UD, PRIV_PC, NULL, NULL },
+	{ "MRS-SCTLR",	amtu_priv_mrs_sctlr,	UD, CAT, NULL, NULL },
+	{ "MRS-TTBR1",	amtu_priv_mrs_ttbr1,	UD, CAT, NULL, NULL },
+	{ "MSR-TPIDR",	amtu_priv_msr_tpidr,	UD, CAT, NULL, NULL },
+	{ "MSR-DAIF",	amtu_priv_msr_daif,	UD, CAT, NULL, NULL },
+	{ "ERET",	amtu_priv_eret,		UD, CAT, NULL, NULL },
+	{ "SMC",	amtu_priv_smc,		UD, CAT, NULL, NULL },
+	{ "HVC",	amtu_priv_hvc,		UD, CAT, NULL, NULL },
+	{ "TLBI",	amtu_priv_tlbi,		UD, CAT, NULL, NULL },
+	{ "DC-IVAC",	amtu_priv_dc_ivac,
+	  PRIV_SIG(SIGILL) | PRIV_SIG(SIGSEGV), PRIV_ANYCODE, CAT, NULL, NULL },
+	{ "MRS-MIDR",	amtu_priv_mrs_midr,	UD, PRIV_BATCH,
+	  cpu_hwcap_cpuid, midr_valid },
+	{ NULL, NULL, 0, 0, 0, NULL, NULL }
+};
 #endif
@@ -38,424 +38,193 @@
 #include <string.h>
 #include <signal.h>
 #include <sys/types.h>
-#include <sys/wait.h>
 #include <syslog.h>
 #include "amtu.h"
 
 #if defined(HAVE_I86) || defined(HAVE_X86_64)
+#include <cpuid.h>
+
+/*
+ * Each instruction should raise a general protection fault, SIGSEGV
+ * with si_code SI_KERNEL, since they are privileged instructions.
+ * RDPMC can be used in user space if correct flags are set but Linux
+ * does not set those flags.  See Chapter 4 of Intel's Systems
+ * Programming Guide.  The descriptor table loads get a valid memory
+ * operand below the stack pointer, so that only the privilege check
+ * can make them fault.
+ */
+#if defined(HAVE_X86_64)
+#define STACK_OPERAND	"-16(%rsp)"
+#define REG_AX		"%rax"
+#else
+#define STACK_OPERAND	"-16(%esp)"
+#define REG_AX		"%eax"
+#endif
 
-/************************************************************************/
-/*                                                                      */
-/* FUNCTION: catchfault                                                 */
-/*                                                                      */
-/* PURPOSE: Signal handler to catch the segmentation violation which is */
-/*          expected when trying to execute privileged instructions     */
-/*          without privilege.                                          */
-/*                                                                      */
-/************************************************************************/
-void catchfault(int sig)
+/* Try to halt the CPU. */
+PRIV_STUB(amtu_priv_hlt, "hlt");
+PRIV_STUB(amtu_priv_rdpmc, "rdpmc");
+PRIV_STUB(amtu_priv_clts, "clts");
+/* Load Global Descriptor Table Test */
+PRIV_STUB(amtu_priv_lgdt, "lgdt " STACK_OPERAND);
+PRIV_STUB(amtu_priv_lidt, "lidt " STACK_OPERAND);
+PRIV_STUB(amtu_priv_ltr, "ltr %ax");
+PRIV_STUB(amtu_priv_lldt, "lldt %ax");
+
+/* X86-64 only instructions */
+#if defined(HAVE_X86_64)
+PRIV_STUB(amtu_priv_lmsw, "lmsw %ax");
+PRIV_STUB(amtu_priv_rdmsr, "rdmsr");
+PRIV_STUB(amtu_priv_wrmsr, "wrmsr");
+#endif
+
+/*
+ * The expanded catalog.  Cache and TLB control, control and debug
+ * register moves, port I/O and the interrupt flag all need CPL 0 (or
+ * IOPL 3, which Linux does not hand out) and raise #GP.  XSETBV raises
+ * #GP only once the OS enabled XSAVE, and VMXON/VMRUN raise #UD unless
+ * a hypervisor turned VMX/SVM on, then #GP, so these are only run when
+ * CPUID reports them.  With OSPKE, WRPKRU and RDPKRU are legal in user
+ * mode, but must still #GP if ECX is not zero; PKRU is rewritten with
+ * its own value in case they do not.
+ */
+PRIV_STUB(amtu_priv_invd, "invd");
+PRIV_STUB(amtu_priv_wbinvd, "wbinvd");
+PRIV_STUB(amtu_priv_invlpg, "invlpg " STACK_OPERAND);
+PRIV_STUB(amtu_priv_rdcr0, "mov %cr0, " REG_AX);
+PRIV_STUB(amtu_priv_wrcr0, "mov " REG_AX ", %cr0");
+PRIV_STUB(amtu_priv_rdcr3, "mov %cr3, " REG_AX);
+PRIV_STUB(amtu_priv_wrcr3, "mov " REG_AX ", %cr3");
+PRIV_STUB(amtu_priv_rdcr4, "mov %cr4, " REG_AX);
+PRIV_STUB(amtu_priv_wrcr4, "mov " REG_AX ", %cr4");
+PRIV_STUB(amtu_priv_rddr7, "mov %dr7, " REG_AX);
+PRIV_STUB(amtu_priv_wrdr7, "mov " REG_AX ", %dr7");
+PRIV_STUB(amtu_priv_in, "in $0x80, %al");
+PRIV_STUB(amtu_priv_out, "out %al, $0x80");
+PRIV_STUB(amtu_priv_cli, "cli");
+PRIV_STUB(amtu_priv_sti, "sti");
+PRIV_STUB(amtu_priv_xsetbv, "xsetbv");
+PRIV_STUB(amtu_priv_vmxon, "vmxon " STACK_OPERAND);
+PRIV_STUB(amtu_priv_vmrun, "vmrun " REG_AX);
+PRIV_STUB(amtu_priv_wrpkru,
+	  "xor %ecx, %ecx\n\trdpkru\n\tmov $1, %ecx\n\twrpkru");
+PRIV_STUB(amtu_priv_rdpkru, "mov $1, %ecx\n\trdpkru");
+
+static int cpu_osxsave(void)
 {
-	if (debug) {
-		printf("caught the fault %d\n", sig);
-	}
-	exit(0);
-}
+	unsigned int a, b, c, d;
 
+	return __get_cpuid(1, &a, &b, &c, &d) && (c & bit_OSXSAVE);
+}
 
-/************************************************************************/
-/*                                                                      */
-/* FUNCTION: amtu_priv                                                  */
-/*                                                                      */
-/* PURPOSE: Execute privileged instructions to ensure that they cannot  */
-/*	    legitimately be run in user mode.                           */
-/*                                                                      */
-/************************************************************************/
-int amtu_priv(int argc, char *argv[])
+static int cpu_vmx(void)
 {
-	struct sigaction sig;
-	pid_t pid, wpid;
-	int stat;
+	unsigned int a, b, c, d;
 
-	printf("Executing Supervisor Mode Instructions Test...\n");
+	/* CPUID 1 ECX bit 5 */
+	return __get_cpuid(1, &a, &b, &c, &d) && (c & (1 << 5));
+}
 
-	/* Set up signal handler */
-	sig.sa_handler = catchfault;
-	sig.sa_flags = 0;
-	sigemptyset(&sig.sa_mask);
-	sigaction(SIGSEGV, &sig, NULL);
-	sigaction(SIGILL, &sig, NULL);
-	sigaction(SIGIOT, &sig, NULL);
-	sigaction(SIGIO, &sig, NULL);
-	sigaction(SIGINT, &sig, NULL);
-	sigaction(SIGABRT, &sig, NULL);
-	sigaction(SIGTERM, &sig, NULL);
-	sigaction(SIGQUIT, &sig, NULL);
-	sigaction(SIGBUS, &sig, NULL);
+static int cpu_svm(void)
+{
+	unsigned int a, b, c, d;
 
-	/* Each assembly directive should seg fault since they are */
-	/* privileged instructions.                                */
-	/* RDPMC can be used in user space if correct flags are    */
-	/* set but Linux does not set those flags.                 */
-	/* See Chapter 4 of Intel's Systems Programming Guide      */
+	/* CPUID 0x80000001 ECX bit 2 */
+	return __get_cpuid(0x80000001, &a, &b, &c, &d) && (c & (1 << 2));
+}
 
-	/*---------------------------------------------------------*/
-	/* Test One                                                */
-	/* Try to halt the CPU.                                    */
-	/*---------------------------------------------------------*/
-	pid = fork();
-	if (pid == 0) {
-		/* child */
-		if (debug) {
-			printf("HLT test: ");
-		}
-		__asm__ ("HLT\n\t");
-		return(-1);
-	} else if (pid == -1) {
-		/* error condition */
-		fprintf(stderr, "Privilege Separation Test FAILED (HLT)!\n");
-#ifdef HAVE_LIBLAUS
-		LAUS_LOG(("amtu failed privilege separation on HLT"))
-#else
-		AUDIT_LOG("amtu failed privilege separation on HLT", 0)
-#endif
-		exit(-1);
-	}
-	/* parent */
-	wpid = wait(&stat);
-	if (!(WIFEXITED(stat) && (WEXITSTATUS(stat) == 0))) {
-		fprintf(stderr, "Privilege Separation Test FAILED on HLT!\n");
-#ifdef HAVE_LIBLAUS
-		LAUS_LOG(("amtu failed privilege separation on HLT"))
-#else
-		AUDIT_LOG("amtu failed privilege separation on HLT", 0)
-#endif
-		return(-1);
-	}
-	/*---------------------------------------------------------*/
-	/* Test Two                                                */
-	/*---------------------------------------------------------*/
-	pid = fork();
-	if (pid == 0) {
-		/* child */
-		if (debug) {
-			printf("RDPMC test: ");
-		}
-		__asm__ ("RDPMC\n\t");
-		exit(-1);
-	} else if (pid == -1) {
-		/* error condition */
-		fprintf(stderr, "Privilege Separation Test FAILED (RDPMC)!\n");
-#ifdef HAVE_LIBLAUS
-		LAUS_LOG(("amtu failed privilege separation on RDPMC"))
-#else
-		AUDIT_LOG("amtu failed privilege separation on RDPMC", 0)
-#endif
-		exit(-1);
-	}
-	/* parent */
-	wpid = wait(&stat);
-	if (!(WIFEXITED(stat) && (WEXITSTATUS(stat) == 0))) {
-		fprintf(stderr, "Privilege Separation Test FAILED on RDPMC!\n");
-#ifdef HAVE_LIBLAUS
-		LAUS_LOG(("amtu failed privilege separation on RDPMC"))
-#else
-		AUDIT_LOG("amtu failed privilege separation on RDPMC", 0)
-#endif
-		return(-1);
-	}
-	/*---------------------------------------------------------*/
-	/* Test Three                                              */
-	/*---------------------------------------------------------*/
-	pid = fork();
-	if (pid == 0) {
-		if (debug) {
-			printf("CLTS test: ");
-		}
-		__asm__ ("CLTS\n\t");
-		exit(-1);
-	} else if (pid == -1) {
-		/* error condition */
-		fprintf(stderr, "Privilege Separation Test FAILED (CLTS)!\n");
-#ifdef HAVE_LIBLAUS
-		LAUS_LOG(("amtu failed privilege separation on CLTS"))
-#else
-		AUDIT_LOG("amtu failed privilege separation on CLTS", 0)
-#endif
-		exit(-1);
-	}
-	/* parent */
-	wpid = wait(&stat);
-	if (!(WIFEXITED(stat) && (WEXITSTATUS(stat) == 0))) {
-		fprintf(stderr, "Privilege Separation Test FAILED on CLTS!\n");
-#ifdef HAVE_LIBLAUS
-		LAUS_LOG(("amtu failed privilege separation on CLTS"))
-#else
-		AUDIT_LOG("amtu failed privilege separation on CLTS", 0)
-#endif
-		return(-1);
-	}
-	/*---------------------------------------------------------*/
-	/* Test Four                                               */
-	/* Load Global Descriptor Table Test                       */
-	/*---------------------------------------------------------*/
-	pid = fork();
-	if (pid == 0) {
-		if (debug) {
-			printf("LGDT test: ");
-		}
-		__asm__ ("SGDT 4\n\t");
-		__asm__ ("LGDT 4\n\t");
-		exit(-1);
-	} else if (pid == -1) {
-		/* error condition */
-		fprintf(stderr, "Privilege SeparationTest FAILED (LGDT)!\n");
-#ifdef HAVE_LIBLAUS
-		LAUS_LOG(("amtu failed privilege separation on LGDT"))
-#else
-		AUDIT_LOG("amtu failed privilege separation on LGDT", 0)
-#endif
-		exit(-1);
-	}
-	/* parent */
-	wpid = wait(&stat);
-	if (!(WIFEXITED(stat) && (WEXITSTATUS(stat) == 0))) {
-		fprintf(stderr, "Privilege Separation Test FAILED on LGDT!\n");
-#ifdef HAVE_LIBLAUS
-		LAUS_LOG(("amtu failed privilege separation on LGDT"))
-#else
-		AUDIT_LOG("amtu failed privilege separation on LGDT", 0)
-#endif
-		return(-1);
-	}
-	/*---------------------------------------------------------*/
-	/* Test Five                                               */
-	/*---------------------------------------------------------*/
-	pid = fork();
-	if (pid == 0) {
-		if (debug) {
-			printf("LIDT test: ");
-		}
-		__asm__ ("SIDT 4\n\t");
-		__asm__ ("LIDT 4\n\t");
-		exit(-1);
-	} else if (pid == -1) {
-		/* error condition */
-		fprintf(stderr, "Privilege Separation Test FAILED (LIDT)!\n");
-#ifdef HAVE_LIBLAUS
-		LAUS_LOG(("amtu failed privilege separation on LIDT"))
-#else
-		AUDIT_LOG("amtu failed privilege separation on LIDT", 0)
-#endif
-		exit(-1);
-	}
-	/* parent */
-	wpid = wait(&stat);
-	if (!(WIFEXITED(stat) && (WEXITSTATUS(stat) == 0))) {
-		fprintf(stderr, "Privilege Separation Test FAILED on LIDT!\n");
-#ifdef HAVE_LIBLAUS
-		LAUS_LOG(("amtu failed privilege separation on LIDT"))
-#else
-		AUDIT_LOG("amtu failed privilege separation on LIDT", 0)
-#endif
-		return(-1);
-	}
-	/*---------------------------------------------------------*/
-	/* Test Six                                                */
-	/*---------------------------------------------------------*/
-	pid = fork();
-	if (pid == 0) {
-		if (debug) {
-			printf("LTR test: ");
-		}
-		__asm__ ("STR 4\n\t");
-		__asm__ ("LTR 4\n\t");
-		exit(-1);
-	} else if (pid == -1) {
-		/* error condition */
-		fprintf(stderr, "Privilege Separation Test FAILED (LTR)!\n");
-#ifdef HAVE_LIBLAUS
-		LAUS_LOG(("amtu failed privilege separation on LTR"))
-#else
-		AUDIT_LOG("amtu failed privilege separation on LTR", 0)
-#endif
-		exit(-1);
-	}
-	/* parent */
-	wpid = wait(&stat);
-	if (!(WIFEXITED(stat) && (WEXITSTATUS(stat) == 0))) {
-		fprintf(stderr, "Privilege Separation Test FAILED on LTR!\n");
-#ifdef HAVE_LIBLAUS
-		LAUS_LOG(("amtu failed privilege separation on LTR"))
-#else
-		AUDIT_LOG("amtu failed privilege separation on LTR", 0)
-#endif
-		return(-1);
-	}
+static int cpu_ospke(void)
+{
+	unsigned int a, b, c, d;
 
-	/*---------------------------------------------------------*/
-	/* Test Seven                                              */
-	/*---------------------------------------------------------*/
-	pid = fork();
-	if (pid == 0) {
-		if (debug) {
-			printf("LLDT test: ");
-		}
-		__asm__ ("SLDT 4\n\t");
-		__asm__ ("LLDT 4\n\t");
-		exit(-1);
-	} else if (pid == -1) {
-		/* error condition */
-		fprintf(stderr, "Privilege Separation Test FAILED (LLDT)!\n");
-#ifdef HAVE_LIBLAUS
-		LAUS_LOG(("amtu failed privilege separation on LLDT"))
-#else
-		AUDIT_LOG("amtu failed privilege separation on LLDT", 0)
-#endif
-		exit(-1);
-	}
-	/* parent */
-	wpid = wait(&stat);
-	if (!(WIFEXITED(stat) && (WEXITSTATUS(stat) == 0))) {
-		fprintf(stderr, "Privilege Separation Test FAILED on LLDT!\n");
-#ifdef HAVE_LIBLAUS
-		LAUS_LOG(("amtu failed privilege separation on LLDT"))
-#else
-		AUDIT_LOG("amtu failed privilege separation on LLDT", 0)
-#endif
-		return(-1);
-	}
+	return __get_cpuid_count(7, 0, &a, &b, &c, &d) && (c & bit_OSPKE);
+}
 
-#if 0
-	/*---------------------------------------------------------*/
-	/* Test Eight                                              */
-	/*---------------------------------------------------------*/
-	pid = fork();
-	if (pid == 0) {
-		if (debug) {
-			printf("CPU Instruction test: ");
-		}
-		__asm__ ("MOVL %cs,28(%esp)\n\t");
-		exit(-1);
-	} else if (pid == -1) {
-		/* error condition */
-		fprintf("Privilege Separation Test FAILED (CPU)!\n");
-		LAUS_LOG(("amtu failed privilege separation on CPU Instruction test"))
-		exit(-1);
-	}
-	/* parent */
-	wpid = wait(&stat);
-	if (!(WIFEXITED(stat) && (WEXITSTATUS(stat) == 0))) {
-		fprintf(stderr, "Privilege Separation Test FAILED on CPU! %d\n", WEXITSTATUS(stat));
-		LAUS_LOG(("amtu failed privilege separation on CPU Instruction test"))
-		return(-1);
-	}
-#endif
+/*
+ * With UMIP, SGDT and SIDT raise #GP in user mode and Linux emulates
+ * them, returning a dummy base and a zero limit instead of the kernel
+ * addresses.  Older kernels do not emulate them for 64-bit processes
+ * and send SIGSEGV, which is just as good.  Without UMIP they are not
+ * privileged, so they are only run when the kernel enabled it.
+ */
+struct desc_ptr {
+	unsigned short limit;
+	unsigned long base;
+} __attribute__((packed));
 
+#define UMIP_GDT_BASE	((unsigned long)0xfffffffffffe0000ULL)
+#define UMIP_IDT_BASE	((unsigned long)0xffffffffffff0000ULL)
 
-/* X86-64 only instructions */
-#if defined(HAVE_X86_64)
-	/*---------------------------------------------------------*/
-	/* Test Nine						   */
-	/*---------------------------------------------------------*/
-	pid = fork();
-	if (pid == 0) {
-		if (debug) {
-			printf("LMSW test: ");
-		}
-		__asm__("LMSW 4\n\t");
-		exit(-1);
-	} else if (pid == -1) {
-		/* error condition */
-		fprintf(stderr, "Privilege Separation Test FAILED on (LMSW)!\n");
-#ifdef HAVE_LIBLAUS
-		LAUS_LOG(("amtu failed privilege separation on LMSW"))
-#else
-		AUDIT_LOG("amtu failed privilege separation on LMSW", 0)
-#endif
-		return(-1);
-	}
-	/* parent */
-	wpid = wait(&stat);
-	if (!(WIFEXITED(stat) && (WEXITSTATUS(stat) == 0))) {
-		fprintf(stderr, "Privilege Separation Test FAILED on LMSW!\n");
-#ifdef HAVE_LIBLAUS
-		LAUS_LOG(("amtu failed privilege separation on LMSW"))
-#else
-		AUDIT_LOG("amtu failed privilege separation on LMSW", 0)
-#endif
-		return(-1);
-	}
+static struct desc_ptr priv_dt;
 
-	/*---------------------------------------------------------*/
-	/* Test Ten                                                */
-	/*---------------------------------------------------------*/
-	pid = fork();
-	if (pid == 0) {
-		if (debug) {
-			printf("RDMSR test");
-		}
-		__asm__("RDMSR\n\t");
-		exit(-1);
-	} else if (pid == -1) {
-		/* error condition */
-		fprintf(stderr, "Privilege Separation Test FAILED on (RDMSR)!\n");
-#ifdef HAVE_LIBLAUS
-		LAUS_LOG(("amtu failed privilege separation on RDMSR"))
-#else
-		AUDIT_LOG("amtu failed privilege separation on RDMSR", 0)
-#endif
-		return(-1);
-	}
-	wpid = wait(&stat);
-	if (!(WIFEXITED(stat) && (WEXITSTATUS(stat) == 0))) {
-		fprintf(stderr, "Privilege Separation Test FAILED on RDMSR!\n");
-#ifdef HAVE_LIBLAUS
-		LAUS_LOG(("amtu failed privilege separation on RDMSR"))
-#else
-		AUDIT_LOG("amtu failed privilege separation on RDMSR", 0)
-#endif
-		return(-1);
-	}
+static void amtu_priv_sgdt(void)
+{
+	__asm__ volatile ("sgdt %0" : "=m" (priv_dt));
+}
 
+static void amtu_priv_sidt(void)
+{
+	__asm__ volatile ("sidt %0" : "=m" (priv_dt));
+}
 
-	/*---------------------------------------------------------*/
-	/* Test Elven                                              */
-	/*---------------------------------------------------------*/
-	pid = fork();
-	if (pid == 0) {
-		if (debug) {
-			printf("WRMSR test");
-		}
-		__asm__("WRMSR\n\t");
-		exit(-1);
-	} else if (pid == -1) {
-		/* error condition */
-		fprintf(stderr, "Privilege Separation Test FAILED on (WRMSR)!\n");
-#ifdef HAVE_LIBLAUS
-		LAUS_LOG(("amtu failed privilege separation on WRMSR"))
-#else
-		AUDIT_LOG("amtu failed privilege separation on WRMSR", 0)
-#endif
-		return(-1);
-	}
-	wpid = wait(&stat);
-	if (!(WIFEXITED(stat) && (WEXITSTATUS(stat) == 0))) {
-		fprintf(stderr, "Privilege Separation Test FAILED on WRMSR!\n");
-#ifdef HAVE_LIBLAUS
-		LAUS_LOG(("amtu failed privilege separation on WRMSR"))
-#else
-		AUDIT_LOG("amtu failed privilege separation on WRMSR", 0)
-#endif
-		return(-1);
-	}
-#endif 
+static int cpu_umip(void)
+{
+	return amtu_cpuinfo_flag("umip");
+}
 
-#ifdef HAVE_LIBLAUS
-	LAUS_LOG(("amtu - Privileged Instruction Test succeeded"))
-#else
-	AUDIT_LOG("amtu - Privileged Instruction Test succeeded", 1)
-#endif
-	printf("Privileged Instruction Test SUCCESS!\n");
-	return(0);
+static int umip_gdt(void)
+{
+	return priv_dt.base == UMIP_GDT_BASE && priv_dt.limit == 0 ? 0 : -1;
+}
+
+static int umip_idt(void)
+{
+	return priv_dt.base == UMIP_IDT_BASE && priv_dt.limit == 0 ? 0 : -1;
 }
+
+#define GP	PRIV_SIG(SIGSEGV), SI_KERNEL
+#define VM	PRIV_SIG(SIGILL) | PRIV_SIG(SIGSEGV), PRIV_ANYCODE
+#define CAT	PRIV_PC | PRIV_BATCH
+
+const struct priv_insn priv_insns[] = {
+	{ "HLT",	amtu_priv_hlt,		GP, PRIV_PC, NULL, NULL },
+	{ "RDPMC",	amtu_priv_rdpmc,	GP, PRIV_PC, NULL, NULL },
+	{ "CLTS",	amtu_priv_clts,		GP, PRIV_PC, NULL, NULL },
+	{ "LGDT",	amtu_priv_lgdt,		GP, PRIV_PC, NULL, NULL },
+	{ "LIDT",	amtu_priv_lidt,		GP, PRIV_PC, NULL, NULL },
+	{ "LTR",	amtu_priv_ltr,		GP, PRIV_PC, NULL, NULL },
+	{ "LLDT",	amtu_priv_lldt,		GP, PRIV_PC, NULL, NULL },
+#if defined(HAVE_X86_64)
+	{ "LMSW",	amtu_priv_lmsw,		GP, PRIV_PC, NULL, NULL },
+	{ "RDMSR",	amtu_priv_rdmsr,	GP, PRIV_PC, NULL, NULL },
+	{ "WRMSR",	amtu_priv_wrmsr,	GP, PRIV_PC, NULL, NULL },
+#endif
+	{ "INVD",	amtu_priv_invd,		GP, CAT, NULL, NULL },
+	{ "WBINVD",	amtu_priv_wbinvd,	GP, CAT, NULL, NULL },
+	{ "INVLPG",	amtu_priv_invlpg,	GP, CAT, NULL, NULL },
+	{ "MOV-CR0",	amtu_priv_rdcr0,	GP, CAT, NULL, NULL },
+	{ "MOV-TO-CR0",	amtu_priv_wrcr0,	GP, CAT, NULL, NULL },
+	{ "MOV-CR3",	amtu_priv_rdcr3,	GP, CAT, NULL, NULL },
+	{ "MOV-TO-CR3",	amtu_priv_wrcr3,	GP, CAT, NULL, NULL },
+	{ "MOV-CR4",	amtu_priv_rdcr4,	GP, CAT, NULL, NULL },
+	{ "MOV-TO-CR4",	amtu_priv_wrcr4,	GP, CAT, NULL, NULL },
+	{ "MOV-DR7",	amtu_priv_rddr7,	GP, CAT, NULL, NULL },
+	{ "MOV-TO-DR7",	amtu_priv_wrdr7,	GP, CAT, NULL, NULL },
+	{ "IN",		amtu_priv_in,		GP, CAT, NULL, NULL },
+	{ "OUT",	amtu_priv_out,		GP, CAT, NULL, NULL },
+	{ "CLI",	amtu_priv_cli,		GP, CAT, NULL, NULL },
+	{ "STI",	amtu_priv_sti,		GP, CAT, NULL, NULL },
+	{ "XSETBV",	amtu_priv_xsetbv,	GP, CAT, cpu_osxsave, NULL },
+	{ "VMXON",	amtu_priv_vmxon,	VM, CAT, cpu_vmx, NULL },
+	{ "VMRUN",	amtu_priv_vmrun,	VM, CAT, cpu_svm, NULL },
+	{ "WRPKRU-ECX",	amtu_priv_wrpkru,	GP, PRIV_BATCH,
+	  cpu_ospke, NULL },
+	{ "RDPKRU-ECX",	amtu_priv_rdpkru,	GP, PRIV_BATCH,
+	  cpu_ospke, NULL },
+	{ "SGDT-UMIP",	amtu_priv_sgdt,		GP, PRIV_BATCH,
+	  cpu_umip, umip_gdt },
+	{ "SIDT-UMIP",	amtu_priv_sidt,		GP, PRIV_BATCH,
+	  cpu_umip, umip_idt },
+	{ NULL, NULL, 0, 0, 0, NULL, NULL }
+};
 #endif
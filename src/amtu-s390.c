@@ -39,226 +39,46 @@
 #include <signal.h>
 #include <sys/types.h>
 #include <syslog.h>
-#include <sys/wait.h>
 #include "amtu.h"
 
 #ifdef HAVE_S390
 
-/************************************************************************/
-/*                                                                      */
-/* FUNCTION: catchfault                                                 */
-/*                                                                      */
-/* PURPOSE: Signal handler to catch the segmentation violation which is */
-/*          expected when trying to execute privileged instructions     */
-/*          without privilege.                                          */
-/*                                                                      */
-/************************************************************************/
-void catchfault(int sig)
+/* Each instruction should fault since they are privileged instructions. */
+
+static void priv_ptlb(void)
 {
-	if (debug) {
-		printf("caught the fault %d\n", sig);
-	}
-	exit(0);
+	__asm__ ("PTLB\n\t");
 }
 
-
-/************************************************************************/
-/*                                                                      */
-/* FUNCTION: amtu_priv                                                  */
-/*                                                                      */
-/* PURPOSE: Execute privileged instructions to ensure that they cannot  */
-/*          legitimately be run in user mode.                           */
-/*                                                                      */
-/************************************************************************/
-int amtu_priv(int argc, char *argv[])
+static void priv_hsch(void)
 {
-	struct sigaction sig;
-	pid_t pid, wpid;
-	int stat;
-	
-	printf("Executing Supervisor Mode Instructions Test...\n");
-
-	sig.sa_handler = catchfault;
-	sig.sa_flags = 0;
-	sigemptyset(&sig.sa_mask);
-	sigaction(SIGSEGV, &sig, NULL);
-	sigaction(SIGILL, &sig, NULL);
-
-	/* Each assembly directive should seg fault since they are */
-	/* privileged instructions.                                */
-	/* RDPMC can be used in user space if correct flags are    */
-	/* set but Linux does not set those flags.                 */
-	/* See Chapter 4 of Intel's Systems Programming Guide      */
-
-	/*------------------------*/
-	/* First Instruction Test */
-	/*------------------------*/
-	pid = fork();
-	if (pid == 0) {
-		/* child */
-		if (debug) {
-			printf("PTLB test: ");
-		}
-		__asm__ ("PTLB\n\t");
-		exit(-1);
-	} else if (pid == -1) {
-		/* error condition */
-		fprintf(stderr, "Privilege Separation Test FAILED (PTLB)!\n");
-#ifdef HAVE_LIBLAUS
-		LAUS_LOG(("amtu failed privilege separation on PTLB"))
-#else
-		AUDIT_LOG("amtu failed privilege separation on PTLB", 0)
-#endif
-		exit(-1);
-	}
-	/* parent */
-	wpid = wait(&stat);
-	if (!(WIFEXITED(stat) && (WEXITSTATUS(stat) == 0))) {
-		fprintf(stderr, "Privilege Separation Test FAILED on PTLB!\n");
-#ifdef HAVE_LIBLAUS
-		LAUS_LOG(("amtu failed privilege separation on PTLB"))
-#else
-		AUDIT_LOG("amtu failed privilege separation on PTLB", 0)
-#endif
-		return(-1);
-	}
-
-	/*-------------------------*/
-	/* Second Instruction Test */
-	/*-------------------------*/
-	pid = fork();
-	if (pid == 0) {
-		/* child */
-		if (debug) {
-			printf("HSCH test: ");
-		}
-		__asm__ ("HSCH\n\t");
-		exit(-1);
-	} else if (pid == -1) {
-		/* error condition */
-		fprintf(stderr, "Privilege Separation Test FAILED (HSCH)!\n");
-#ifdef HAVE_LIBLAUS
-		LAUS_LOG(("amtu failed privilege separation on HSCH"))
-#else
-		AUDIT_LOG("amtu failed privilege separation on HSCH", 0)
-#endif
-		exit(-1);
-	}
-	/* parent */
-	wpid = wait(&stat);
-	if (!(WIFEXITED(stat) && (WEXITSTATUS(stat) == 0))) {
-		fprintf(stderr, "Privilege Separation Test FAILED on HSCH!\n");
-#ifdef HAVE_LIBLAUS
-		LAUS_LOG(("amtu failed privilege separation on HSCH"))
-#else
-		AUDIT_LOG("amtu failed privilege separation on HSCH", 0)
-#endif
-		return(-1);
-	}
+	__asm__ ("HSCH\n\t");
+}
 
-	/*------------------------*/
-	/* Third Instruction Test */
-	/*------------------------*/
-	pid = fork();
-	if (pid == 0) {
-		if (debug) {
-			printf("PALB test: ");
-		}
-		__asm__ ("PALB\n\t");
-		exit(-1);
-	} else if (pid == -1) {
-		/* error condition */
-		fprintf(stderr, "Privilege Separation Test FAILED (PALB)!\n");
-#ifdef HAVE_LIBLAUS
-		LAUS_LOG(("amtu failed privilege separation on PALB"))
-#else
-		AUDIT_LOG("amtu failed privilege separation on PALB", 0)
-#endif
-		exit(-1);
-	}
-	/* parent */
-	wpid = wait(&stat);
-	if (!(WIFEXITED(stat) && (WEXITSTATUS(stat) == 0))) {
-		fprintf(stderr, "Privilege Separation Test FAILED on PALB!\n");
-#ifdef HAVE_LIBLAUS
-		LAUS_LOG(("amtu failed privilege separation on PALB"))
-#else
-		AUDIT_LOG("amtu failed privilege separation on PALB", 0)
-#endif
-		return(-1);
-	}
+static void priv_palb(void)
+{
+	__asm__ ("PALB\n\t");
+}
 
-	/*------------------------*/
-	/* Fourth Instruction Test */
-	/*------------------------*/
-	pid = fork();
-	if (pid == 0) {
-		if (debug) {
-			printf("RRBE test: ");
-		}
-		__asm__ ("RRBE 4,8\n\t");
-		exit(-1);
-	} else if (pid == -1) {
-		/* error condition */
-		fprintf(stderr, "Privilege Separation Test FAILED (RRBE)!\n");
-#ifdef HAVE_LIBLAUS
-		LAUS_LOG(("amtu failed privilege separation on RRBE"))
-#else
-		AUDIT_LOG("amtu failed privilege separation on RRBE", 0)
-#endif
-		exit(-1);
-	}
-	/* parent */
-	wpid = wait(&stat);
-	if (!(WIFEXITED(stat) && (WEXITSTATUS(stat) == 0))) {
-		fprintf(stderr, "Privilege Separation Test FAILED on RRBE!\n");
-#ifdef HAVE_LIBLAUS
-		LAUS_LOG(("amtu failed privilege separation on RRBE"))
-#else
-		AUDIT_LOG("amtu failed privilege separation on RRBE", 0)
-#endif
-		return(-1);
-	}
+static void priv_rrbe(void)
+{
+	__asm__ ("RRBE 4,8\n\t");
+}
 
-	/*------------------------*/
-	/* Fifth Instruction Test */
-	/*------------------------*/
-	pid = fork();
-	if (pid == 0) {
-		if (debug) {
-			printf("EPAR test: ");
-		}
-		__asm__ ("EPAR 1\n\t");
-		exit(-1);
-	} else if (pid == -1) {
-		/* error condition */
-		fprintf(stderr, "Privilege Separation Test FAILED (EPAR)!\n");
-#ifdef HAVE_LIBLAUS
-		LAUS_LOG(("amtu failed privilege separation on EPAR"))
-#else
-		AUDIT_LOG("amtu failed privilege separation on EPAR", 0)
-#endif
-		exit(-1);
-	}
-	/* parent */
-	wpid = wait(&stat);
-	if (!(WIFEXITED(stat) && (WEXITSTATUS(stat) == 0))) {
-		fprintf(stderr, "Privilege Separation Test FAILED on EPAR!\n");
-#ifdef HAVE_LIBLAUS
-		LAUS_LOG(("amtu failed privilege separation on EPAR"))
-#else
-		AUDIT_LOG("amtu failed privilege separation on EPAR", 0)
-#endif
-		return(-1);
-	}
+static void priv_epar(void)
+{
+	__asm__ ("EPAR 1\n\t");
+}
 
+/* SIGILL or SIGSEGV, with any si_code */
+#define FAULT	PRIV_SIG(SIGILL) | PRIV_SIG(SIGSEGV), PRIV_ANYCODE
 
-#ifdef HAVE_LIBLAUS
-	LAUS_LOG(("amtu - Privileged Instruction Test succeeded"))
-#else
-	AUDIT_LOG("amtu - Privileged Instruction Test succeeded", 1)
-#endif
-	printf("Privileged Instruction Test SUCCESS!\n");
-	return(0);
-}
+const struct priv_insn priv_insns[] = {
+	{ "PTLB",	priv_ptlb,	FAULT, 0, NULL, NULL },
+	{ "HSCH",	priv_hsch,	FAULT, 0, NULL, NULL },
+	{ "PALB",	priv_palb,	FAULT, 0, NULL, NULL },
+	{ "RRBE",	priv_rrbe,	FAULT, 0, NULL, NULL },
+	{ "EPAR",	priv_epar,	FAULT, 0, NULL, NULL },
+	{ NULL, NULL, 0, 0, 0, NULL, NULL }
+};
 #endif
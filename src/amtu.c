@@ -50,37 +50,321 @@
 #include <syslog.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <time.h>
 #include "amtu.h"
 
 int debug;
 
+int amtu_threads = 0;
+int memsep_probes = 32;
+int memsep_probes_gb = 0;
+int memsep_fork = 0;
+int memsep_kprobes = 4096;
+int memsep_regions = 256;
+int memsep_syscalls = 4096;
+int procsep_victims = 16;
+int procsep_rounds = 64;
+int procsep_kb = 64;
+int procsep_uid = -1;
+int cow_mb = 64;
+int cow_children = 0;
+int aslr_samples = 2048;
+int aslr_min_bits = 8;
+int priv_inproc = 1;
+int priv_bench = 1000;
+int priv_bench_max_ns = 0;
+int priv_percpu = 0;
+int priv_ioports = 1;
+int priv_fuzz = 0;
+int priv_fuzz_seed = 0;
+int net_timeout_ms = 1000;
+int net_engine = NET_ENGINE_SOCKET;
+int net_frames = 1000;
+int net_burst = 64;
+int net_sweep = 1;
+int net_loss_ppm = 0;
+int net_seed = 0;
+int net_xdp_queue = 0;
+int net_xdp_skb = 1;
+int net_veth = 0;
+int net_netem_delay_us = 0;
+int net_netem_loss_ppm = 0;
+char *net_include = NULL;
+char *net_exclude = NULL;
+
+/* Tunables accepted by -o name=value[,name=value...] */
+struct tunable {
+	const char *name;
+	int *value;
+	const char *help;
+};
+
+static struct tunable tunables[] = {
+	{ "threads", &amtu_threads,
+	  "worker threads or processes per test (0 = online CPUs)" },
+	{ "memsep_probes", &memsep_probes,
+	  "random probes per memory region, plus both edges" },
+	{ "memsep_probes_gb", &memsep_probes_gb,
+	  "additional probes per GB of region size" },
+	{ "memsep_fork", &memsep_fork,
+	  "1 = probe in child processes instead of threads" },
+	{ "memsep_kprobes", &memsep_kprobes,
+	  "probes per kernel address range (0 = skip kernel sweep)" },
+	{ "memsep_regions", &memsep_regions,
+	  "regions per protection in the guard/NX sweep (0 = skip)" },
+	{ "memsep_syscalls", &memsep_syscalls,
+	  "addresses per range passed to system calls (0 = skip)" },
+	{ "procsep_victims", &procsep_victims,
+	  "victim processes in the cross-process test" },
+	{ "procsep_rounds", &procsep_rounds,
+	  "attempts on each victim per access method" },
+	{ "procsep_kb", &procsep_kb,
+	  "KB of canary filled memory in each victim" },
+	{ "procsep_uid", &procsep_uid,
+	  "uid the victims run as (-1 = root)" },
+	{ "cow_mb", &cow_mb,
+	  "MB of memory shared copy-on-write with the children" },
+	{ "cow_children", &cow_children,
+	  "children in the copy-on-write test (0 = threads)" },
+	{ "aslr_samples", &aslr_samples,
+	  "processes sampled by the address space randomization test" },
+	{ "aslr_min_bits", &aslr_min_bits,
+	  "bits of entropy required for each randomized region" },
+	{ "priv_inproc", &priv_inproc,
+	  "1 = trap privileged instructions in-process, 0 = fork" },
+	{ "priv_bench", &priv_bench,
+	  "trap latency iterations per instruction (0 = skip)" },
+	{ "priv_bench_max_ns", &priv_bench_max_ns,
+	  "fail if a median trap latency is above this (0 = off)" },
+	{ "priv_percpu", &priv_percpu,
+	  "1 = also run the instructions on every CPU concurrently" },
+	{ "priv_ioports", &priv_ioports,
+	  "1 = IN/OUT on every I/O port as nobody and root (x86)" },
+	{ "priv_fuzz", &priv_fuzz,
+	  "system opcode encodings to fuzz, all first (0 = skip)" },
+	{ "priv_fuzz_seed", &priv_fuzz_seed,
+	  "seed of the random fuzzer variants (0 = time)" },
+	{ "net_timeout_ms", &net_timeout_ms,
+	  "ms the network test waits for its packets" },
+	{ "net_engine", &net_engine,
+	  "network test: 0 = socket, 1 = packet rings, 2 = latency, "
+	  "3 = sendmmsg, 4 = AF_XDP, 5 = RX queues" },
+	{ "net_frames", &net_frames,
+	  "frames per interface of the ring, latency and batch engines" },
+	{ "net_burst", &net_burst,
+	  "frames the ring and batch engines queue per send call" },
+	{ "net_sweep", &net_sweep,
+	  "1 = ring engine sweeps frame sizes 64 bytes to the MTU" },
+	{ "net_loss_ppm", &net_loss_ppm,
+	  "frames per million the ring engine may lose" },
+	{ "net_seed", &net_seed,
+	  "seed of the network test payload pattern (0 = time)" },
+	{ "net_xdp_queue", &net_xdp_queue,
+	  "queue the AF_XDP engine binds to" },
+	{ "net_xdp_skb", &net_xdp_skb,
+	  "0 = AF_XDP engine attaches XDP in the driver if it can" },
+	{ "net_veth", &net_veth,
+	  "test this many veth pairs in a private namespace (0 = off)" },
+	{ "net_netem_delay_us", &net_netem_delay_us,
+	  "netem delay of the veth pairs, in us" },
+	{ "net_netem_loss_ppm", &net_netem_loss_ppm,
+	  "netem loss of the veth pairs, frames per million" },
+	{ NULL, NULL, NULL }
+};
+
+/* Tunables taking a string, NULL when not set */
+struct string_tunable {
+	const char *name;
+	char **value;
+	const char *help;
+};
+
+static struct string_tunable string_tunables[] = {
+	{ "net_include", &net_include,
+	  "network interfaces to test, as name:name... shell patterns" },
+	{ "net_exclude", &net_exclude,
+	  "network interfaces not to test, as name:name... patterns" },
+	{ NULL, NULL, NULL }
+};
+
 void usage()
 {
-	printf("Usage: amtu [-dmsinph]\n");
+	struct tunable *t;
+	struct string_tunable *st;
+
+	printf("Usage: amtu [-dmsxcainph] [-o name=value[,...]]\n");
 	printf("d      Display debug messages\n");
 	printf("m      Execute Memory Test\n");
 	printf("s      Execute Memory Separation Test\n");
+	printf("x      Execute Cross-Process Memory Separation Test\n");
+	printf("c      Execute Copy-on-Write Isolation Test\n");
+	printf("a      Execute Address Space Randomization Test (not run "
+		"by default)\n");
 	printf("i      Execute I/O Controller - Disk Test\n");
 	printf("n      Execute I/O Controller - Network Test\n");
 	printf("p      Execute Supervisor Mode Instructions Test\n");
 	printf("h      Display help message\n");
+	printf("o      Set tunables:\n");
+	for (t = tunables; t->name; t++)
+		printf("       %-20s %s (%d)\n", t->name, t->help, *t->value);
+	for (st = string_tunables; st->name; st++)
+		printf("       %-20s %s (%s)\n", st->name, st->help,
+			*st->value ? *st->value : "none");
 	exit(-1);
 }
 
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: set_tunables                                               */
+/*                                                                      */
+/* PURPOSE: Parse a comma separated list of name=value pairs given to   */
+/*          -o and store the values in the matching tunables.           */
+/*                                                                      */
+/************************************************************************/
+void set_tunables(char *arg)
+{
+	struct tunable *t;
+	struct string_tunable *st;
+	char *opt, *val, *end, *save = NULL;
+
+	for (opt = strtok_r(arg, ",", &save); opt;
+	     opt = strtok_r(NULL, ",", &save)) {
+		val = strchr(opt, '=');
+		if (val == NULL) {
+			fprintf(stderr, "Missing value for option %s\n", opt);
+			usage();
+		}
+		*val++ = '\0';
+		for (st = string_tunables; st->name; st++)
+			if (strcmp(st->name, opt) == 0)
+				break;
+		if (st->name != NULL) {
+			*st->value = val;
+			continue;
+		}
+		for (t = tunables; t->name; t++)
+			if (strcmp(t->name, opt) == 0)
+				break;
+		if (t->name == NULL) {
+			fprintf(stderr, "Unknown option %s\n", opt);
+			usage();
+		}
+		*t->value = strtol(val, &end, 0);
+		if (*val == '\0' || *end != '\0') {
+			fprintf(stderr, "Bad value for option %s: %s\n",
+				opt, val);
+			usage();
+		}
+	}
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: amtu_nthreads                                              */
+/*                                                                      */
+/* PURPOSE: Number of workers a test should use: the threads tunable,   */
+/*          or the number of online CPUs when it is not set.            */
+/*                                                                      */
+/************************************************************************/
+int amtu_nthreads(void)
+{
+	long n = amtu_threads;
+
+	if (n <= 0)
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n <= 0)
+		n = 1;
+	if (n > MAXTHREADS)
+		n = MAXTHREADS;
+	return n;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: amtu_now                                                   */
+/*                                                                      */
+/* PURPOSE: Monotonic time in seconds, used for the rates reported by   */
+/*          the tests.                                                  */
+/*                                                                      */
+/************************************************************************/
+double amtu_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: amtu_cpuinfo_flag                                          */
+/*                                                                      */
+/* PURPOSE: Returns 1 if the first "flags" line of /proc/cpuinfo lists  */
+/*          the given CPU feature, 0 otherwise.                         */
+/*                                                                      */
+/************************************************************************/
+int amtu_cpuinfo_flag(const char *flag)
+{
+	FILE *fp;
+	char line[4096];
+	char *p;
+	size_t len = strlen(flag);
+	int found = 0;
+
+	fp = fopen("/proc/cpuinfo", "r");
+	if (fp == NULL)
+		return 0;
+	while (fgets(line, sizeof line, fp)) {
+		if (strncmp(line, "flags", 5) != 0)
+			continue;
+		for (p = strchr(line, ':'); p && !found; p = strchr(p, ' ')) {
+			p++;
+			if (strncmp(p, flag, len) == 0 &&
+			    (p[len] == ' ' || p[len] == '\n'))
+				found = 1;
+		}
+		break;
+	}
+	fclose(fp);
+	return found;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: amtu_helper                                                */
+/*                                                                      */
+/* PURPOSE: Some tests re-execute amtu as "amtu --helper=name args" to  */
+/*          get fresh processes; run the named helper.                  */
+/*                                                                      */
+/************************************************************************/
+int amtu_helper(const char *name, int argc, char *argv[])
+{
+	if (strcmp(name, "victim") == 0)
+		return procsep_victim(argc, argv);
+	if (strcmp(name, "aslr") == 0)
+		return aslr_helper(argc, argv);
+	fprintf(stderr, "Unknown helper %s\n", name);
+	return 2;
+}
+
 int main(int argc, char *argv[])
 {
 	int rc = 0;
 	int c;
 	int memtest = 0, memseptest = 0, disktest = 0;
-	int nettest = 0, privtest = 0;
+	int nettest = 0, privtest = 0, procseptest = 0;
+	int copytest = 0, aslrtest = 0;
 	int testspecified = 1;
 	char msg[50];
 
+	if (argc > 1 && strncmp(argv[1], "--helper=", 9) == 0)
+		return amtu_helper(argv[1] + 9, argc - 1, argv + 1);
+
 #ifdef HAVE_LIBLAUS
 	LAUS_OPEN
 #endif
 	
-	while ((c = getopt(argc, argv, "dmsinph")) != -1) { 
+	while ((c = getopt(argc, argv, "dmsxcainpho:")) != -1) { 
 		switch (c) {
 			case 'd':
 				debug = 1;
@@ -93,6 +377,18 @@ int main(int argc, char *argv[])
 				memseptest++;
 				testspecified = 0;
 				break;
+			case 'x':
+				procseptest++;
+				testspecified = 0;
+				break;
+			case 'c':
+				copytest++;
+				testspecified = 0;
+				break;
+			case 'a':
+				aslrtest++;
+				testspecified = 0;
+				break;
 			case 'i':
 				disktest++;
 				testspecified = 0;
@@ -108,6 +404,9 @@ int main(int argc, char *argv[])
 			case 'h':
 				usage();
 				break;
+			case 'o':
+				set_tunables(optarg);
+				break;
 			default:
 				usage();
 				break;
@@ -124,6 +423,21 @@ int main(int argc, char *argv[])
 		rc |= memsep(argc, argv);
 	}
 
+	// Invoke Cross-Process Memory Separation Test
+	if (testspecified || procseptest) {
+		rc |= procsep(argc, argv);
+	}
+
+	// Invoke Copy-on-Write Isolation Test
+	if (testspecified || copytest) {
+		rc |= cowtest(argc, argv);
+	}
+
+	// Invoke Address Space Randomization Test, only on request
+	if (aslrtest) {
+		rc |= aslr(argc, argv);
+	}
+
 	// Invoke I/O Controller - Network Test
 	if (testspecified || nettest) {
 		rc |= networkio(argc, argv);
@@ -28,12 +28,186 @@
 #define _AMTU_H_
 extern int debug;
 
+#define MAXTHREADS	256	/* upper bound for amtu_nthreads() */
+
+/* Tunables, set with -o name=value (see amtu.c) */
+extern int amtu_threads;
+extern int memsep_probes;
+extern int memsep_probes_gb;
+extern int memsep_fork;
+extern int memsep_kprobes;
+extern int memsep_regions;
+extern int memsep_syscalls;
+extern int procsep_victims;
+extern int procsep_rounds;
+extern int procsep_kb;
+extern int procsep_uid;
+extern int cow_mb;
+extern int cow_children;
+extern int aslr_samples;
+extern int aslr_min_bits;
+extern int priv_inproc;
+extern int priv_bench;
+extern int priv_bench_max_ns;
+extern int priv_percpu;
+extern int priv_ioports;
+extern int priv_fuzz;
+extern int priv_fuzz_seed;
+extern int net_timeout_ms;
+extern int net_engine;
+extern int net_frames;
+extern int net_burst;
+extern int net_sweep;
+extern int net_loss_ppm;
+extern int net_seed;
+extern int net_xdp_queue;
+extern int net_xdp_skb;
+extern int net_veth;
+extern int net_netem_delay_us;
+extern int net_netem_loss_ppm;
+extern char *net_include;
+extern char *net_exclude;
+
 /* Function Prototypes */
 int memory(int, char **);
 int memsep(int, char **);
 int iodisktest(int, char **);
 int amtu_priv(int, char **);
+int ioport_sweep(void);
+int priv_fuzz_run(void);
 int networkio(int, char **);
+int procsep(int, char **);
+int cowtest(int, char **);
+int aslr(int, char **);
+
+/* Helper processes started by the tests, "amtu --helper=name" */
+int procsep_victim(int, char **);
+int aslr_helper(int, char **);
+
+/* Helpers shared by the tests (amtu.c) */
+int amtu_nthreads(void);
+double amtu_now(void);
+int amtu_cpuinfo_flag(const char *);
+
+/* Privileged instruction tables (amtu-<arch>.c), run by priv.c */
+#define PRIV_SIG(s)	(1 << (s))
+#define PRIV_ANYCODE	0x7fffffff	/* any si_code is accepted */
+#define PRIV_IGNORE	1	/* run and report, but do not check */
+#define PRIV_PC		2	/* probe starts with the instruction */
+#define PRIV_BATCH	4	/* fork mode: run in the one catalog child */
+
+struct priv_insn {
+	const char *name;
+	void (*probe)(void);	/* executes the instruction */
+	int signals;		/* PRIV_SIG() of each signal it may raise */
+	int code;		/* si_code it must raise in-process */
+	int flags;
+	int (*available)(void);	/* NULL, or 0 if the CPU lacks it */
+	int (*verify)(void);	/* NULL, or the probe may complete when
+				   emulated, and this checks its result */
+};
+
+/*
+ * Define probe "name" in assembler (x86 and aarch64), starting with the
+ * instructions tested and returning after them, for entries flagged
+ * PRIV_PC: the signal must then be raised at the address of the probe.
+ */
+#define PRIV_STUB(name, insns)						\
+	void name(void) __attribute__((visibility("hidden")));		\
+	__asm__(".text\n\t.globl " #name "\n\t.hidden " #name		\
+		"\n\t.type " #name ", %function\n" #name ":\n\t"		\
+		insns "\n\tret\n\t.size " #name ", .-" #name "\n")
+
+extern const struct priv_insn priv_insns[];
+
+/* In-process fault trapping (trap.c) */
+struct trap_info {
+	int sig;	/* signal raised, 0 if none */
+	int code;	/* si_code of the signal */
+	void *addr;	/* si_addr of the signal */
+	void *pc;	/* faulting instruction, NULL if unknown */
+};
+
+int trap_init(void);
+int trap_load(const volatile int *, int *, struct trap_info *);
+int trap_store(volatile int *, int, struct trap_info *);
+int trap_call(void (*)(void), struct trap_info *);
+
+/* Network I/O test (networkio.c), its packet ring and batch
+   (netring.c), latency (netlat.c), AF_XDP (netxdp.c) and RX queue
+   (netfanout.c) engines, and its veth namespace (netns.c) */
+#define MSGSIZE		512	/* bytes of the payload pattern */
+#define NET_MAGIC	"AMTU"	/* first bytes of every message */
+#define NET_HDRLEN	16	/* magic, sequence number, seed, CRC32C */
+#define NET_FRAMELEN	(NET_HDRLEN + MSGSIZE)	/* the whole pattern */
+#define NET_MINFRAME	64	/* smallest frame of a size sweep */
+#define NET_STRIDE	97	/* bytes between the lengths of frames */
+#define NET_REPORTS	8	/* bad frames reported per interface */
+
+#define NET_ENGINE_SOCKET	0	/* one packet, recvfrom() */
+#define NET_ENGINE_RING		1	/* TPACKET_V3 rings */
+#define NET_ENGINE_LATENCY	2	/* SO_TIMESTAMPING round trips */
+#define NET_ENGINE_MMSG		3	/* sendmmsg() and recvmmsg() */
+#define NET_ENGINE_XDP		4	/* AF_XDP socket on one queue */
+#define NET_ENGINE_FANOUT	5	/* PACKET_FANOUT, a thread per queue */
+
+struct interface_info {
+	unsigned int ifindex;
+	char ifname[16];		/* IFNAMSIZ */
+	unsigned char lladdr[14];
+	unsigned int halen;		/* length of lladdr */
+	unsigned int mtu;
+};
+
+/* State of the test of one interface */
+struct if_test {
+	struct interface_info *iff;
+	int rsock;		/* receive socket, -1 if none */
+	int ssock;		/* send socket, -1 if none */
+	double sent;		/* when the first packet was sent */
+	double rtt;		/* until it came back, < 0 if it did not */
+	double last;		/* when the last packet came back */
+	unsigned long frames;	/* good packets received */
+	unsigned long long bytes;	/* in the good packets */
+	unsigned long bad;	/* packets with the wrong contents */
+	unsigned long reordered;	/* good, but after a later one */
+	unsigned long dups;	/* good, but received before */
+	unsigned int syndrome;	/* bits that differed in bad packets */
+	int reports;		/* bad packets reported */
+	int failed;
+};
+
+/* Numbered frames sent on one interface */
+struct net_stream {
+	unsigned int next;	/* next sequence number to send */
+	unsigned int high;	/* one past the highest seq received */
+	unsigned int maxlen;	/* longest frame sent */
+	unsigned int count;	/* frames to send, net_frames */
+	int burst;		/* frames per batch, net_burst */
+	unsigned char *seen;	/* sequence numbers received */
+};
+
+extern unsigned char msgstr[2 * MSGSIZE];
+int net_attach_filter(int, int);
+int open_receiver(struct interface_info *, int);
+int open_sender(struct interface_info *);
+struct sockaddr_ll;
+int net_sender(struct if_test *, int, const struct sockaddr_ll *);
+void net_dest(struct interface_info *, struct sockaddr_ll *);
+void net_pattern(unsigned int);
+void net_frame(unsigned char *, unsigned int, int);
+int net_check_frame(struct if_test *, const unsigned char *, int,
+		    unsigned int *);
+int net_stream_len(struct net_stream *, unsigned int);
+unsigned int net_rxqueues(const char *);
+void net_limits(int, unsigned int *, int *);
+void net_account(struct if_test *, struct net_stream *,
+		 const unsigned char *, int, double);
+int ring_test(struct if_test *, int);
+int latency_test(struct if_test *, int);
+int xdp_test(struct if_test *, int);
+int fanout_test(struct if_test *, int);
+int netns_run(int, char **);
 
 /* LAuS defines from Tom Lendacky */
 #ifdef HAVE_LIBLAUS
@@ -0,0 +1,339 @@
+//----------------------------------------------------------------------
+//
+// Module Name:  aslr.c
+//
+// Include File:  none
+//
+// Description:   Code for Abstract Machine Test Utility - Address Space
+//                Randomization Test.
+//
+// Notes:  This module spawns aslr_samples short-lived copies of amtu as
+//         "amtu --helper=aslr", spread over the worker threads.  Each
+//         reports the address of its stack, an anonymous mapping, the
+//         heap, the vDSO and the executable over a pipe and exits.  The
+//         entropy observed for each region, the sum of the entropy of
+//         each address bit, must be at least aslr_min_bits.  The heap is
+//         only checked when randomize_va_space is 2 and the executable
+//         only when it is position independent.  The return codes are
+//         as follows:
+//         -1 = failure occurred
+//          0 = success
+// -----------------------------------------------------------------
+// LANGUAGE:     C
+//
+// Licensed under the Common Public License v. 1.0
+// -----------------------------------------------------------------
+
+#define _GNU_SOURCE
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <spawn.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <elf.h>
+#include <link.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/auxv.h>
+#include "amtu.h"
+
+#define ASLR_STACK	0
+#define ASLR_MMAP	1
+#define ASLR_HEAP	2
+#define ASLR_VDSO	3
+#define ASLR_PIE	4
+#define ASLR_REGIONS	5
+
+static const char *aslr_names[ASLR_REGIONS] = {
+	"stack", "mmap", "heap", "vDSO", "executable"
+};
+
+extern char **environ;
+
+/* What a helper reports */
+struct aslr_sample {
+	uintptr_t addr[ASLR_REGIONS];
+};
+
+struct aslr_job {
+	struct aslr_sample *samples;
+	int nsamples;
+	int id;
+	int nthreads;
+	int failed;
+};
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: aslr_helper                                                */
+/*                                                                      */
+/* PURPOSE: Body of a helper process: write where our regions ended up  */
+/*          to stdout.                                                  */
+/*                                                                      */
+/************************************************************************/
+int aslr_helper(int argc, char *argv[])
+{
+	struct aslr_sample s;
+	int local;
+	void *map;
+
+	map = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED)
+		return 2;
+	s.addr[ASLR_STACK] = (uintptr_t)&local;
+	s.addr[ASLR_MMAP] = (uintptr_t)map;
+	s.addr[ASLR_HEAP] = (uintptr_t)sbrk(0);
+	s.addr[ASLR_VDSO] = getauxval(AT_SYSINFO_EHDR);
+	s.addr[ASLR_PIE] = getauxval(AT_PHDR);
+	if (write(1, &s, sizeof(s)) != sizeof(s))
+		return 2;
+	return 0;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: spawn_sample                                               */
+/*                                                                      */
+/* PURPOSE: posix_spawn() one helper and read its sample.               */
+/*                                                                      */
+/************************************************************************/
+static int spawn_sample(struct aslr_sample *s)
+{
+	posix_spawn_file_actions_t fa;
+	char *args[] = { "amtu", "--helper=aslr", NULL };
+	int out[2];
+	int rc, stat;
+	ssize_t n;
+	pid_t pid;
+
+	if (pipe2(out, O_CLOEXEC) < 0)
+		return -1;
+	posix_spawn_file_actions_init(&fa);
+	posix_spawn_file_actions_adddup2(&fa, out[1], 1);
+	rc = posix_spawn(&pid, "/proc/self/exe", &fa, NULL, args, environ);
+	posix_spawn_file_actions_destroy(&fa);
+	close(out[1]);
+	if (rc != 0) {
+		errno = rc;
+		close(out[0]);
+		return -1;
+	}
+	n = read(out[0], s, sizeof(*s));
+	close(out[0]);
+	if (waitpid(pid, &stat, 0) < 0 ||
+	    !(WIFEXITED(stat) && (WEXITSTATUS(stat) == 0)))
+		return -1;
+	return n == sizeof(*s) ? 0 : -1;
+}
+
+static void *aslr_thread(void *arg)
+{
+	struct aslr_job *job = arg;
+	int i;
+
+	for (i = job->id; i < job->nsamples; i += job->nthreads) {
+		if (spawn_sample(&job->samples[i]) < 0) {
+			if (!job->failed)
+				perror("aslr: could not sample a process");
+			job->failed = 1;
+		}
+	}
+	return NULL;
+}
+
+static int cmp_addr(const void *a, const void *b)
+{
+	uintptr_t x = *(const uintptr_t *)a, y = *(const uintptr_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: region_entropy                                             */
+/*                                                                      */
+/* PURPOSE: Estimate the bits of entropy of a region: the sum over all  */
+/*          address bits of the entropy of that bit alone.  Also counts */
+/*          the distinct addresses seen.                                */
+/*                                                                      */
+/************************************************************************/
+static double region_entropy(struct aslr_sample *samples, int n, int region,
+			     uintptr_t *addrs, int *unique)
+{
+	double bits = 0, p;
+	unsigned int b;
+	int i, ones;
+
+	for (i = 0; i < n; i++)
+		addrs[i] = samples[i].addr[region];
+	qsort(addrs, n, sizeof(*addrs), cmp_addr);
+	*unique = n > 0;
+	for (i = 1; i < n; i++)
+		if (addrs[i] != addrs[i - 1])
+			(*unique)++;
+
+	for (b = 0; b < 8 * sizeof(uintptr_t); b++) {
+		ones = 0;
+		for (i = 0; i < n; i++)
+			ones += (addrs[i] >> b) & 1;
+		if (ones == 0 || ones == n)
+			continue;
+		p = (double)ones / n;
+		bits -= p * log2(p) + (1 - p) * log2(1 - p);
+	}
+	return bits;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: is_pie                                                     */
+/*                                                                      */
+/* PURPOSE: Returns 1 if our executable is position independent, so    */
+/*          that its load address can be randomized.                    */
+/*                                                                      */
+/************************************************************************/
+static int is_pie(void)
+{
+	ElfW(Ehdr) eh;
+	int fd, n;
+
+	fd = open("/proc/self/exe", O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+	n = read(fd, &eh, sizeof(eh));
+	close(fd);
+	return n == sizeof(eh) && eh.e_type == ET_DYN;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: randomize_va_space                                         */
+/*                                                                      */
+/* PURPOSE: Returns the kernel.randomize_va_space setting, or -1.       */
+/*                                                                      */
+/************************************************************************/
+static int randomize_va_space(void)
+{
+	FILE *fp;
+	int val = -1;
+
+	fp = fopen("/proc/sys/kernel/randomize_va_space", "r");
+	if (fp == NULL)
+		return -1;
+	if (fscanf(fp, "%d", &val) != 1)
+		val = -1;
+	fclose(fp);
+	return val;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: aslr                                                       */
+/*                                                                      */
+/* PURPOSE: Execute Address Space Randomization Test.                   */
+/*                                                                      */
+/************************************************************************/
+int aslr(int argc, char *argv[])
+{
+	struct aslr_sample *samples;
+	struct aslr_job jobs[MAXTHREADS];
+	pthread_t tids[MAXTHREADS];
+	uintptr_t *addrs;
+	int nsamples = aslr_samples > 1 ? aslr_samples : 2;
+	int nthreads = amtu_nthreads();
+	int va_space = randomize_va_space();
+	int pie = is_pie();
+	int i, j, unique, sampled, rc = 0;
+	double start, elapsed, bits;
+	const char *skip;
+
+	printf("Executing Address Space Randomization Test...\n");
+
+	samples = calloc(nsamples, sizeof(*samples));
+	addrs = calloc(nsamples, sizeof(*addrs));
+	if (samples == NULL || addrs == NULL) {
+		fprintf(stderr, "Could not allocate memory\n");
+		free(samples);
+		free(addrs);
+		return -1;
+	}
+
+	// Sample the helpers in parallel
+	fflush(stdout);
+	start = amtu_now();
+	for (i = 0; i < nthreads; i++) {
+		jobs[i].samples = samples;
+		jobs[i].nsamples = nsamples;
+		jobs[i].id = i;
+		jobs[i].nthreads = nthreads;
+		jobs[i].failed = 0;
+		if (pthread_create(&tids[i], NULL, aslr_thread, &jobs[i]))
+			break;
+	}
+	for (j = 0; j < i; j++) {
+		pthread_join(tids[j], NULL);
+		rc |= jobs[j].failed ? -1 : 0;
+	}
+	if (i < nthreads)
+		rc = -1;
+	elapsed = amtu_now() - start;
+
+	// Samples are missing if spawning failed, don't analyze them
+	sampled = rc == 0;
+	for (i = 0; sampled && i < ASLR_REGIONS; i++) {
+		skip = NULL;
+		if (i == ASLR_HEAP && va_space < 2)
+			skip = "randomize_va_space < 2";
+		if (i == ASLR_PIE && !pie)
+			skip = "not position independent";
+		if (i == ASLR_VDSO && samples[0].addr[i] == 0)
+			skip = "no vDSO";
+		if (skip) {
+			printf("  %-10s not checked, %s\n", aslr_names[i],
+				skip);
+			continue;
+		}
+		bits = region_entropy(samples, nsamples, i, addrs, &unique);
+		printf("  %-10s %6d unique addresses %6.2f bits of entropy\n",
+			aslr_names[i], unique, bits);
+		if (bits < aslr_min_bits) {
+			fprintf(stderr, "Only %.2f bits of entropy in the %s "
+				"address, need %d\n", bits, aslr_names[i],
+				aslr_min_bits);
+			rc = -1;
+		}
+	}
+	printf("%d processes by %d threads: %.3f s, %.0f spawns/s\n",
+		nsamples, nthreads, elapsed,
+		elapsed > 0 ? nsamples / elapsed : 0);
+
+	free(samples);
+	free(addrs);
+
+	if (rc != 0) {
+		fprintf(stderr, "Address Space Randomization Test FAILED!\n");
+#ifdef HAVE_LIBLAUS
+		LAUS_LOG(("amtu failed address space randomization test"))
+#else
+		AUDIT_LOG("amtu failed address space randomization test", 0)
+#endif
+		return -1;
+	}
+
+	fprintf(stderr, "Address Space Randomization Test SUCCESS!\n");
+#ifdef HAVE_LIBLAUS
+	LAUS_LOG(("amtu - Address Space Randomization Test succeeded"))
+#else
+	AUDIT_LOG("amtu - Address Space Randomization Test succeeded", 1)
+#endif
+	return 0;
+}
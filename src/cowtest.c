@@ -0,0 +1,301 @@
+//----------------------------------------------------------------------
+//
+// Module Name:  cowtest.c
+//
+// Include File:  none
+//
+// Description:   Code for Abstract Machine Test Utility - Copy-on-Write
+//                Isolation Test.
+//
+// Notes:  This module checks that writes made after fork() stay
+//         private to the process making them.  A region is filled with
+//         a seeded pattern, then cow_children children each overwrite
+//         their own disjoint set of pages at the same time.  Every
+//         child then checks that it sees its own pages and the
+//         original pattern everywhere else, and the parent checks that
+//         its view is unchanged.  The return codes are as follows:
+//         -1 = failure occurred
+//          0 = success
+// -----------------------------------------------------------------
+// LANGUAGE:     C
+//
+// Licensed under the Common Public License v. 1.0
+// -----------------------------------------------------------------
+
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include "amtu.h"
+
+/* Results of one child, in shared memory */
+struct cow_stats {
+	unsigned long faults;		/* pages written first */
+	double seconds;			/* time taken by the first writes */
+	unsigned long bad_pages;	/* pages with unexpected contents */
+	long first_bad;			/* index of the first one, or -1 */
+};
+
+/*
+ * The children count themselves in and wait for the parent to let them
+ * go on, so the parent can notice a child that died on the way
+ */
+struct cow_shared {
+	volatile int ready;		/* children ready to write */
+	volatile int go;		/* set once all of them are */
+	volatile int written;		/* children that wrote their pages */
+	volatile int check;		/* set once all of them did */
+	struct cow_stats child[MAXTHREADS];
+};
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: cow_word                                                   */
+/*                                                                      */
+/* PURPOSE: The value of word w of page p in the pattern of writer id   */
+/*          (0 is the original pattern written before fork()).          */
+/*                                                                      */
+/************************************************************************/
+static uint32_t cow_word(uint32_t seed, int id, size_t p, size_t w)
+{
+	uint32_t x = seed ^ (id * 0x9E3779B1U) ^ (p * 0x85EBCA6BU) ^ w;
+
+	x ^= x >> 16;
+	x *= 0x7FEB352DU;
+	x ^= x >> 15;
+	return x;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: cow_verify                                                 */
+/*                                                                      */
+/* PURPOSE: Check every page of the region: the pages owned by id must  */
+/*          hold its pattern, all others the original pattern.  The     */
+/*          parent passes id 0 and owns no pages.                       */
+/*                                                                      */
+/************************************************************************/
+static void cow_verify(uint32_t *mem, size_t npages, size_t words,
+		       uint32_t seed, int id, int nchildren,
+		       struct cow_stats *st)
+{
+	size_t p, w;
+	int owner;
+
+	st->first_bad = -1;
+	for (p = 0; p < npages; p++) {
+		owner = (id && (int)(p % nchildren) == id - 1) ? id : 0;
+		for (w = 0; w < words; w++) {
+			if (mem[p * words + w] != cow_word(seed, owner, p, w))
+				break;
+		}
+		if (w < words) {
+			if (st->first_bad < 0)
+				st->first_bad = p;
+			st->bad_pages++;
+		}
+	}
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: cow_child                                                  */
+/*                                                                      */
+/* PURPOSE: Body of child id (1..nchildren): write the first word of    */
+/*          each of our pages, which takes the copy-on-write fault,     */
+/*          fill the rest, then verify once all siblings wrote theirs.  */
+/*                                                                      */
+/************************************************************************/
+static int cow_child(uint32_t *mem, size_t npages, size_t words,
+		     uint32_t seed, int id, int nchildren,
+		     struct cow_shared *sh)
+{
+	struct cow_stats *st = &sh->child[id - 1];
+	double start;
+	size_t p, w;
+
+	__sync_fetch_and_add(&sh->ready, 1);
+	while (!sh->go)
+		sched_yield();
+	start = amtu_now();
+	for (p = id - 1; p < npages; p += nchildren) {
+		mem[p * words] = cow_word(seed, id, p, 0);
+		st->faults++;
+	}
+	st->seconds = amtu_now() - start;
+	for (p = id - 1; p < npages; p += nchildren)
+		for (w = 1; w < words; w++)
+			mem[p * words + w] = cow_word(seed, id, p, w);
+
+	__sync_fetch_and_add(&sh->written, 1);
+	while (!sh->check)
+		sched_yield();
+	cow_verify(mem, npages, words, seed, id, nchildren, st);
+	return st->bad_pages ? 1 : 0;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: cow_wait                                                   */
+/*                                                                      */
+/* PURPOSE: Wait until counter reaches n, the number of children.       */
+/*          Returns -1 if a child exited first, killed by the OOM       */
+/*          killer or crashed, instead of waiting for it forever.       */
+/*                                                                      */
+/************************************************************************/
+static int cow_wait(volatile int *counter, int n)
+{
+	pid_t pid;
+	int stat;
+
+	while (*counter < n) {
+		pid = waitpid(-1, &stat, WNOHANG);
+		if (pid > 0) {
+			fprintf(stderr, "Child %d exited before the others "
+				"were done, status 0x%x\n", (int)pid, stat);
+			return -1;
+		}
+		sched_yield();
+	}
+	return 0;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: cowtest                                                    */
+/*                                                                      */
+/* PURPOSE: Execute Copy-on-Write Isolation Test.                       */
+/*                                                                      */
+/************************************************************************/
+int cowtest(int argc, char *argv[])
+{
+	struct cow_shared *sh;
+	struct cow_stats parent;
+	pid_t pids[MAXTHREADS];
+	long pagesize = sysconf(_SC_PAGESIZE);
+	size_t size, npages, words, p, w;
+	unsigned long faults = 0;
+	double start, wall = 0, fault_time = 0;
+	uint32_t *mem;
+	uint32_t seed;
+	int nchildren = cow_children;
+	int i, n, stat, rc = 0;
+
+	printf("Executing Copy-on-Write Isolation Test...\n");
+
+	if (nchildren <= 0)
+		nchildren = amtu_nthreads();
+	if (nchildren > MAXTHREADS)
+		nchildren = MAXTHREADS;
+	size = (size_t)(cow_mb > 0 ? cow_mb : 1) << 20;
+	npages = size / pagesize;
+	words = pagesize / sizeof(*mem);
+
+	mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	sh = mmap(NULL, sizeof(*sh), PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED || sh == MAP_FAILED) {
+		fprintf(stderr, "Could not allocate memory\n");
+#ifdef HAVE_LIBLAUS
+		LAUS_LOG(("amtu copy-on-write test - could not allocate memory"))
+#else
+		AUDIT_LOG("amtu copy-on-write test - could not allocate memory", 0)
+#endif
+		if (mem != MAP_FAILED)
+			munmap(mem, size);
+		return -1;
+	}
+
+	seed = (uint32_t)time(NULL);
+	for (p = 0; p < npages; p++)
+		for (w = 0; w < words; w++)
+			mem[p * words + w] = cow_word(seed, 0, p, w);
+
+	fflush(stdout);
+	for (n = 0; n < nchildren; n++) {
+		pids[n] = fork();
+		if (pids[n] == 0)
+			_exit(cow_child(mem, npages, words, seed, n + 1,
+					nchildren, sh));
+		if (pids[n] == -1) {
+			perror("cowtest: fork failed");
+			break;
+		}
+	}
+	if (n < nchildren || cow_wait(&sh->ready, nchildren) < 0) {
+		rc = -1;
+	} else {
+		__sync_synchronize();
+		sh->go = 1;
+		start = amtu_now();
+		if (cow_wait(&sh->written, nchildren) < 0)
+			rc = -1;
+		wall = amtu_now() - start;
+		__sync_synchronize();
+		sh->check = 1;
+	}
+	if (rc != 0) {
+		/* The others wait on the missing ones: stop them */
+		for (i = 0; i < n; i++)
+			kill(pids[i], SIGKILL);
+	} else {
+		memset(&parent, 0, sizeof(parent));
+		cow_verify(mem, npages, words, seed, 0, nchildren, &parent);
+		if (parent.bad_pages) {
+			fprintf(stderr, "Parent sees %lu changed pages, first "
+				"is page %ld\n", parent.bad_pages,
+				parent.first_bad);
+			rc = -1;
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		if (waitpid(pids[i], &stat, 0) < 0 ||
+		    !(WIFEXITED(stat) && (WEXITSTATUS(stat) == 0)))
+			rc = -1;
+		if (sh->child[i].bad_pages)
+			fprintf(stderr, "Child %d sees %lu unexpected pages, "
+				"first is page %ld\n", i + 1,
+				sh->child[i].bad_pages,
+				sh->child[i].first_bad);
+		faults += sh->child[i].faults;
+		fault_time += sh->child[i].seconds;
+	}
+	if (rc == 0)
+		printf("%d children, %lu copy-on-write faults in %zu MB: "
+			"%.3f s, %.0f faults/s, %.0f faults/s per child\n",
+			nchildren, faults, size >> 20, wall,
+			wall > 0 ? faults / wall : 0,
+			fault_time > 0 ? faults / fault_time : 0);
+
+	munmap(sh, sizeof(*sh));
+	munmap(mem, size);
+
+	if (rc != 0) {
+		fprintf(stderr, "Copy-on-Write Isolation Test FAILED!\n");
+#ifdef HAVE_LIBLAUS
+		LAUS_LOG(("amtu failed copy-on-write isolation test"))
+#else
+		AUDIT_LOG("amtu failed copy-on-write isolation test", 0)
+#endif
+		return -1;
+	}
+
+	fprintf(stderr, "Copy-on-Write Isolation Test SUCCESS!\n");
+#ifdef HAVE_LIBLAUS
+	LAUS_LOG(("amtu - Copy-on-Write Isolation Test succeeded"))
+#else
+	AUDIT_LOG("amtu - Copy-on-Write Isolation Test succeeded", 1)
+#endif
+	return 0;
+}
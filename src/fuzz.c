@@ -0,0 +1,613 @@
+//----------------------------------------------------------------------
+//
+// Module Name:  fuzz.c
+//
+// Include File:  amtu.h
+//
+// Description:   Code for Abstract Machine Test Utility - privileged
+//                opcode fuzzer of the Supervisor Mode Instructions Test.
+//
+// Notes:  The instruction tables only hold the opcodes someone wrote
+//         down.  This module generates the encodings of whole groups of
+//         system instructions instead, every one of which must fault
+//         in user mode: on x86 the 0F xx system opcodes (descriptor
+//         table and control register loads, MSRs, cache and TLB
+//         control, VMX and SVM), with every register field and both
+//         register and memory forms, under each operand size and
+//         repeat prefix and, on x86_64, REX.W; on aarch64 every MRS,
+//         MSR, SYS and SYSL encoding of the EL1 and higher system
+//         registers.  priv_fuzz candidates are run: first the list as
+//         generated, then random variants of it (segment override and
+//         REX bits on x86, the transfer register on aarch64).
+//
+//         Candidates are written into slots of a scratch page mapped
+//         twice from a memfd, writable and executable, each followed
+//         by a return, so that a page of them costs one cache flush.
+//         Every slot is then called under the trap engine.  Memory
+//         operands point at the second, read-only page of the scratch
+//         mapping.  The work is spread over amtu_nthreads() worker
+//         processes; a worker killed by an encoding that ran reports
+//         it too, and one that could not map its scratch page (e.g.
+//         under vm.memfd_noexec) reports the step that failed.  The
+//         return codes are as follows:
+//         -1 = failure occurred
+//          0 = success
+// -----------------------------------------------------------------
+// LANGUAGE:     C
+//
+// Licensed under the Common Public License v. 1.0
+// -----------------------------------------------------------------
+
+#define _GNU_SOURCE
+#include "config.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <syslog.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include "amtu.h"
+
+#define FUZZ_LIST	16	/* encodings listed per worker */
+#define FUZZ_MAXLEN	15	/* longest instruction */
+#define FUZZ_MAXSLOTS	1024	/* slots filled at a time */
+
+/*
+ * One generated encoding.  On x86 the fields are assembled into bytes
+ * when the slot is filled, so that the random variants can change the
+ * prefixes; on aarch64 the instruction word is ready.
+ */
+struct fuzz_cand {
+	uint32_t insn;		/* aarch64 */
+	unsigned char pfx;	/* x86: 66, F2, F3 or 0 */
+	unsigned char rex;	/* x86_64: REX prefix or 0 */
+	unsigned char op;	/* x86: second opcode byte after 0F */
+	short modrm;		/* x86: ModRM byte, -1 if none */
+	unsigned char mem;	/* x86: ModRM is disp32 memory form */
+};
+
+struct fuzz_list {
+	struct fuzz_cand *cand;
+	int n;
+	int size;
+};
+
+/* Results of one worker, in shared memory */
+struct fuzz_stats {
+	unsigned long run;
+	unsigned long faulted;
+	unsigned long flagged;
+	long current;		/* candidate being run */
+	unsigned char cur[FUZZ_MAXLEN];
+	int curlen;
+	double elapsed;
+	int done;
+	const char *setup;	/* step that failed before any candidate */
+	int err;		/* and its errno */
+	int nlisted;
+	struct {
+		unsigned char b[FUZZ_MAXLEN];
+		int len;
+		int sig;
+	} listed[FUZZ_LIST];
+};
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: fuzz_rand                                                  */
+/*                                                                      */
+/* PURPOSE: xorshift64* generator, one state per worker.                */
+/*                                                                      */
+/************************************************************************/
+static uint64_t fuzz_rand(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545F4914F6CDD1DULL;
+}
+
+static int fuzz_add(struct fuzz_list *l, const struct fuzz_cand *c)
+{
+	struct fuzz_cand *p;
+
+	if (l->n == l->size) {
+		l->size = l->size ? 2 * l->size : 1024;
+		p = realloc(l->cand, l->size * sizeof(*p));
+		if (p == NULL)
+			return -1;
+		l->cand = p;
+	}
+	l->cand[l->n++] = *c;
+	return 0;
+}
+
+#if defined(HAVE_I86) || defined(HAVE_X86_64)
+
+#define FUZZ_SLOT	16
+
+static const unsigned char seg_prefixes[] = {
+	0x26, 0x2e, 0x36, 0x3e, 0x64, 0x65
+};
+
+/* 0F 01 register forms that are privileged instructions of their own */
+static const unsigned char op01_priv[] = {
+	0xc2, 0xc3, 0xc4,		/* VMLAUNCH, VMRESUME, VMXOFF */
+	0xc8, 0xc9, 0xca, 0xcb,		/* MONITOR, MWAIT, CLAC, STAC */
+	0xcf, 0xd1,			/* ENCLS, XSETBV */
+	0xd8, 0xda, 0xdb, 0xdc,		/* VMRUN, VMLOAD, VMSAVE, STGI */
+	0xdd, 0xde, 0xdf,		/* CLGI, SKINIT, INVLPGA */
+#if defined(HAVE_X86_64)
+	0xf8,				/* SWAPGS */
+#endif
+};
+
+/* Two byte opcodes without ModRM */
+static const unsigned char op_plain[] = {
+	0x06, 0x08, 0x09,		/* CLTS, INVD, WBINVD */
+	0x30, 0x32, 0x33,		/* WRMSR, RDMSR, RDPMC */
+	0x35,				/* SYSEXIT */
+#if defined(HAVE_X86_64)
+	0x07,				/* SYSRET */
+#endif
+};
+
+static int x86_add(struct fuzz_list *l, int pfx, int rex, int op,
+		   int reg, int rm, int mem)
+{
+	struct fuzz_cand c;
+
+	memset(&c, 0, sizeof(c));
+	c.pfx = pfx;
+	c.rex = rex;
+	c.op = op;
+	c.mem = mem;
+	if (reg < 0)
+		c.modrm = -1;
+	else if (mem)
+		c.modrm = (reg << 3) | 5;
+	else
+		c.modrm = 0xc0 | (reg << 3) | rm;
+	return fuzz_add(l, &c);
+}
+
+/* Both forms of group op /reg */
+static int x86_add_group(struct fuzz_list *l, int pfx, int rex, int op,
+			 int reg, int regform, int memform)
+{
+	int rm, rc = 0;
+
+	for (rm = 0; regform && rm < 8; rm++)
+		rc |= x86_add(l, pfx, rex, op, reg, rm, 0);
+	if (memform)
+		rc |= x86_add(l, pfx, rex, op, reg, 0, 1);
+	return rc;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: fuzz_build                                                 */
+/*                                                                      */
+/* PURPOSE: Generate the x86 system opcode groups.  Prefixes that turn  */
+/*          an encoding into an unprivileged instruction (66 0F 78 is   */
+/*          EXTRQ, 0F C7 /6 with a register is RDRAND) are left out.    */
+/*                                                                      */
+/************************************************************************/
+static int fuzz_build(struct fuzz_list *l)
+{
+	static const unsigned char pfxs[] = { 0, 0x66, 0xf2, 0xf3 };
+#if defined(HAVE_X86_64)
+	static const unsigned char rexs[] = { 0, 0x48 };
+#else
+	static const unsigned char rexs[] = { 0 };
+#endif
+	unsigned int p, r, i;
+	int pfx, rex, op, reg, rc = 0;
+	int mwait3 = amtu_cpuinfo_flag("ring3mwait");
+
+	for (p = 0; p < sizeof(pfxs); p++) {
+		for (r = 0; r < sizeof(rexs); r++) {
+			pfx = pfxs[p];
+			rex = rexs[r];
+			for (i = 0; i < sizeof(op_plain); i++)
+				rc |= x86_add(l, pfx, rex, op_plain[i],
+					      -1, 0, 0);
+			// LLDT, LTR
+			for (reg = 2; reg <= 3; reg++)
+				rc |= x86_add_group(l, pfx, rex, 0x00, reg,
+						    1, 1);
+			// LGDT, LIDT, INVLPG; LMSW
+			rc |= x86_add_group(l, pfx, rex, 0x01, 2, 0, 1);
+			rc |= x86_add_group(l, pfx, rex, 0x01, 3, 0, 1);
+			rc |= x86_add_group(l, pfx, rex, 0x01, 7, 0, 1);
+			rc |= x86_add_group(l, pfx, rex, 0x01, 6, 1, 1);
+			// MOV to and from CRn and DRn, always registers
+			for (op = 0x20; op <= 0x23; op++)
+				for (reg = 0; reg < 8; reg++)
+					rc |= x86_add_group(l, pfx, rex, op,
+							    reg, 1, 0);
+			// VMCLEAR (66), VMXON (F3), VMPTRLD
+			if (pfx != 0xf2)
+				rc |= x86_add_group(l, pfx, rex, 0xc7, 6,
+						    0, 1);
+			if (pfx)
+				continue;
+			for (i = 0; i < sizeof(op01_priv); i++) {
+				// MONITOR and MWAIT run in ring 3 if enabled
+				if (mwait3 && (op01_priv[i] == 0xc8 ||
+				    op01_priv[i] == 0xc9))
+					continue;
+				rc |= x86_add(l, 0, rex, 0x01,
+					      (op01_priv[i] >> 3) & 7,
+					      op01_priv[i] & 7, 0);
+			}
+			// VMREAD, VMWRITE, VMPTRST
+			for (reg = 0; reg < 8; reg++) {
+				rc |= x86_add_group(l, 0, rex, 0x78, reg,
+						    1, 1);
+				rc |= x86_add_group(l, 0, rex, 0x79, reg,
+						    1, 1);
+			}
+			rc |= x86_add_group(l, 0, rex, 0xc7, 7, 0, 1);
+		}
+	}
+	return rc;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: fuzz_emit                                                  */
+/*                                                                      */
+/* PURPOSE: Assemble a candidate and a RET into slot w, which executes  */
+/*          at address x.  Random variants get a segment override and,  */
+/*          on x86_64, random REX.RXB bits.  Returns its length.        */
+/*                                                                      */
+/************************************************************************/
+static int fuzz_emit(const struct fuzz_cand *c, uint64_t *rnd,
+		     unsigned char *w, uintptr_t x, uintptr_t data)
+{
+	int n = 0, rex = c->rex;
+	uint64_t v;
+	uint32_t disp;
+
+	if (rnd) {
+		v = fuzz_rand(rnd);
+		w[n++] = seg_prefixes[v % sizeof(seg_prefixes)];
+#if defined(HAVE_X86_64)
+		rex = 0x40 | (rex & 8) | ((v >> 8) & 7);
+#endif
+	}
+	if (c->pfx)
+		w[n++] = c->pfx;
+	if (rex)
+		w[n++] = rex;
+	w[n++] = 0x0f;
+	w[n++] = c->op;
+	if (c->modrm >= 0)
+		w[n++] = c->modrm;
+	if (c->mem) {
+#if defined(HAVE_X86_64)
+		disp = data - (x + n + 4);	/* RIP relative */
+#else
+		(void)x;
+		disp = data;
+#endif
+		memcpy(&w[n], &disp, 4);
+		n += 4;
+	}
+	w[n] = 0xc3;		/* ret */
+	return n;
+}
+
+static void fuzz_flush(void *x, size_t len)
+{
+	(void)x;
+	(void)len;
+}
+
+#elif defined(HAVE_AARCH64)
+
+#define FUZZ_SLOT	8
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: fuzz_build                                                 */
+/*                                                                      */
+/* PURPOSE: Generate every SYS, SYSL, MSR and MRS encoding whose op1 is */
+/*          not 3, that is of the EL1 and higher registers and system   */
+/*          instructions.  MRS of the ID registers (op0 3, op1 0, CRn   */
+/*          0) is left out, the kernel emulates it.                     */
+/*                                                                      */
+/************************************************************************/
+static int fuzz_build(struct fuzz_list *l)
+{
+	struct fuzz_cand c;
+	unsigned int enc, op0, L, op1, crn, crm, op2;
+	int rc = 0;
+
+	memset(&c, 0, sizeof(c));
+	for (enc = 0; enc < 3 * 2 * 8 * 16 * 16 * 8; enc++) {
+		op2 = enc & 7;
+		crm = (enc >> 3) & 15;
+		crn = (enc >> 7) & 15;
+		op1 = (enc >> 11) & 7;
+		L = (enc >> 14) & 1;
+		op0 = (enc >> 15) + 1;
+		if (op1 == 3 || (L && op0 == 3 && op1 == 0 && crn == 0))
+			continue;
+		c.insn = 0xd5000000 | (L << 21) | (op0 << 19) | (op1 << 16) |
+			 (crn << 12) | (crm << 8) | (op2 << 5);
+		rc |= fuzz_add(l, &c);
+	}
+	return rc;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: fuzz_emit                                                  */
+/*                                                                      */
+/* PURPOSE: Write a candidate and a RET into slot w.  Random variants   */
+/*          use one of x0-x15 instead of x0.  Returns its length.       */
+/*                                                                      */
+/************************************************************************/
+static int fuzz_emit(const struct fuzz_cand *c, uint64_t *rnd,
+		     unsigned char *w, uintptr_t x, uintptr_t data)
+{
+	uint32_t insn[2];
+
+	(void)x;
+	(void)data;
+	insn[0] = c->insn;
+	if (rnd)
+		insn[0] |= fuzz_rand(rnd) & 15;
+	insn[1] = 0xd65f03c0;	/* ret */
+	memcpy(w, insn, sizeof(insn));
+	return 4;
+}
+
+static void fuzz_flush(void *x, size_t len)
+{
+	__builtin___clear_cache((char *)x, (char *)x + len);
+}
+
+#else
+
+#define FUZZ_SLOT	16
+
+static int fuzz_build(struct fuzz_list *l)
+{
+	(void)l;
+	return 0;
+}
+
+static int fuzz_emit(const struct fuzz_cand *c, uint64_t *rnd,
+		     unsigned char *w, uintptr_t x, uintptr_t data)
+{
+	(void)c;
+	(void)rnd;
+	(void)w;
+	(void)x;
+	(void)data;
+	return 0;
+}
+
+static void fuzz_flush(void *x, size_t len)
+{
+	(void)x;
+	(void)len;
+}
+#endif
+
+/* Record why worker setup failed, for the parent to report */
+static int fuzz_setup_failed(struct fuzz_stats *st, const char *what)
+{
+	st->setup = what;
+	st->err = errno;
+	return 2;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: fuzz_worker                                                */
+/*                                                                      */
+/* PURPOSE: Body of worker id: run every nworkers-th of total           */
+/*          candidates, a page of slots at a time.                      */
+/*                                                                      */
+/************************************************************************/
+static int fuzz_worker(struct fuzz_list *l, long total, int id,
+		       int nworkers, uint64_t seed, struct fuzz_stats *st)
+{
+	long pagesize = sysconf(_SC_PAGESIZE);
+	int nslots = pagesize / FUZZ_SLOT;
+	struct trap_info ti;
+	unsigned char *w, *x;
+	uint64_t rnd = seed + id * 0x9E3779B97F4A7C15ULL;
+	long k, slot_k[FUZZ_MAXSLOTS];
+	int fd, i, used, len[FUZZ_MAXSLOTS];
+	double start;
+
+	if (nslots > FUZZ_MAXSLOTS)
+		nslots = FUZZ_MAXSLOTS;
+	prctl(PR_SET_DUMPABLE, 0);
+	fd = memfd_create("amtu-fuzz", MFD_CLOEXEC);
+	if (fd < 0)
+		return fuzz_setup_failed(st, "memfd_create");
+	if (ftruncate(fd, 2 * pagesize) < 0)
+		return fuzz_setup_failed(st, "ftruncate");
+	w = mmap(NULL, 2 * pagesize, PROT_READ | PROT_WRITE, MAP_SHARED,
+		 fd, 0);
+	if (w == MAP_FAILED)
+		return fuzz_setup_failed(st, "mmap PROT_WRITE");
+	x = mmap(NULL, 2 * pagesize, PROT_READ | PROT_EXEC, MAP_SHARED,
+		 fd, 0);
+	if (x == MAP_FAILED)
+		return fuzz_setup_failed(st, "mmap PROT_EXEC");
+	close(fd);
+	if (trap_init() < 0)
+		return fuzz_setup_failed(st, "trap_init");
+
+	start = amtu_now();
+	k = id;
+	while (k < total) {
+		// Fill a page of slots
+		for (used = 0; used < nslots && k < total;
+		     used++, k += nworkers) {
+			slot_k[used] = k;
+			len[used] = fuzz_emit(&l->cand[k % l->n],
+					      k >= l->n ? &rnd : NULL,
+					      w + used * FUZZ_SLOT,
+					      (uintptr_t)x + used * FUZZ_SLOT,
+					      (uintptr_t)x + pagesize);
+		}
+		fuzz_flush(x, used * FUZZ_SLOT);
+
+		// And run them
+		for (i = 0; i < used; i++) {
+			st->current = slot_k[i];
+			st->curlen = len[i];
+			memcpy(st->cur, w + i * FUZZ_SLOT, len[i]);
+			trap_call((void (*)(void))(x + i * FUZZ_SLOT), &ti);
+			st->run++;
+			if (ti.sig == SIGILL || ti.sig == SIGSEGV) {
+				st->faulted++;
+				continue;
+			}
+			st->flagged++;
+			if (st->nlisted < FUZZ_LIST) {
+				memcpy(st->listed[st->nlisted].b, st->cur,
+				       len[i]);
+				st->listed[st->nlisted].len = len[i];
+				st->listed[st->nlisted].sig = ti.sig;
+				st->nlisted++;
+			}
+		}
+	}
+	st->elapsed = amtu_now() - start;
+	st->done = 1;
+	return st->flagged ? 1 : 0;
+}
+
+static void fuzz_print(const char *what, const unsigned char *b, int len)
+{
+	int i;
+
+	fprintf(stderr, "%s:", what);
+	for (i = 0; i < len; i++)
+		fprintf(stderr, " %02x", b[i]);
+	fprintf(stderr, "\n");
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: priv_fuzz_run                                              */
+/*                                                                      */
+/* PURPOSE: Run the opcode fuzzer and report the encodings that did not */
+/*          fault.  Returns -1 if there were any.                       */
+/*                                                                      */
+/************************************************************************/
+int priv_fuzz_run(void)
+{
+	struct fuzz_list l = { NULL, 0, 0 };
+	struct fuzz_stats *st;
+	pid_t pids[MAXTHREADS];
+	uint64_t seed = priv_fuzz_seed ? (uint64_t)priv_fuzz_seed :
+				(uint64_t)time(NULL);
+	unsigned long run = 0, faulted = 0, flagged = 0;
+	double start, elapsed, cpu = 0;
+	char msg[100];
+	int nworkers = amtu_nthreads();
+	int i, k, n, stat, rc = 0;
+
+	if (fuzz_build(&l) < 0) {
+		fprintf(stderr, "Could not allocate memory\n");
+		free(l.cand);
+		return -1;
+	}
+	if (l.n == 0) {
+		printf("Opcode fuzzer not supported on this architecture\n");
+		return 0;
+	}
+	st = mmap(NULL, MAXTHREADS * sizeof(*st), PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (st == MAP_FAILED) {
+		fprintf(stderr, "Could not allocate memory\n");
+		free(l.cand);
+		return -1;
+	}
+
+	printf("Opcode fuzzer, %d encodings, %d candidates, seed %llu:\n",
+		l.n, priv_fuzz, (unsigned long long)seed);
+	fflush(stdout);
+	start = amtu_now();
+	for (n = 0; n < nworkers; n++) {
+		pids[n] = fork();
+		if (pids[n] == 0)
+			_exit(fuzz_worker(&l, priv_fuzz, n, nworkers, seed,
+					  &st[n]));
+		if (pids[n] == -1) {
+			perror("amtu_priv: fork failed");
+			rc = -1;
+			break;
+		}
+	}
+	for (i = 0; i < n; i++)
+		waitpid(pids[i], &stat, 0);
+	elapsed = amtu_now() - start;
+
+	for (i = 0; i < n; i++) {
+		run += st[i].run;
+		faulted += st[i].faulted;
+		flagged += st[i].flagged;
+		cpu += st[i].elapsed;
+		if (st[i].setup) {
+			fprintf(stderr, "Fuzzer worker %d could not set up: "
+				"%s: %s\n", i, st[i].setup,
+				strerror(st[i].err));
+			rc = -1;
+		} else if (!st[i].done && st[i].curlen == 0) {
+			fprintf(stderr, "Fuzzer worker %d died before its "
+				"first candidate\n", i);
+			rc = -1;
+		} else if (!st[i].done) {
+			fprintf(stderr, "Fuzzer worker %d died at candidate "
+				"%ld\n", i, st[i].current);
+			fuzz_print("  encoding", st[i].cur, st[i].curlen);
+			rc = -1;
+		}
+		for (k = 0; k < st[i].nlisted; k++)
+			fuzz_print(st[i].listed[k].sig ? "Wrong signal" :
+				   "No fault", st[i].listed[k].b,
+				   st[i].listed[k].len);
+	}
+	printf("  %lu run, %lu faulted, %lu flagged by %d workers: %.3f s, "
+		"%.0f candidates/s, %.0f per worker\n", run, faulted, flagged,
+		n, elapsed, elapsed > 0 ? run / elapsed : 0,
+		cpu > 0 ? run / cpu : 0);
+
+	if (flagged) {
+		fprintf(stderr, "Privilege Separation Test FAILED on %lu "
+			"fuzzed encodings!\n", flagged);
+		snprintf(msg, sizeof(msg), "amtu failed privilege separation "
+			"on %lu fuzzed encodings", flagged);
+#ifdef HAVE_LIBLAUS
+		LAUS_LOG((msg))
+#else
+		AUDIT_LOG(msg, 0)
+#endif
+		rc = -1;
+	}
+
+	munmap(st, MAXTHREADS * sizeof(*st));
+	free(l.cand);
+	return rc;
+}
@@ -0,0 +1,252 @@
+//----------------------------------------------------------------------
+//
+// Module Name:  ioport.c
+//
+// Include File:  amtu.h
+//
+// Description:   Code for Abstract Machine Test Utility - I/O port
+//                sweep of the Supervisor Mode Instructions Test.
+//
+// Notes:  On x86 user mode may only do port I/O if IOPL or the I/O
+//         bitmap of the TSS allows it, which Linux only grants through
+//         iopl() and ioperm().  This module executes IN and OUT with
+//         byte, word and dword width on every one of the 65536 ports
+//         under the trap engine, once as the unprivileged user nobody
+//         and once as root.  Neither process ever called iopl() or
+//         ioperm(), so every access must raise a general protection
+//         fault (SIGSEGV, SI_KERNEL).  Both passes run at the same
+//         time in child processes, the nobody one having dropped its
+//         privileges for good.  Ports that did not fault are listed.
+//         The return codes are as follows:
+//         -1 = failure occurred
+//          0 = success
+// -----------------------------------------------------------------
+// LANGUAGE:     C
+//
+// Licensed under the Common Public License v. 1.0
+// -----------------------------------------------------------------
+
+#define _GNU_SOURCE
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <syslog.h>
+#include <pwd.h>
+#include <grp.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include "amtu.h"
+
+#if defined(HAVE_I86) || defined(HAVE_X86_64)
+
+#define IOPORTS		65536
+#define IOPORT_LIST	16	/* ports not faulting that are listed */
+
+/* The port probed, read by the probe functions */
+static unsigned short io_port;
+
+static void io_inb(void)
+{
+	unsigned char v;
+
+	__asm__ volatile ("inb %1, %0" : "=a" (v) : "d" (io_port));
+}
+
+static void io_inw(void)
+{
+	unsigned short v;
+
+	__asm__ volatile ("inw %1, %0" : "=a" (v) : "d" (io_port));
+}
+
+static void io_inl(void)
+{
+	unsigned int v;
+
+	__asm__ volatile ("inl %1, %0" : "=a" (v) : "d" (io_port));
+}
+
+static void io_outb(void)
+{
+	__asm__ volatile ("outb %0, %1" : : "a" ((unsigned char)0),
+			  "d" (io_port));
+}
+
+static void io_outw(void)
+{
+	__asm__ volatile ("outw %0, %1" : : "a" ((unsigned short)0),
+			  "d" (io_port));
+}
+
+static void io_outl(void)
+{
+	__asm__ volatile ("outl %0, %1" : : "a" (0U), "d" (io_port));
+}
+
+static const struct {
+	const char *name;
+	void (*probe)(void);
+} io_probes[] = {
+	{ "INB", io_inb }, { "INW", io_inw }, { "INL", io_inl },
+	{ "OUTB", io_outb }, { "OUTW", io_outw }, { "OUTL", io_outl },
+};
+
+#define IO_PROBES	(sizeof(io_probes) / sizeof(io_probes[0]))
+
+/* Result of one pass, in shared memory */
+struct io_stats {
+	const char *who;
+	int done;
+	unsigned long accesses;
+	unsigned long trapped;
+	double elapsed;
+	int nlisted;
+	struct {
+		int port;
+		int probe;
+		int sig;
+	} listed[IOPORT_LIST];
+};
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: io_sweep                                                   */
+/*                                                                      */
+/* PURPOSE: Body of a sweep child: try every width and direction on     */
+/*          every port.  Only a general protection fault counts.        */
+/*                                                                      */
+/************************************************************************/
+static int io_sweep(struct io_stats *st)
+{
+	struct trap_info ti;
+	unsigned int p, port;
+	double start;
+
+	if (trap_init() < 0)
+		return 2;
+	start = amtu_now();
+	for (port = 0; port < IOPORTS; port++) {
+		io_port = port;
+		for (p = 0; p < IO_PROBES; p++) {
+			trap_call(io_probes[p].probe, &ti);
+			st->accesses++;
+			if (ti.sig == SIGSEGV && ti.code == SI_KERNEL) {
+				st->trapped++;
+				continue;
+			}
+			if (st->nlisted < IOPORT_LIST) {
+				st->listed[st->nlisted].port = port;
+				st->listed[st->nlisted].probe = p;
+				st->listed[st->nlisted].sig = ti.sig;
+				st->nlisted++;
+			}
+		}
+	}
+	st->elapsed = amtu_now() - start;
+	st->done = 1;
+	return st->trapped == st->accesses ? 0 : 1;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: ioport_sweep                                               */
+/*                                                                      */
+/* PURPOSE: Sweep all I/O ports as nobody and as root, at the same      */
+/*          time, and report the trap rate and any port that did not    */
+/*          fault.  Returns -1 if one did.                              */
+/*                                                                      */
+/************************************************************************/
+int ioport_sweep(void)
+{
+	struct io_stats *st;
+	struct passwd *pwd;
+	pid_t pids[2];
+	char msg[100];
+	int i, k, n, stat, rc = 0;
+
+	pwd = getpwnam("nobody");
+	if (pwd == NULL) {
+		fprintf(stderr, "Could not obtain info for user nobody\n");
+		return -1;
+	}
+	st = mmap(NULL, 2 * sizeof(*st), PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (st == MAP_FAILED) {
+		fprintf(stderr, "Could not allocate memory\n");
+		return -1;
+	}
+	st[0].who = "nobody";
+	st[1].who = "root";
+
+	printf("I/O port sweep, %d ports, IN and OUT of 1, 2 and 4 bytes:\n",
+		IOPORTS);
+	fflush(stdout);
+	for (n = 0; n < 2; n++) {
+		pids[n] = fork();
+		if (pids[n] == 0) {
+			if (n == 0 && (setgroups(0, NULL) < 0 ||
+			    setresgid(pwd->pw_gid, pwd->pw_gid,
+				      pwd->pw_gid) < 0 ||
+			    setresuid(pwd->pw_uid, pwd->pw_uid,
+				      pwd->pw_uid) < 0)) {
+				perror("amtu_priv: could not become nobody");
+				_exit(2);
+			}
+			_exit(io_sweep(&st[n]));
+		}
+		if (pids[n] == -1) {
+			perror("amtu_priv: fork failed");
+			rc = -1;
+			break;
+		}
+	}
+	for (i = 0; i < n; i++)
+		waitpid(pids[i], &stat, 0);
+
+	for (i = 0; i < n; i++) {
+		if (!st[i].done) {
+			fprintf(stderr, "I/O port sweep as %s did not "
+				"complete\n", st[i].who);
+			rc = -1;
+			continue;
+		}
+		printf("  %-8s %lu accesses, %lu trapped: %.3f s, "
+			"%.0f traps/s\n", st[i].who, st[i].accesses,
+			st[i].trapped, st[i].elapsed,
+			st[i].elapsed > 0 ? st[i].trapped / st[i].elapsed : 0);
+		if (st[i].trapped == st[i].accesses)
+			continue;
+		for (k = 0; k < st[i].nlisted; k++)
+			fprintf(stderr, "%s on port 0x%04x as %s: %s\n",
+				io_probes[st[i].listed[k].probe].name,
+				st[i].listed[k].port, st[i].who,
+				st[i].listed[k].sig ? "wrong signal" :
+				"no fault");
+		if (st[i].accesses - st[i].trapped > IOPORT_LIST)
+			fprintf(stderr, "... and %lu more\n", st[i].accesses -
+				st[i].trapped - IOPORT_LIST);
+		fprintf(stderr, "Privilege Separation Test FAILED on I/O "
+			"ports as %s!\n", st[i].who);
+		snprintf(msg, sizeof(msg), "amtu failed privilege separation "
+			"on I/O ports as %s", st[i].who);
+#ifdef HAVE_LIBLAUS
+		LAUS_LOG((msg))
+#else
+		AUDIT_LOG(msg, 0)
+#endif
+		rc = -1;
+	}
+
+	munmap(st, 2 * sizeof(*st));
+	return rc;
+}
+#else
+int ioport_sweep(void)
+{
+	return 0;
+}
+#endif
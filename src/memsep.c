@@ -56,6 +56,7 @@
 //
 //----------------------------------------------------------------------
 
+#define _GNU_SOURCE
 #include "config.h"
 #include <stdlib.h>
 #include <stdio.h>
@@ -66,25 +67,153 @@
 #include <sys/types.h>
 #include <syslog.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/random.h>
 #include <pwd.h>
 #include <time.h>
 #include "amtu.h"
 
+#define MAXREGIONS	4096
+#define MAXPROBES	(1ULL << 24)	/* per region */
+#define MAXKINDS	16		/* kinds of region in the report */
+#define PROBE_LOAD	1
+#define PROBE_STORE	2
+#define PROBE_KERNEL	(PROBE_LOAD | PROBE_STORE)
+#define PROBE_SYSCALL	4
+
+/* A part of the kernel half of the address space */
+struct kernel_range {
+	const char *name;
+	uintptr_t start;
+	uintptr_t end;
+};
+
+/*
+ * Kernel address space layouts.  The ranges cover the areas the kernel
+ * places its mappings in (at randomized offsets with KASLR) and the
+ * addresses that are not canonical for the MMU at all; every address in
+ * them must fault for both loads and stores from user mode.  The
+ * vsyscall and ia64 gate pages, which user mode may legitimately read or
+ * execute, are left out.
+ */
+#if defined(HAVE_X86_64)
+static const struct kernel_range kernel_ranges[] = {
+	{ "non-canonical",	0x0000800000000000UL, 0xffff800000000000UL },
+	{ "guard hole",		0xffff800000000000UL, 0xffff888000000000UL },
+	{ "direct map",		0xffff888000000000UL, 0xffffc88000000000UL },
+	{ "vmalloc",		0xffffc90000000000UL, 0xffffe90000000000UL },
+	{ "vmemmap",		0xffffea0000000000UL, 0xffffeb0000000000UL },
+	{ "cpu entry area",	0xfffffe0000000000UL, 0xfffffe8000000000UL },
+	{ "kernel text",	0xffffffff80000000UL, 0xffffffffa0000000UL },
+	{ "modules",		0xffffffffa0000000UL, 0xffffffffff000000UL },
+	{ NULL, 0, 0 }
+};
+
+/* With 5-level paging (la57) user space and the kernel half grow */
+static const struct kernel_range kernel_ranges_la57[] = {
+	{ "non-canonical",	0x0100000000000000UL, 0xff00000000000000UL },
+	{ "guard hole",		0xff00000000000000UL, 0xff11000000000000UL },
+	{ "direct map",		0xff11000000000000UL, 0xff91000000000000UL },
+	{ "vmalloc",		0xffa0000000000000UL, 0xffd2000000000000UL },
+	{ "vmemmap",		0xffd4000000000000UL, 0xffd6000000000000UL },
+	{ "cpu entry area",	0xfffffe0000000000UL, 0xfffffe8000000000UL },
+	{ "kernel text",	0xffffffff80000000UL, 0xffffffffa0000000UL },
+	{ "modules",		0xffffffffa0000000UL, 0xffffffffff000000UL },
+	{ NULL, 0, 0 }
+};
+#elif defined(HAVE_AARCH64)
+/* User data accesses ignore the top byte (TBI), so keep it clear */
+static const struct kernel_range kernel_ranges[] = {
+	{ "non-canonical",	0x0001000000000000UL, 0x00ff000000000000UL },
+	{ "linear map",		0xffff000000000000UL, 0xffff800000000000UL },
+	{ "modules",		0xffff800000000000UL, 0xffff800080000000UL },
+	{ "kernel image",	0xffff800080000000UL, 0xffff800100000000UL },
+	{ "vmalloc",		0xffff800100000000UL, 0xfffffc0000000000UL },
+	{ "vmemmap",		0xfffffc0000000000UL, 0xfffffe0000000000UL },
+	{ "fixmap/io",		0xfffffe0000000000UL, 0xffffffffffe00000UL },
+	{ NULL, 0, 0 }
+};
+#elif defined(HAVE_PPC64)
+static const struct kernel_range kernel_ranges[] = {
+	{ "non-canonical",	0x0010000000000000UL, 0xc000000000000000UL },
+	{ "linear map",		0xc000000000000000UL, 0xc008000000000000UL },
+	{ "vmalloc/io",		0xc008000000000000UL, 0xc010000000000000UL },
+	{ "vmalloc (hash)",	0xd000000000000000UL, 0xfffffffffffff000UL },
+	{ NULL, 0, 0 }
+};
+#elif defined(HAVE_IA64)
+static const struct kernel_range kernel_ranges[] = {
+	{ "uncached identity",	0xc000000000000000UL, 0xe000000000000000UL },
+	{ "cached identity",	0xe000000000000000UL, 0xfffffffffffff000UL },
+	{ NULL, 0, 0 }
+};
+#elif defined(HAVE_I86) || defined(HAVE_PPC)
+static const struct kernel_range kernel_ranges[] = {
+	{ "lowmem",		0xc0000000UL, 0xf8000000UL },
+	{ "vmalloc",		0xf8000000UL, 0xff000000UL },
+	{ NULL, 0, 0 }
+};
+#else
+/* s390 runs the kernel in its own address space: nothing to probe */
+static const struct kernel_range kernel_ranges[] = {
+	{ NULL, 0, 0 }
+};
+#endif
+
+/* An address range to probe and the results for it */
+struct probe_region {
+	char *start;
+	char *end;
+	int kind;			/* PROBE_LOAD, _STORE or _KERNEL */
+	const char *name;		/* kernel range name */
+	unsigned long probes;		/* probes planned */
+	unsigned long done;		/* probes executed */
+	unsigned long missed;		/* probes that did not fault */
+	char *miss_addr;		/* first address that did not fault */
+	int miss_call;			/* and the system call accepting it */
+};
+
+/* The probe plan lives in shared memory so forked workers can report */
+struct probe_plan {
+	int nregions;
+	int nworkers;
+	int go;				/* set once the plan is complete */
+	int syscalls;			/* probes are PROBE_SYSCALL */
+	int failed;			/* workers that could not run */
+	char *user_end;			/* end of the highest mapping */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct probe_region region[MAXREGIONS];
+};
+
+struct probe_thread {
+	struct probe_plan *plan;
+	int id;
+	pthread_t tid;
+};
+
 /************************************************************************/
 /*                                                                      */
-/* FUNCTION: sig_handler                                                */
+/* FUNCTION: probe_rand                                                 */
 /*                                                                      */
-/* PURPOSE: Signal handler to catch the segmentation violation which is */
-/*          expected when trying to read from or write to restricted    */
-/*          memory (i.e. kernel memory).                                */
+/* PURPOSE: xorshift64* generator.  Each worker keeps its own state, so */
+/*          no locking is needed while probing.                         */
 /*                                                                      */
 /************************************************************************/
-void sig_handler(int sig)
+static uint64_t probe_rand(uint64_t *state)
 {
-	if (debug) {
-		fprintf(stderr, "caught the fault %d\n", sig);
-	}
-	_exit(0);
+	uint64_t x = *state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545F4914F6CDD1DULL;
 }
 
 /************************************************************************/
@@ -95,92 +224,993 @@ void sig_handler(int sig)
 /*          range start <= j < end, aligned to sizeof(int)              */
 /*                                                                      */
 /************************************************************************/
-#if __LP64__
-#define RANDNUM ((uint64_t)random() << 32 | random())
-#else
-#define RANDNUM random()
+int *get_pointer_in_range(char *start, char *end, uint64_t rnd)
+{
+	uintptr_t slots = ((uintptr_t)end - (uintptr_t)start) / sizeof(int);
+
+	return (int *)(start + (rnd % slots) * sizeof(int));
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: plan_region                                                */
+/*                                                                      */
+/* PURPOSE: Add a range to the probe plan.  Every range gets its two    */
+/*          edges, nrandom random addresses and memsep_probes_gb more   */
+/*          random addresses for each GB it spans.                      */
+/*                                                                      */
+/************************************************************************/
+static void plan_region(struct probe_plan *plan, char *start, char *end,
+			int kind, const char *name, int nrandom)
+{
+	struct probe_region *r;
+	unsigned long long size = (uintptr_t)end - (uintptr_t)start;
+	unsigned long long n;
+
+	if (size < sizeof(int))
+		return;
+	if (plan->nregions == MAXREGIONS) {
+		if (debug)
+			printf("Too many regions, not probing %p-%p\n",
+				start, end);
+		return;
+	}
+
+	n = 2 + (nrandom > 0 ? nrandom : 0);
+	if (memsep_probes_gb > 0)
+		n += memsep_probes_gb * (size >> 20) / 1024;
+	if (n > MAXPROBES)
+		n = MAXPROBES;
+
+	r = &plan->region[plan->nregions++];
+	r->start = start;
+	r->end = end;
+	r->kind = kind;
+	r->name = name;
+	r->probes = n;
+}
+
+#if defined(HAVE_X86_64)
+/*
+ * Whether the kernel runs with 5-level paging.  The la57 flag only says
+ * the CPU can, the kernel may not use it (no5lvl, or not built for it),
+ * and only then does mmap() honour a hint above 2^47.  The mapping is
+ * gone again before anything is probed.
+ */
+static int la57_active(void)
+{
+	long pagesize = sysconf(_SC_PAGESIZE);
+	void *p;
+	int high;
+
+	if (!amtu_cpuinfo_flag("la57"))
+		return 0;
+	p = mmap((void *)(1UL << 56), pagesize, PROT_NONE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return 0;
+	high = (uintptr_t)p >= 1UL << 47;
+	munmap(p, pagesize);
+	return high;
+}
 #endif
-int *get_pointer_in_range(int *start, int *end)
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: plan_kernel                                                */
+/*                                                                      */
+/* PURPOSE: Add the kernel half of the address space to the probe plan, */
+/*          memsep_kprobes addresses per range.  x86_64 kernels using   */
+/*          5-level paging have a different layout.  A 32-bit process   */
+/*          on a 64-bit kernel has user space up to about 0xffffe000,   */
+/*          so the 32-bit ranges only start above the highest mapping   */
+/*          plan_maps() saw.                                            */
+/*                                                                      */
+/************************************************************************/
+static void plan_kernel(struct probe_plan *plan)
 {
-        return (int *)((char *)start + (RANDNUM % ((char *)end - (char *)start)));
+	const struct kernel_range *k = kernel_ranges;
+	char *start;
+
+	if (memsep_kprobes <= 0)
+		return;
+#if defined(HAVE_X86_64)
+	if (la57_active())
+		k = kernel_ranges_la57;
+#endif
+	if (k->name == NULL && debug)
+		printf("No kernel ranges to probe on this architecture\n");
+	for (; k->name; k++) {
+		start = (char *)k->start;
+#if defined(HAVE_I86) || defined(HAVE_PPC)
+		if (start < plan->user_end)
+			start = plan->user_end;
+		if (start >= (char *)k->end) {
+			if (debug)
+				printf("Kernel range %s is user space, "
+					"not probed\n", k->name);
+			continue;
+		}
+#endif
+		plan_region(plan, start, (char *)k->end, PROBE_KERNEL,
+			    k->name, memsep_kprobes);
+	}
 }
 
 /************************************************************************/
 /*                                                                      */
-/* FUNCTION: write_read_mem                                             */
+/* FUNCTION: plan_maps                                                  */
 /*                                                                      */
-/* PURPOSE: Attempts to read or write to memory addresses               */
+/* PURPOSE: Build the probe plan from /proc/self/maps: read-only areas  */
+/*          are probed with writes and unmapped areas between mappings  */
+/*          with reads.  Nothing may be mapped between reading the maps */
+/*          and probing, so callers allocate everything beforehand.     */
 /*                                                                      */
 /************************************************************************/
-void write_read_mem(int *ptr, int write_flag)
+static void plan_maps(struct probe_plan *plan, FILE *fp)
 {
-	int stat;
-	struct sigaction sig;             
-	pid_t pid, wpid;		 
-
-	// Signal handling
-	sig.sa_handler = sig_handler;
-	sig.sa_flags = 0;
-	sigemptyset(&sig.sa_mask);
-	sigaction(SIGSEGV, &sig, NULL);
-	sigaction(SIGILL, &sig, NULL);
-	sigaction(SIGBUS, &sig, NULL);
-
-	// Try reading/writing to the memory addresses.
-	fflush(stdout);
-	pid = fork();   // Create child process
-	if (pid == 0) {
-		// Read or write to memory addresses
-		if (!write_flag) {
-			if (debug) {
-				fprintf(stderr, "Reading Memory Address"
-					" %p\n", ptr);
+	char line[200];
+	char flags[10];
+	char *start, *end, *last_end;
+	int is_stack_area;
+
+	last_end = 0;
+	while (!feof(fp)) {
+		is_stack_area = 0;
+		if (!fgets(line, sizeof line, fp)) break;
+
+		if (debug) {
+			printf("Line from /proc/self/maps: %s", line);
+		}
+
+		/* sample /proc/self/maps lines:
+		 * 40028000-4014f000 r-xp 00000000 03:05 283345   /lib/libc-2.3.2.so
+		 * 4014f000-40154000 rw-p 00127000 03:05 283345   /lib/libc-2.3.2.so
+		 * bfffc000-c0000000 rwxp ffffd000 00:00 0
+		 * or 64-bit
+		 * 00000000ffff9000-00000000fffff000 rwxp ffffffffffffb000 00:00 0
+		 */
+
+		sscanf(line, "%p-%p %s %*s", &start, &end, flags);
+		if (debug) {
+			printf("start %p, end %p, flags %s\n", start, end, flags);
+		}
+
+		if (start < (char *)&is_stack_area &&
+		    (char *)&is_stack_area < end) {
+			if (debug) printf("This is the stack area.\n");
+			is_stack_area = 1;
+		}
+
+		if (strchr(flags, 'w') == NULL) {
+			// This area is marked read-only. Try writing to it.
+			plan_region(plan, start, end, PROBE_STORE, NULL,
+				    memsep_probes);
+		}
+
+		if (start > last_end && !is_stack_area)  {
+			/* There is an unmapped area between the end of
+			 * the previous one and the start of the current
+			 * area.  Try reading a value from there, which
+			 * should fail.  Exception: don't try to read
+			 * the area reserved for the stack, since that
+			 * will auto-extend on some platforms.
+			 */
+			plan_region(plan, last_end, start, PROBE_LOAD, NULL,
+				    memsep_probes);
+		}
+		last_end = end;
+	}
+	plan->user_end = last_end;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: plan_syscalls                                              */
+/*                                                                      */
+/* PURPOSE: Turn a plan of the unmapped areas and kernel ranges into a  */
+/*          plan of system call probes, memsep_syscalls addresses per   */
+/*          range.  Read-only mappings are dropped: the kernel may well */
+/*          read them.                                                  */
+/*                                                                      */
+/************************************************************************/
+static void plan_syscalls(struct probe_plan *plan)
+{
+	struct probe_region *r;
+	int k, n = 0;
+
+	for (k = 0; k < plan->nregions; k++) {
+		r = &plan->region[k];
+		if (r->kind == PROBE_STORE)
+			continue;
+		r->kind = PROBE_SYSCALL;
+		r->probes = 2 + (unsigned long)memsep_syscalls;
+		if (r->probes > MAXPROBES)
+			r->probes = MAXPROBES;
+		plan->region[n++] = *r;
+	}
+	plan->nregions = n;
+	plan->syscalls = 1;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: probe_address                                              */
+/*                                                                      */
+/* PURPOSE: Attempts to read or write to a memory address.  Returns 1   */
+/*          if the access faulted.  A write probe stores back the value */
+/*          it read, so a write that wrongly succeeds cannot corrupt    */
+/*          our own mappings; an area that cannot even be read is       */
+/*          protected against writes as well.  Kernel addresses must    */
+/*          fault for the load and the store on their own.              */
+/*                                                                      */
+/************************************************************************/
+static int probe_address(int kind, int *ptr)
+{
+	struct trap_info ti;
+	int val = 0;
+	int faulted;
+
+	faulted = trap_load(ptr, &val, &ti);
+	switch (kind) {
+	case PROBE_LOAD:
+		return faulted;
+	case PROBE_STORE:
+		return faulted || trap_store(ptr, val, &ti);
+	default:
+		return faulted && trap_store(ptr, val, &ti);
+	}
+}
+
+/*
+ * System calls that are passed each address as a buffer of one int.
+ * Every one of them must fail with EFAULT, without a signal.
+ */
+static const char *syscall_names[] = {
+	"read", "write", "pread", "recvmsg", "getrandom", "pipe"
+};
+#define NSYSCALLS	(sizeof(syscall_names) / sizeof(syscall_names[0]))
+
+static const char syscall_data[sizeof(int)] = { 'a', 'm', 't', 'u' };
+
+/* Descriptors a worker passes the addresses to */
+struct syscall_fds {
+	int pipe[2];		/* holds syscall_data */
+	int sock[2];		/* one syscall_data datagram queued */
+	int file;		/* memfd holding syscall_data */
+};
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: syscall_setup                                              */
+/*                                                                      */
+/* PURPOSE: Create the worker's descriptors, each with data to read.    */
+/*          None of this maps memory.                                   */
+/*                                                                      */
+/************************************************************************/
+static int syscall_setup(struct syscall_fds *fds)
+{
+	int n = sizeof(syscall_data);
+
+	fds->pipe[0] = fds->pipe[1] = fds->sock[0] = fds->sock[1] = -1;
+	fds->file = memfd_create("amtu", MFD_CLOEXEC);
+	if (fds->file < 0 ||
+	    pipe2(fds->pipe, O_NONBLOCK | O_CLOEXEC) < 0 ||
+	    socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, fds->sock) < 0 ||
+	    write(fds->file, syscall_data, n) != n ||
+	    write(fds->pipe[1], syscall_data, n) != n ||
+	    send(fds->sock[0], syscall_data, n, 0) != n)
+		return -1;
+	return 0;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: syscall_done                                               */
+/*                                                                      */
+/* PURPOSE: Check that no call consumed or added data: the pipe holds   */
+/*          syscall_data alone and the socket the one datagram.  Then   */
+/*          close the descriptors.  Returns -1 if data was changed.     */
+/*                                                                      */
+/************************************************************************/
+static int syscall_done(struct syscall_fds *fds)
+{
+	char buf[2 * sizeof(syscall_data)];
+	int queued = -1;
+	int rc = 0;
+
+	if (ioctl(fds->pipe[0], FIONREAD, &queued) < 0 ||
+	    queued != sizeof(syscall_data) ||
+	    read(fds->pipe[0], buf, sizeof(buf)) != sizeof(syscall_data) ||
+	    memcmp(buf, syscall_data, sizeof(syscall_data)) != 0)
+		rc = -1;
+	if (recv(fds->sock[1], buf, sizeof(buf), MSG_DONTWAIT) !=
+		sizeof(syscall_data) ||
+	    memcmp(buf, syscall_data, sizeof(syscall_data)) != 0 ||
+	    recv(fds->sock[1], buf, sizeof(buf), MSG_DONTWAIT) != -1)
+		rc = -1;
+	if (rc && debug)
+		printf("System call probes changed the data queued\n");
+
+	close(fds->pipe[0]);
+	close(fds->pipe[1]);
+	close(fds->sock[0]);
+	close(fds->sock[1]);
+	close(fds->file);
+	return rc;
+}
+
+#define EFAULTED(call)	((call) == -1 && errno == EFAULT)
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: syscall_probe                                              */
+/*                                                                      */
+/* PURPOSE: Pass ptr as the buffer of each call in syscall_names.       */
+/*          Returns 0 if all failed with EFAULT, else the index + 1 of  */
+/*          the first that did not.  Data is only peeked at, so a call  */
+/*          that fails does not lose it.                                */
+/*                                                                      */
+/************************************************************************/
+static int syscall_probe(struct syscall_fds *fds, int *ptr)
+{
+	struct iovec iov = { ptr, sizeof(int) };
+	struct msghdr msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	if (!EFAULTED(read(fds->pipe[0], ptr, sizeof(int))))
+		return 1;
+	if (!EFAULTED(write(fds->pipe[1], ptr, sizeof(int))))
+		return 2;
+	if (!EFAULTED(pread(fds->file, ptr, sizeof(int), 0)))
+		return 3;
+	if (!EFAULTED(recvmsg(fds->sock[1], &msg, MSG_PEEK | MSG_DONTWAIT)))
+		return 4;
+	if (!EFAULTED(getrandom(ptr, sizeof(int), GRND_NONBLOCK)))
+		return 5;
+	if (!EFAULTED(pipe(ptr)))
+		return 6;
+	return 0;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: probe_worker                                               */
+/*                                                                      */
+/* PURPOSE: Execute this worker's share of the plan: every nworkers-th  */
+/*          probe of each region, starting at the worker's id.  Probe 0 */
+/*          and 1 are the first and last int of the region.  Must not   */
+/*          allocate memory, as that could map something into a gap.    */
+/*                                                                      */
+/************************************************************************/
+static void probe_worker(struct probe_plan *plan, int id)
+{
+	struct probe_region *r;
+	struct syscall_fds fds;
+	uint64_t seed;
+	unsigned long i, n;
+	int *ptr;
+	int k, bad;
+
+	if (plan->syscalls && syscall_setup(&fds) < 0) {
+		perror("memsep: could not set up system call probes");
+		__sync_fetch_and_add(&plan->failed, 1);
+		return;
+	}
+
+	seed = ((uint64_t)time(NULL) << 16) ^
+		((uint64_t)(id + 1) * 0x9E3779B97F4A7C15ULL);
+	for (k = 0; k < plan->nregions; k++) {
+		r = &plan->region[k];
+		n = 0;
+		for (i = id; i < r->probes; i += plan->nworkers) {
+			if (i == 0)
+				ptr = (int *)r->start;
+			else if (i == 1)
+				ptr = (int *)(r->end - sizeof(int));
+			else
+				ptr = get_pointer_in_range(r->start, r->end,
+						probe_rand(&seed));
+			if (r->kind == PROBE_SYSCALL)
+				bad = syscall_probe(&fds, ptr);
+			else
+				bad = !probe_address(r->kind, ptr);
+			if (bad && __sync_fetch_and_add(&r->missed, 1) == 0) {
+				r->miss_addr = (char *)ptr;
+				r->miss_call = bad;
 			}
-			fprintf(stderr, "value of address: %d\n", *ptr);
+			n++;
 		}
-		else {
-			if (debug) {
-				fprintf(stderr, "Writing to Memory Address"
-					" %p\n", ptr);
+		__sync_fetch_and_add(&r->done, n);
+	}
+	if (plan->syscalls && syscall_done(&fds) < 0)
+		__sync_fetch_and_add(&plan->failed, 1);
+}
+
+static void *probe_thread_main(void *arg)
+{
+	struct probe_thread *t = arg;
+
+	pthread_mutex_lock(&t->plan->lock);
+	while (!t->plan->go)
+		pthread_cond_wait(&t->plan->cond, &t->plan->lock);
+	pthread_mutex_unlock(&t->plan->lock);
+	probe_worker(t->plan, t->id);
+	return NULL;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: run_plan                                                   */
+/*                                                                      */
+/* PURPOSE: Run the plan with the workers started by start_workers(),   */
+/*          the calling thread being worker 0.  In fork mode the other  */
+/*          workers are child processes forked here.  Returns -1 if a   */
+/*          worker could not be run or died.                            */
+/*                                                                      */
+/************************************************************************/
+static int run_plan(struct probe_plan *plan, struct probe_thread *t)
+{
+	int i, stat, rc = 0;
+	pid_t pid;
+
+	if (memsep_fork) {
+		fflush(stdout);
+		for (i = 1; i < plan->nworkers; i++) {
+			pid = fork();
+			if (pid == 0) {
+				probe_worker(plan, i);
+				_exit(0);
+			} else if (pid == -1) {
+				perror("memsep: fork failed");
+				rc = -1;
 			}
-			*ptr = rand();
 		}
-		_exit(-1);
+		probe_worker(plan, 0);
+		while (wait(&stat) > 0) {
+			if (!(WIFEXITED(stat) && (WEXITSTATUS(stat) == 0)))
+				rc = -1;
+		}
+		return rc;
 	}
-	else if (pid == -1) {
-		// Error condition 
-		fprintf(stderr, "Memory Separation Test FAILED!\n");
-#ifdef HAVE_LIBLAUS
-		LAUS_LOG(("amtu failed memory separation test"))
+
+	pthread_mutex_lock(&plan->lock);
+	plan->go = 1;
+	pthread_cond_broadcast(&plan->cond);
+	pthread_mutex_unlock(&plan->lock);
+	probe_worker(plan, 0);
+	for (i = 1; i < plan->nworkers; i++)
+		pthread_join(t[i].tid, NULL);
+	return rc;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: start_workers                                              */
+/*                                                                      */
+/* PURPOSE: Create the probe threads before the maps are read, so that  */
+/*          their stacks are already part of the plan.  They wait for   */
+/*          plan->go until the plan is complete.                        */
+/*                                                                      */
+/************************************************************************/
+static void start_workers(struct probe_plan *plan, struct probe_thread *t)
+{
+	int i, n = amtu_nthreads();
+
+	if (memsep_fork) {
+		plan->nworkers = n;
+		return;
+	}
+
+	for (i = 0; i < n; i++) {
+		t[i].plan = plan;
+		t[i].id = i;
+	}
+	pthread_mutex_init(&plan->lock, NULL);
+	pthread_cond_init(&plan->cond, NULL);
+	for (i = 1; i < n; i++) {
+		if (pthread_create(&t[i].tid, NULL, probe_thread_main,
+				   &t[i]) != 0)
+			break;
+	}
+	if (i < n && debug)
+		printf("Only %d probe threads could be created\n", i);
+	/* Run with the ones we have */
+	plan->nworkers = i;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: report_plan                                                */
+/*                                                                      */
+/* PURPOSE: Print the coverage of each kind of region: the kernel      */
+/*          ranges by name, and the user space areas probed with reads, */
+/*          writes or system calls, with the lowest coverage of any of  */
+/*          their regions, then the overall probe rate.  With debug     */
+/*          every region is printed as well.  Returns -1 if any probe   */
+/*          did not fault.                                              */
+/*                                                                      */
+/************************************************************************/
+static int report_plan(struct probe_plan *plan, double elapsed)
+{
+	struct probe_region *r;
+	struct {
+		const char *what;
+		int regions;
+		unsigned long long done;
+		double pages, low;
+	} kinds[MAXKINDS];
+	unsigned long long total = 0;
+	long pagesize = sysconf(_SC_PAGESIZE);
+	double pages, coverage;
+	const char *what;
+	int j, k, nkinds = 0, rc = 0;
+
+	for (k = 0; k < plan->nregions; k++) {
+		r = &plan->region[k];
+		pages = ((uintptr_t)r->end - (uintptr_t)r->start) /
+			(double)pagesize;
+		coverage = pages < 1 ? 100 : 100 * r->done / pages;
+		if (coverage > 100)
+			coverage = 100;
+		total += r->done;
+		if (r->name)
+			what = r->name;
+		else if (r->kind == PROBE_SYSCALL)
+			what = "unmapped";
+		else
+			what = r->kind == PROBE_LOAD ? "read" : "write";
+		if (debug)
+			printf("  %p-%p %-14s %9lu probes %10.4g%% of "
+				"pages\n", r->start, r->end, what, r->done,
+				coverage);
+		for (j = 0; j < nkinds; j++)
+			if (strcmp(kinds[j].what, what) == 0)
+				break;
+		if (j == nkinds && nkinds < MAXKINDS) {
+			kinds[j].what = what;
+			kinds[j].regions = 0;
+			kinds[j].done = 0;
+			kinds[j].pages = 0;
+			kinds[j].low = 100;
+			nkinds++;
+		}
+		if (j < nkinds) {
+			kinds[j].regions++;
+			kinds[j].done += r->done;
+			kinds[j].pages += pages < 1 ? 1 : pages;
+			if (coverage < kinds[j].low)
+				kinds[j].low = coverage;
+		}
+		if (r->missed && r->kind == PROBE_SYSCALL) {
+			fprintf(stderr, "%lu %s addresses were not rejected "
+				"with EFAULT in %p-%p, first %p by %s()\n",
+				r->missed, what, r->start, r->end,
+				r->miss_addr, syscall_names[r->miss_call - 1]);
+			rc = -1;
+		} else if (r->missed) {
+			fprintf(stderr, "%lu %s probes did not fault in "
+				"%p-%p, first at %p\n", r->missed, what,
+				r->start, r->end, r->miss_addr);
+			rc = -1;
+		}
+	}
+	for (j = 0; j < nkinds; j++) {
+		coverage = 100 * kinds[j].done / kinds[j].pages;
+		printf("  %-14s %5d regions %12llu probes %10.4g%% of "
+			"pages, lowest %.4g%%\n", kinds[j].what,
+			kinds[j].regions, kinds[j].done,
+			coverage > 100 ? 100 : coverage, kinds[j].low);
+	}
+	if (plan->failed) {
+		fprintf(stderr, "%d workers failed to set up or changed "
+			"their data\n", plan->failed);
+		rc = -1;
+	}
+	if (plan->syscalls) {
+		printf("%llu calls at %llu addresses in %d regions by %d %s: "
+			"%.3f s, %.0f calls/s\n", total * NSYSCALLS, total,
+			plan->nregions, plan->nworkers,
+			memsep_fork ? "processes" : "threads", elapsed,
+			elapsed > 0 ? total * NSYSCALLS / elapsed : 0);
+		return rc;
+	}
+	printf("%llu probes in %d regions by %d %s: %.3f s, %.0f probes/s\n",
+		total, plan->nregions, plan->nworkers,
+		memsep_fork ? "processes" : "threads", elapsed,
+		elapsed > 0 ? total / elapsed : 0);
+	return rc;
+}
+
+/* Expected outcome of an access in the protection sweep */
+#define ACC_FAULT	0	/* must raise SIGSEGV */
+#define ACC_WORK	1	/* must complete */
+#define ACC_EITHER	2	/* depends on the hardware */
+#define ACC_SKIP	3	/* not tried */
+
+#define ACC_READ	0
+#define ACC_WRITE	1
+#define ACC_EXEC	2
+
+/*
+ * A "return" instruction to place in the regions we execute.  Where we
+ * do not have one, or function pointers are descriptors, the execute
+ * accesses are skipped.
+ */
+#if defined(HAVE_I86) || defined(HAVE_X86_64)
+static const unsigned char ret_stub[] = { 0xc3 };		/* ret */
+#elif defined(HAVE_AARCH64)
+static const unsigned char ret_stub[] = { 0xc0, 0x03, 0x5f, 0xd6 };	/* ret */
+#elif defined(HAVE_S390)
+static const unsigned char ret_stub[] = { 0x07, 0xfe };	/* br %r14 */
+#elif defined(HAVE_PPC64) && defined(__LITTLE_ENDIAN__)
+static const unsigned char ret_stub[] = { 0x20, 0x00, 0x80, 0x4e };	/* blr */
 #else
-		AUDIT_LOG("amtu failed memory separation test", 0)
+#define NO_RET_STUB
+static const unsigned char ret_stub[] = { 0 };
 #endif
-		exit(-1);
-	}
 
-	// Parent process
-	wpid = wait(&stat);
+/* A kind of protected memory and what each access to it must do */
+struct prot_target {
+	const char *name;
+	int prot;		/* anonymous regions: protection to test */
+	int expect[3];		/* indexed by ACC_READ, _WRITE, _EXEC */
+	int special;		/* kernel provided mapping, SIGBUS allowed */
+	unsigned long regions;
+	unsigned long accesses;
+	unsigned long wrong;
+};
 
-	// Check if child process exited cleanly.
-	// If not, report failure.
-	if (!(WIFEXITED(stat) && (WEXITSTATUS(stat) == 0))) {
-		fprintf(stderr, "Memory Separation Test FAILED!\n");
-#ifdef HAVE_LIBLAUS
-		LAUS_LOG(("amtu failed memory separation test"))
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: have_nx                                                    */
+/*                                                                      */
+/* PURPOSE: Whether data pages can be made non-executable.  Only 32-bit */
+/*          x86 without PAE lacks that among our architectures.         */
+/*                                                                      */
+/************************************************************************/
+static int have_nx(void)
+{
+#if defined(HAVE_I86) || defined(HAVE_X86_64)
+	return amtu_cpuinfo_flag("nx");
 #else
-		AUDIT_LOG("amtu failed memory separation test", 0)
+	return 1;
+#endif
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: check_access                                               */
+/*                                                                      */
+/* PURPOSE: Perform one access on addr and compare the outcome with     */
+/*          what the target expects.  A fault must be a SIGSEGV (or a   */
+/*          SIGBUS in a kernel provided mapping) at addr.  Returns 0 if */
+/*          the outcome was right.                                      */
+/*                                                                      */
+/************************************************************************/
+static int check_access(struct prot_target *t, int acc, char *addr)
+{
+	struct trap_info ti;
+	int expect = t->expect[acc];
+	int val = 0;
+	int faulted;
+
+	if (expect == ACC_SKIP)
+		return 0;
+	t->accesses++;
+	switch (acc) {
+	case ACC_READ:
+		faulted = trap_load((int *)addr, NULL, &ti);
+		break;
+	case ACC_WRITE:
+		/* Store back what is there, if it can be read */
+		trap_load((int *)addr, &val, &ti);
+		faulted = trap_store((int *)addr, val, &ti);
+		break;
+	default:
+		faulted = trap_call((void (*)(void))addr, &ti);
+		break;
+	}
+
+	if (!faulted)
+		return expect == ACC_FAULT;
+	if (expect == ACC_WORK)
+		return 1;
+	if (ti.sig != SIGSEGV && !(t->special && ti.sig == SIGBUS))
+		return 1;
+	if ((char *)ti.addr != addr && !t->special)
+		return 1;
+	if (acc == ACC_EXEC && ti.pc && (char *)ti.pc != addr)
+		return 1;
+	return 0;
+}
+
+static void check_region(struct prot_target *t, char *addr)
+{
+	static const char *accname[] = { "read", "write", "execute" };
+	int acc;
+
+	t->regions++;
+	for (acc = ACC_READ; acc <= ACC_EXEC; acc++) {
+		if (check_access(t, acc, addr)) {
+			t->wrong++;
+			if (debug || t->wrong == 1)
+				fprintf(stderr, "%s: %s of %p gave the wrong "
+					"result\n", t->name, accname[acc],
+					addr);
+		}
+	}
+}
+
+static void *guard_thread(void *arg)
+{
+	int *fd = arg;
+	char c;
+
+	/* Keep our stack, and its guard page, until released */
+	while (read(*fd, &c, 1) > 0)
+		;
+	return NULL;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: sweep_anon                                                 */
+/*                                                                      */
+/* PURPOSE: Create memsep_regions anonymous regions with the target's   */
+/*          protection and a return instruction at their start, then    */
+/*          check all of them.                                          */
+/*                                                                      */
+/************************************************************************/
+static int sweep_anon(struct prot_target *t, long pagesize)
+{
+	char **region;
+	int i, n = memsep_regions;
+	int rc = 0;
+
+	region = calloc(n, sizeof(*region));
+	if (region == NULL)
+		return -1;
+	for (i = 0; i < n; i++) {
+		region[i] = mmap(NULL, pagesize, PROT_READ | PROT_WRITE,
+				 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (region[i] == MAP_FAILED) {
+			region[i] = NULL;
+			break;
+		}
+		memcpy(region[i], ret_stub, sizeof(ret_stub));
+		__builtin___clear_cache(region[i],
+					region[i] + sizeof(ret_stub));
+		if (mprotect(region[i], pagesize, t->prot) < 0)
+			break;
+	}
+	if (i < n) {
+		perror("memsep: could not create test region");
+		rc = -1;
+	}
+	for (i = 0; i < n && region[i]; i++) {
+		if (rc == 0)
+			check_region(t, region[i]);
+		munmap(region[i], pagesize);
+	}
+	free(region);
+	return rc;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: sweep_guards                                               */
+/*                                                                      */
+/* PURPOSE: Check the guard pages below the stacks of a few threads,    */
+/*          and that the stack right above each guard is usable.        */
+/*                                                                      */
+/************************************************************************/
+static int sweep_guards(struct prot_target *t)
+{
+	struct trap_info ti;
+	pthread_t tid[4];
+	pthread_attr_t attr;
+	void *stack;
+	size_t size, guard;
+	int fd[2];
+	int i, n, rc = 0;
+
+	if (pipe(fd) < 0)
+		return -1;
+	for (n = 0; n < 4; n++)
+		if (pthread_create(&tid[n], NULL, guard_thread, &fd[0]))
+			break;
+	for (i = 0; i < n; i++) {
+		if (pthread_getattr_np(tid[i], &attr) != 0) {
+			rc = -1;
+			continue;
+		}
+		pthread_attr_getstack(&attr, &stack, &size);
+		pthread_attr_getguardsize(&attr, &guard);
+		pthread_attr_destroy(&attr);
+		if (guard == 0) {
+			fprintf(stderr, "Thread stack has no guard page\n");
+			rc = -1;
+			continue;
+		}
+		check_region(t, (char *)stack - guard);
+		check_region(t, (char *)stack - sizeof(int));
+		if (trap_load(stack, NULL, &ti)) {
+			fprintf(stderr, "Thread stack at %p is not readable\n",
+				stack);
+			rc = -1;
+		}
+	}
+	close(fd[1]);
+	for (i = 0; i < n; i++)
+		pthread_join(tid[i], NULL);
+	close(fd[0]);
+	return rc;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: sweep_special                                              */
+/*                                                                      */
+/* PURPOSE: Check every page of the kernel provided mappings whose name */
+/*          in /proc/self/maps starts like the target's name.           */
+/*                                                                      */
+/************************************************************************/
+static int sweep_special(struct prot_target *t, long pagesize)
+{
+	FILE *fp;
+	char line[200];
+	char *start, *end, *name, *p;
+
+	fp = fopen("/proc/self/maps", "r");
+	if (fp == NULL)
+		return -1;
+	while (fgets(line, sizeof line, fp)) {
+		name = strchr(line, '[');
+		if (name == NULL ||
+		    strncmp(name, t->name, strlen(t->name) - 1) != 0)
+			continue;
+		sscanf(line, "%p-%p", &start, &end);
+		for (p = start; p < end; p += pagesize)
+			check_region(t, p);
+	}
+	fclose(fp);
+	return 0;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: prot_sweep                                                 */
+/*                                                                      */
+/* PURPOSE: Check that page protections are enforced for read, write   */
+/*          and execute: anonymous PROT_NONE, PROT_READ and PROT_EXEC   */
+/*          regions, thread stack guard pages, the vDSO and vvar.       */
+/*          Returns -1 if any access gave the wrong result.             */
+/*                                                                      */
+/************************************************************************/
+static int prot_sweep(void)
+{
+	long pagesize = sysconf(_SC_PAGESIZE);
+	int nx = have_nx();
+	int i, rc = 0;
+	double start, elapsed;
+	unsigned long accesses = 0;
+	/*
+	 * Execute-only memory stays readable unless the MMU (or x86
+	 * protection keys) can express it.  vvar may contain pages that
+	 * are not backed and raise SIGBUS.  The vDSO is executable on
+	 * purpose, so we do not jump into it.
+	 */
+	struct prot_target targets[] = {
+		{ "PROT_NONE", PROT_NONE,
+		  { ACC_FAULT, ACC_FAULT, ACC_FAULT }, 0, 0, 0, 0 },
+		{ "PROT_READ", PROT_READ,
+		  { ACC_WORK, ACC_FAULT, ACC_FAULT }, 0, 0, 0, 0 },
+		{ "PROT_EXEC", PROT_EXEC,
+		  { ACC_EITHER, ACC_FAULT, ACC_WORK }, 0, 0, 0, 0 },
+		{ "stack guard", 0,
+		  { ACC_FAULT, ACC_FAULT, ACC_FAULT }, 0, 0, 0, 0 },
+		{ "[vdso]", 0,
+		  { ACC_WORK, ACC_FAULT, ACC_SKIP }, 1, 0, 0, 0 },
+		{ "[vvar]", 0,
+		  { ACC_EITHER, ACC_FAULT, ACC_FAULT }, 1, 0, 0, 0 },
+	};
+	int ntargets = sizeof(targets) / sizeof(targets[0]);
+
+	if (memsep_regions <= 0)
+		return 0;
+
+	for (i = 0; i < ntargets; i++) {
+#ifdef NO_RET_STUB
+		targets[i].expect[ACC_EXEC] = ACC_SKIP;
 #endif
-		exit(-1);
+		/* Without NX readable data may be executed; don't jump
+		 * into data we did not put there ourselves. */
+		if (!nx && targets[i].prot == PROT_READ)
+			targets[i].expect[ACC_EXEC] = ACC_EITHER;
+		if (!nx && targets[i].special)
+			targets[i].expect[ACC_EXEC] = ACC_SKIP;
 	}
+
+	start = amtu_now();
+	for (i = 0; i < 3; i++)
+		rc |= sweep_anon(&targets[i], pagesize);
+	rc |= sweep_guards(&targets[3]);
+	rc |= sweep_special(&targets[4], pagesize);
+	rc |= sweep_special(&targets[5], pagesize);
+	elapsed = amtu_now() - start;
+
+	for (i = 0; i < ntargets; i++) {
+		printf("  %-14s %6lu regions %7lu accesses %5lu wrong\n",
+			targets[i].name, targets[i].regions,
+			targets[i].accesses, targets[i].wrong);
+		accesses += targets[i].accesses;
+		if (targets[i].wrong)
+			rc = -1;
+	}
+	printf("%lu protection checks: %.3f s, %.0f checks/s%s\n", accesses,
+		elapsed, elapsed > 0 ? accesses / elapsed : 0,
+		nx ? "" : " (no NX)");
+	return rc;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: syscall_sweep                                              */
+/*                                                                      */
+/* PURPOSE: Check that the kernel rejects user supplied pointers to the */
+/*          unmapped areas and the kernel half of the address space,    */
+/*          not just the MMU.  The maps are read again, as the probe    */
+/*          threads of the first plan are gone.  Returns -1 if any call */
+/*          accepted an address.                                        */
+/*                                                                      */
+/************************************************************************/
+static int syscall_sweep(void)
+{
+	struct probe_plan *plan;
+	struct probe_thread t[MAXTHREADS];
+	FILE *fp;
+	double start;
+	int rc;
+
+	if (memsep_syscalls <= 0)
+		return 0;
+
+	plan = mmap(NULL, sizeof(*plan), PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (plan == MAP_FAILED)
+		return -1;
+	fp = fopen("/proc/self/maps", "r");
+	if (fp == NULL) {
+		fprintf(stderr, "File /proc/self/maps could not be opened");
+		munmap(plan, sizeof(*plan));
+		return -1;
+	}
+
+	start_workers(plan, t);
+	plan_maps(plan, fp);
+	fclose(fp);
+	plan_kernel(plan);
+	plan_syscalls(plan);
+
+	start = amtu_now();
+	rc = run_plan(plan, t);
+	rc |= report_plan(plan, amtu_now() - start);
+	munmap(plan, sizeof(*plan));
+	return rc;
 }
 
 /************************************************************************/
 /*                                                                      */
 /* FUNCTION: memsep                                                     */
 /*                                                                      */
-/* PURPOSE: Execute Memory Separation Test that randomly writes to      */
-//          areas of memory, then reads the memory back to ensure       */
-/*          the values written remain unchanged.                        */
+/* PURPOSE: Execute Memory Separation Test that tries to write to the   */
+/*          read-only areas of memory, read from the unmapped areas of  */
+/*          memory and read and write the kernel half of the address    */
+/*          space, all of which must fault.                             */
 /*                                                                      */
 /************************************************************************/
 int memsep(int argc, char *argv[])
@@ -188,10 +1218,10 @@ int memsep(int argc, char *argv[])
 	struct passwd *pwd;          
 	uid_t id;                    
 	FILE *fp;
-	char line[200];
-	char flags[10];
-	int *start, *end, *inrange, *last_end;
-	int is_stack_area;
+	struct probe_plan *plan;
+	struct probe_thread t[MAXTHREADS];
+	double start;
+	int rc;
 
 	printf("Executing Memory Separation Test...\n");
 
@@ -213,6 +1243,18 @@ int memsep(int argc, char *argv[])
 		id = pwd->pw_uid;
 	}
 
+	plan = mmap(NULL, sizeof(*plan), PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (plan == MAP_FAILED || trap_init() < 0) {
+		fprintf(stderr, "Memory Separation Test FAILED!\n");
+#ifdef HAVE_LIBLAUS
+		LAUS_LOG(("amtu failed memory separation test"))
+#else
+		AUDIT_LOG("amtu failed memory separation test", 0)
+#endif
+		return -1;
+	}
+
 #ifndef HAVE_LIBAUDIT
 /* On RHEL4 must be root in order to read /proc/self/maps */
 /* Don't switch to user nobody if running on RHEL4 */
@@ -239,59 +1281,27 @@ int memsep(int argc, char *argv[])
                 AUDIT_LOG("amtu memory separation test: file"
 			" /proc/meminfo could not be opened", 0)
 #endif
+		munmap(plan, sizeof(*plan));
 		return -1;
 	}
 
-	srand((unsigned) time(NULL));
-
-	// Get memory ranges from /proc/self/maps, then
-	// attempt to read/write to memory
-	last_end = 0;
-	while (!feof(fp)) {
-		is_stack_area = 0;
-		if (!fgets(line, sizeof line, fp)) break;
-
-		if (debug) {
-			printf("Line from /proc/self/maps: %s", line);
-		}
+	// Start the workers first, then get memory ranges from
+	// /proc/self/maps and attempt to read/write to memory
+	start_workers(plan, t);
+	plan_maps(plan, fp);
+	fclose(fp);
+	plan_kernel(plan);
 
-		/* sample /proc/self/maps lines:
-		 * 40028000-4014f000 r-xp 00000000 03:05 283345   /lib/libc-2.3.2.so
-		 * 4014f000-40154000 rw-p 00127000 03:05 283345   /lib/libc-2.3.2.so
-		 * bfffc000-c0000000 rwxp ffffd000 00:00 0
-		 * or 64-bit
-		 * 00000000ffff9000-00000000fffff000 rwxp ffffffffffffb000 00:00 0
-		 */
+	start = amtu_now();
+	rc = run_plan(plan, t);
+	rc |= report_plan(plan, amtu_now() - start);
+	munmap(plan, sizeof(*plan));
 
-		sscanf(line, "%p-%p %s %*s", &start, &end, flags);
-		if (debug) {
-			printf("start %p, end %p, flags %s\n", start, end, flags);
-		}
+	// Pass the unmapped and kernel addresses to system calls
+	rc |= syscall_sweep();
 
-		if (start < &is_stack_area && &is_stack_area < end) {
-			if (debug) printf("This is the stack area.\n");
-			is_stack_area = 1;
-		}
-
-		if (strchr(flags, 'w') == NULL) {
-			// This area is marked read-only. Try writing to it.
-			inrange = get_pointer_in_range(start, end);
-			write_read_mem(inrange, 1);
-		}
-
-		if (start > last_end && !is_stack_area)  {
-			/* There is an unmapped area between the end of
-			 * the previous one and the start of the current
-			 * area.  Try reading a value from there, which
-			 * should fail.  Exception: don't try to read
-			 * the area reserved for the stack, since that
-			 * will auto-extend on some platforms.
-			 */
-			inrange = get_pointer_in_range(last_end, start);
-			write_read_mem(inrange, 0);
-		}
-		last_end = end;
-	}
+	// Check page protections, guard pages and NX
+	rc |= prot_sweep();
 
 #ifndef HAVE_LIBAUDIT
 /* On RHEL4 don't need to change back, still root */
@@ -316,6 +1326,16 @@ int memsep(int argc, char *argv[])
 	}
 #endif
 
+	if (rc != 0) {
+		fprintf(stderr, "Memory Separation Test FAILED!\n");
+#ifdef HAVE_LIBLAUS
+		LAUS_LOG(("amtu failed memory separation test"))
+#else
+		AUDIT_LOG("amtu failed memory separation test", 0)
+#endif
+		return -1;
+	}
+
 	fprintf(stderr, "Memory Separation Test SUCCESS!\n");
 #ifdef HAVE_LIBLAUS
 	LAUS_LOG(("amtu - Memory Separation Test succeeded"))
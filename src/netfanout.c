@@ -0,0 +1,825 @@
+//----------------------------------------------------------------------
+//
+// Module Name:  netfanout.c
+//
+// Include File:  amtu.h
+//
+// Description:   Code for Abstract Machine Test Utility - RX queue
+//                engine of the I/O Controller-Network test.
+//
+// Notes:  A multi-queue NIC spreads what it receives over its RX
+//         queues by a hash of the addresses in each frame, so the
+//         identical frames of the other engines all land on one queue,
+//         and a queue that drops or corrupts frames goes unnoticed.
+//         With net_engine 5 the net_frames frames of each interface
+//         are sent as IPv4/UDP datagrams instead, in flows of their
+//         own source address and port, which receive side scaling
+//         hashes onto every queue; the amtu frame is the UDP payload.
+//         The receiving interface gets a PACKET_FANOUT group of one
+//         socket per RX queue, each read by a worker thread pinned to
+//         a CPU of its own, and a classic BPF fanout program steers
+//         every frame to the socket of the queue the driver recorded
+//         it on.  Frames of no recorded queue go to an extra socket.
+//         veth records no RX queue: a frame keeps the TX queue its
+//         peer sent it on, which veth hands to the RX queue of the
+//         same number, so on veth that number is taken as the queue.
+//         The RX queues are the ones in use, and a queue that none of
+//         the flows reached fails.
+//         A frame is credited to the interface whose address it was
+//         sent from, so the frames of one interface must reach
+//         another interface under test, as on veth pairs or on ports
+//         cabled to each other.  A lost frame is charged to the queue
+//         the rest of its flow arrived on.  Each queue is reported
+//         with its throughput, and fails on a corrupted frame or if
+//         it lost more than net_loss_ppm frames per million.
+//         The return code is the number of interfaces that failed.
+// -----------------------------------------------------------------
+// LANGUAGE:     C
+//
+// Licensed under the Common Public License v. 1.0
+// -----------------------------------------------------------------
+
+#define _GNU_SOURCE
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <net/if.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+#include <linux/sockios.h>
+#include <linux/ethtool.h>
+#include "amtu.h"
+
+#define FANOUT_HDRLEN	28	/* IPv4 and UDP headers */
+#define FANOUT_FLOWS	16	/* flows per RX queue */
+#define FANOUT_SADDR	0xc6120000	/* 198.18.0.0, plus the flow */
+#define FANOUT_DADDR	0xc6130001	/* 198.19.0.1 */
+#define FANOUT_SPORT	0xc000	/* UDP source port, plus the flow */
+#define FANOUT_PORT	0x414d	/* UDP destination port, "AM" */
+#define FANOUT_BATCH	64	/* frames per recvmmsg() of a worker */
+#define FANOUT_POLL	10	/* ms a worker waits before checking stop */
+#define FANOUT_SKB	1024	/* kernel overhead per queued frame */
+#define FANOUT_WINDOW	4	/* bursts in flight per interface */
+#define FANOUT_MAXBURST	4096
+
+/* One RX queue of an interface, and the worker thread reading it */
+struct fanout_queue {
+	struct if_test t;	/* the frames that arrived on the queue */
+	int queue;		/* nqueues for frames of no recorded queue */
+	int cpu;		/* the worker is pinned to, -1 if none */
+	int sock;		/* member of the fanout group, -1 if none */
+	int running;		/* worker started */
+	pthread_t tid;
+	unsigned int *high;	/* per sender, one past the highest seq */
+	unsigned long lost;	/* frames of its flows that never came */
+};
+
+/* One interface: the frames it sends and the queues it receives on */
+struct fanout_if {
+	struct net_stream s;	/* the frames sent, seen set by workers */
+	int tx;			/* send socket */
+	unsigned int nqueues;
+	unsigned int txqueue;	/* 1 if frames keep the TX queue, as on veth */
+	struct fanout_queue *queues;	/* nqueues + 1 */
+	struct fanout_queue **flowq;	/* per flow, queue it arrived on */
+	unsigned long arrived;	/* good frames, counted by the workers */
+	unsigned long unseen;	/* lost in flows no frame of arrived */
+	int unpaced;		/* frames went missing, window is off */
+	unsigned char *txbuf;	/* net_burst datagrams to send */
+	struct mmsghdr *txmsg;
+	struct iovec *iov;
+	struct sockaddr_ll dest;
+};
+
+/* Shared with the workers, which credit frames by their sender */
+static struct if_test *fanout_tests;
+static struct fanout_if *fanout_ifs;
+static int fanout_count;
+static unsigned int fanout_flows;
+static volatile int fanout_stop;
+
+/*
+ * Socket filter of the queue sockets: accept only IPv4/UDP datagrams to
+ * FANOUT_PORT with NET_MAGIC at the start of their payload, as they
+ * arrive and not as they leave, so the frames are seen once, on the
+ * interface that received them.
+ */
+static struct sock_filter fanout_filter[] = {
+	BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_AD_OFF + SKF_AD_PKTTYPE),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, PACKET_OUTGOING, 11, 0),
+	BPF_STMT(BPF_LD | BPF_H | BPF_ABS, SKF_AD_OFF + SKF_AD_PROTOCOL),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IP, 0, 9),
+	BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 0),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x45, 0, 7),
+	BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 9),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, 5),
+	BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 22),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, FANOUT_PORT, 0, 3),
+	BPF_STMT(BPF_LD | BPF_W | BPF_ABS, FANOUT_HDRLEN),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+		 (NET_MAGIC[0] << 24) | (NET_MAGIC[1] << 16) |
+		 (NET_MAGIC[2] << 8) | NET_MAGIC[3], 0, 1),
+	BPF_STMT(BPF_RET | BPF_K, 0xffff),
+	BPF_STMT(BPF_RET | BPF_K, 0),
+};
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: fanout_header					*/
+/*								*/
+/* PURPOSE: Write the IPv4 and UDP headers of frame seq, of	*/
+/*	    len bytes of payload, at p.  The flow of the frame	*/
+/*	    picks its source address and port.  The UDP		*/
+/*	    checksum is left out, the payload has its own CRC.	*/
+/*								*/
+/****************************************************************/
+static void fanout_header(unsigned char *p, unsigned int seq, int len)
+{
+	unsigned int flow = seq % fanout_flows, sum = 0;
+	unsigned int saddr = FANOUT_SADDR + flow;
+	int i;
+
+	memset(p, 0, FANOUT_HDRLEN);
+	p[0] = 0x45;			/* version 4, 5 words of header */
+	p[2] = (FANOUT_HDRLEN + len) >> 8;
+	p[3] = FANOUT_HDRLEN + len;
+	p[6] = 0x40;			/* don't fragment */
+	p[8] = 64;			/* TTL */
+	p[9] = IPPROTO_UDP;
+	for (i = 0; i < 4; i++) {
+		p[12 + i] = saddr >> (24 - 8 * i);
+		p[16 + i] = FANOUT_DADDR >> (24 - 8 * i);
+	}
+	for (i = 0; i < 20; i += 2)
+		sum += p[i] << 8 | p[i + 1];
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = ~((sum & 0xffff) + (sum >> 16));
+	p[10] = sum >> 8;
+	p[11] = sum;
+
+	p[20] = (FANOUT_SPORT + flow) >> 8;
+	p[21] = FANOUT_SPORT + flow;
+	p[22] = FANOUT_PORT >> 8;
+	p[23] = FANOUT_PORT & 0xff;
+	p[24] = (8 + len) >> 8;
+	p[25] = 8 + len;
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: fanout_account					*/
+/*								*/
+/* PURPOSE: Verify and count one datagram of len bytes, -1 if	*/
+/*	    it was truncated, that arrived on queue q from	*/
+/*	    link address from at now.  Its headers must be the	*/
+/*	    ones sent for its sequence number, and its payload	*/
+/*	    a good frame of the stream of the sender.		*/
+/*								*/
+/****************************************************************/
+static void fanout_account(struct fanout_queue *q,
+			   const struct sockaddr_ll *from,
+			   const unsigned char *ip, int len, double now)
+{
+	struct fanout_if *fi;
+	unsigned char hdr[FANOUT_HDRLEN];
+	unsigned int seq;
+	int k;
+
+	for (k = 0; k < fanout_count; k++)
+		if (from->sll_halen == fanout_tests[k].iff->halen &&
+		    memcmp(from->sll_addr, fanout_tests[k].iff->lladdr,
+			   from->sll_halen) == 0)
+			break;
+	if (len < FANOUT_HDRLEN || k == fanout_count) {
+		q->t.bad++;
+		return;
+	}
+	fi = &fanout_ifs[k];
+	len -= FANOUT_HDRLEN;
+	if (net_check_frame(&q->t, ip + FANOUT_HDRLEN, len, &seq) < 0 ||
+	    seq >= fi->s.count ||
+	    len != net_stream_len(&fi->s, seq)) {
+		q->t.bad++;
+		return;
+	}
+	fanout_header(hdr, seq, len);
+	if (memcmp(hdr, ip, FANOUT_HDRLEN) != 0) {
+		if (q->t.reports++ < NET_REPORTS)
+			printf("  %-16s frame %u has corrupted IP or UDP "
+				"headers\n", q->t.iff->ifname, seq);
+		q->t.bad++;
+		return;
+	}
+	if (__sync_lock_test_and_set(&fi->s.seen[seq], 1)) {
+		q->t.dups++;
+		return;
+	}
+	fi->flowq[seq % fanout_flows] = q;
+	if (seq + 1 < q->high[k])
+		q->t.reordered++;
+	else
+		q->high[k] = seq + 1;
+	__sync_fetch_and_add(&fi->arrived, 1);
+	if (q->t.frames++ == 0)
+		q->t.sent = now;
+	q->t.bytes += len;
+	q->t.last = now;
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: fanout_worker					*/
+/*								*/
+/* PURPOSE: Thread reading the socket of one queue, pinned to	*/
+/*	    its CPU, FANOUT_BATCH frames per recvmmsg(), until	*/
+/*	    fanout_stop is set.					*/
+/*								*/
+/****************************************************************/
+static void *fanout_worker(void *arg)
+{
+	struct fanout_queue *q = arg;
+	struct mmsghdr msg[FANOUT_BATCH];
+	struct iovec iov[FANOUT_BATCH];
+	struct sockaddr_ll from[FANOUT_BATCH];
+	struct pollfd pfd;
+	unsigned char *buf;
+	size_t size = q->t.iff->mtu;
+	cpu_set_t set;
+	int i, n;
+	double now;
+
+	if (q->cpu >= 0) {
+		CPU_ZERO(&set);
+		CPU_SET(q->cpu, &set);
+		if (sched_setaffinity(0, sizeof(set), &set) < 0)
+			q->cpu = -1;
+	}
+	buf = malloc(FANOUT_BATCH * size);
+	if (buf == NULL) {
+		fprintf(stderr, "netfanout: malloc failed\n");
+		q->t.failed = 1;
+		return NULL;
+	}
+	memset(msg, 0, sizeof(msg));
+	for (i = 0; i < FANOUT_BATCH; i++) {
+		iov[i].iov_base = buf + i * size;
+		iov[i].iov_len = size;
+		msg[i].msg_hdr.msg_iov = &iov[i];
+		msg[i].msg_hdr.msg_iovlen = 1;
+		msg[i].msg_hdr.msg_name = &from[i];
+	}
+	pfd.fd = q->sock;
+	pfd.events = POLLIN;
+	while (!fanout_stop) {
+		if (poll(&pfd, 1, FANOUT_POLL) <= 0)
+			continue;
+		for (i = 0; i < FANOUT_BATCH; i++)
+			msg[i].msg_hdr.msg_namelen = sizeof(from[i]);
+		n = recvmmsg(q->sock, msg, FANOUT_BATCH, MSG_DONTWAIT, NULL);
+		now = amtu_now();
+		for (i = 0; i < n; i++)
+			fanout_account(q, &from[i], iov[i].iov_base,
+				       msg[i].msg_hdr.msg_flags & MSG_TRUNC ?
+				       -1 : (int)msg[i].msg_len, now);
+	}
+	free(buf);
+	return NULL;
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: fanout_join					*/
+/*								*/
+/* PURPOSE: Open the socket of queue q of interface t, bind it	*/
+/*	    and add it to the fanout group of the interface.	*/
+/*	    The first socket creates the group with an id of	*/
+/*	    its own, puts the interface in promiscuous mode and	*/
+/*	    loads the fanout program; the sockets join in queue	*/
+/*	    order, so socket k gets what the program returns k	*/
+/*	    for.  The program reads the queue_mapping of the	*/
+/*	    frame, which is the RX queue plus one if the driver	*/
+/*	    recorded one, or the TX queue kept on veth.		*/
+/*								*/
+/****************************************************************/
+static int fanout_join(struct if_test *t, struct fanout_if *fi,
+		       struct fanout_queue *q, int *id)
+{
+	struct sock_filter steer[] = {
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_QUEUE),
+		BPF_STMT(BPF_ALU | BPF_ADD | BPF_K, fi->txqueue),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 3, 0),
+		BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, fi->nqueues, 2, 0),
+		BPF_STMT(BPF_ALU | BPF_SUB | BPF_K, 1),
+		BPF_STMT(BPF_RET | BPF_A, 0),
+		BPF_STMT(BPF_RET | BPF_K, fi->nqueues),
+	};
+	struct sock_fprog prog;
+	struct packet_mreq mr;
+	struct sockaddr_ll sll;
+	socklen_t len;
+	int val, rcvbuf;
+
+	q->sock = socket(PF_PACKET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+			 0);
+	if (q->sock < 0) {
+		perror("netfanout:socket() failed");
+		return -1;
+	}
+	prog.len = sizeof(fanout_filter) / sizeof(fanout_filter[0]);
+	prog.filter = fanout_filter;
+	if (setsockopt(q->sock, SOL_SOCKET, SO_ATTACH_FILTER, &prog,
+		       sizeof(prog)) < 0) {
+		perror("netfanout:SO_ATTACH_FILTER failed");
+		return -1;
+	}
+	rcvbuf = FANOUT_WINDOW * fi->s.burst * (t->iff->mtu + FANOUT_SKB);
+	if (setsockopt(q->sock, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf,
+		       sizeof(rcvbuf)) < 0)
+		setsockopt(q->sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf,
+			   sizeof(rcvbuf));
+	if (q->queue == 0) {
+		memset(&mr, 0, sizeof(mr));
+		mr.mr_ifindex = t->iff->ifindex;
+		mr.mr_type = PACKET_MR_PROMISC;
+		if (setsockopt(q->sock, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mr,
+			       sizeof(mr)) < 0) {
+			perror("netfanout:PACKET_MR_PROMISC failed");
+			return -1;
+		}
+	}
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_ifindex = t->iff->ifindex;
+	sll.sll_protocol = htons(ETH_P_ALL);
+	if (bind(q->sock, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+		perror("netfanout:bind failed");
+		return -1;
+	}
+
+	val = *id | PACKET_FANOUT_CBPF << 16;
+	if (q->queue == 0)
+		val |= PACKET_FANOUT_FLAG_UNIQUEID << 16;
+	if (setsockopt(q->sock, SOL_PACKET, PACKET_FANOUT, &val,
+		       sizeof(val)) < 0) {
+		perror("netfanout:PACKET_FANOUT failed");
+		return -1;
+	}
+	if (q->queue != 0)
+		return 0;
+	len = sizeof(val);
+	if (getsockopt(q->sock, SOL_PACKET, PACKET_FANOUT, &val, &len) < 0) {
+		perror("netfanout:could not read the fanout group id");
+		return -1;
+	}
+	*id = val & 0xffff;
+	prog.len = sizeof(steer) / sizeof(steer[0]);
+	prog.filter = steer;
+	if (setsockopt(q->sock, SOL_PACKET, PACKET_FANOUT_DATA, &prog,
+		       sizeof(prog)) < 0) {
+		perror("netfanout:PACKET_FANOUT_DATA failed");
+		return -1;
+	}
+	return 0;
+}
+
+/* 1 if the driver of iff is veth, asked through socket sock */
+static int fanout_is_veth(struct interface_info *iff, int sock)
+{
+	struct ethtool_drvinfo drv;
+	struct ifreq ifr;
+
+	memset(&drv, 0, sizeof(drv));
+	drv.cmd = ETHTOOL_GDRVINFO;
+	memset(&ifr, 0, sizeof(ifr));
+	memcpy(ifr.ifr_name, iff->ifname, sizeof(ifr.ifr_name));
+	ifr.ifr_data = (void *)&drv;
+	return ioctl(sock, SIOCETHTOOL, &ifr) == 0 &&
+		strcmp(drv.driver, "veth") == 0;
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: fanout_open					*/
+/*								*/
+/* PURPOSE: Size the datagrams of one interface, open its send	*/
+/*	    socket and set up the messages of a batch, and open	*/
+/*	    a socket per RX queue, plus one for frames of no	*/
+/*	    recorded queue.  The workers are pinned to the CPUs	*/
+/*	    we may run on in turn, ncpus of them in cpus.	*/
+/*								*/
+/****************************************************************/
+static int fanout_open(struct if_test *t, struct fanout_if *fi,
+		       const int *cpus, int ncpus)
+{
+	struct fanout_queue *q;
+	unsigned int k;
+	int i, id = 0;
+
+	fi->s.maxlen = t->iff->mtu - FANOUT_HDRLEN;
+	if (!net_sweep && fi->s.maxlen > NET_FRAMELEN)
+		fi->s.maxlen = NET_FRAMELEN;
+	if (t->iff->mtu < FANOUT_HDRLEN + NET_MINFRAME) {
+		fprintf(stderr, "netfanout: MTU of %s too small\n",
+			t->iff->ifname);
+		return -1;
+	}
+	fi->s.seen = calloc(fi->s.count, 1);
+	fi->flowq = calloc(fanout_flows, sizeof(*fi->flowq));
+	fi->txbuf = malloc((size_t)fi->s.burst * t->iff->mtu);
+	fi->txmsg = calloc(fi->s.burst, sizeof(*fi->txmsg));
+	fi->iov = calloc(fi->s.burst, sizeof(*fi->iov));
+	if (fi->s.seen == NULL || fi->flowq == NULL || fi->txbuf == NULL ||
+	    fi->txmsg == NULL || fi->iov == NULL) {
+		fprintf(stderr, "netfanout: malloc failed\n");
+		return -1;
+	}
+	net_dest(t->iff, &fi->dest);
+	fi->dest.sll_protocol = htons(ETH_P_IP);
+	for (i = 0; i < fi->s.burst; i++) {
+		fi->iov[i].iov_base = fi->txbuf + (size_t)i * t->iff->mtu;
+		fi->txmsg[i].msg_hdr.msg_name = &fi->dest;
+		fi->txmsg[i].msg_hdr.msg_namelen = sizeof(fi->dest);
+		fi->txmsg[i].msg_hdr.msg_iov = &fi->iov[i];
+		fi->txmsg[i].msg_hdr.msg_iovlen = 1;
+	}
+	fi->tx = open_sender(t->iff);
+	if (fi->tx < 0)
+		return -1;
+	fi->txqueue = fanout_is_veth(t->iff, fi->tx);
+
+	for (k = 0; k <= fi->nqueues; k++) {
+		q = &fi->queues[k];
+		q->t.iff = t->iff;
+		q->queue = k;
+		q->cpu = ncpus ? cpus[k % ncpus] : -1;
+		q->high = calloc(fanout_count, sizeof(*q->high));
+		if (q->high == NULL) {
+			fprintf(stderr, "netfanout: malloc failed\n");
+			return -1;
+		}
+		if (fanout_join(t, fi, q, &id) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/* Frames one interface may still send before the workers catch up */
+static int fanout_room(struct fanout_if *fi)
+{
+	int room = FANOUT_WINDOW * fi->s.burst - (int)(fi->s.next -
+		__sync_fetch_and_add(&fi->arrived, 0));
+
+	if (fi->unpaced)
+		return fi->s.burst;
+	return room > 0 ? room : 0;
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: fanout_send					*/
+/*								*/
+/* PURPOSE: Send up to net_burst datagrams on one interface	*/
+/*	    with one sendmmsg(), as far as its window allows,	*/
+/*	    so that the sockets of the queues do not overflow	*/
+/*	    while the workers wait for a CPU.  Returns the	*/
+/*	    number sent, or -1 on error.			*/
+/*								*/
+/****************************************************************/
+static int fanout_send(struct if_test *t, struct fanout_if *fi)
+{
+	unsigned char *p;
+	int n, len, sent, room = fanout_room(fi);
+
+	for (n = 0; n < fi->s.burst && n < room &&
+	     fi->s.next + n < fi->s.count; n++) {
+		p = fi->iov[n].iov_base;
+		len = net_stream_len(&fi->s, fi->s.next + n);
+		fanout_header(p, fi->s.next + n, len);
+		net_frame(p + FANOUT_HDRLEN, fi->s.next + n, len);
+		fi->iov[n].iov_len = FANOUT_HDRLEN + len;
+	}
+	if (n == 0)
+		return 0;
+	if (fi->s.next == 0)
+		t->sent = amtu_now();
+	sent = sendmmsg(fi->tx, fi->txmsg, n, MSG_DONTWAIT);
+	if (sent < 0) {
+		if (errno == EAGAIN || errno == ENOBUFS)
+			return 0;
+		perror("netfanout:sendmmsg() failed");
+		return -1;
+	}
+	fi->s.next += sent;
+	return sent;
+}
+
+/* Close the sockets of one interface and free what it holds */
+static void fanout_close(struct fanout_if *fi)
+{
+	unsigned int k;
+
+	for (k = 0; fi->queues != NULL && k <= fi->nqueues; k++) {
+		if (fi->queues[k].sock >= 0)
+			close(fi->queues[k].sock);
+		free(fi->queues[k].high);
+	}
+	if (fi->tx >= 0)
+		close(fi->tx);
+	free(fi->queues);
+	free(fi->flowq);
+	free(fi->s.seen);
+	free(fi->txbuf);
+	free(fi->txmsg);
+	free(fi->iov);
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: fanout_report					*/
+/*								*/
+/* PURPOSE: Report each queue of one interface that is one of	*/
+/*	    its RX queues or received something.  An RX queue	*/
+/*	    that received nothing fails, since the flows should	*/
+/*	    reach every queue in use.  Returns the number of	*/
+/*	    queues that failed.					*/
+/*								*/
+/****************************************************************/
+static int fanout_report(struct fanout_if *fi)
+{
+	struct fanout_queue *q;
+	unsigned int k;
+	int failed = 0, bad;
+	double elapsed;
+	char name[16];
+
+	for (k = 0; k <= fi->nqueues; k++) {
+		q = &fi->queues[k];
+		if (k == fi->nqueues && !q->t.frames && !q->t.bad &&
+		    !q->lost && !q->t.dups)
+			continue;
+		if (k == fi->nqueues)
+			snprintf(name, sizeof(name), "no queue");
+		else
+			snprintf(name, sizeof(name), "RX queue %u", k);
+		if (q->t.failed) {
+			printf("  %-16s %-12s failed\n", "", name);
+			failed++;
+			continue;
+		}
+		if (!q->t.frames && !q->t.bad && !q->lost) {
+			printf("  %-16s %-12s no frames: FAILED\n", "", name);
+			failed++;
+			continue;
+		}
+		bad = q->t.bad || (double)q->lost * 1e6 >
+			(double)net_loss_ppm * (q->t.frames + q->lost);
+		elapsed = q->t.last - q->t.sent;
+		printf("  %-16s %-12s cpu %d, %lu frames, %.0f frames/s, "
+			"%.1f Mbit/s, %lu lost, %lu reordered, %lu duplicated, "
+			"%lu corrupted: %s\n", "", name, q->cpu, q->t.frames,
+			elapsed > 0 ? q->t.frames / elapsed : 0,
+			elapsed > 0 ? q->t.bytes * 8 / elapsed / 1e6 : 0,
+			q->lost, q->t.reordered, q->t.dups, q->t.bad,
+			bad ? "FAILED" : "ok");
+		if (q->t.syndrome)
+			printf("  %-16s %-12s bits 0x%02x differed in the "
+				"corrupted frames\n", "", "", q->t.syndrome);
+		failed += bad;
+	}
+	return failed;
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: fanout_test					*/
+/*								*/
+/* PURPOSE: Start a worker per RX queue of every interface,	*/
+/*	    send net_frames datagrams on every interface,	*/
+/*	    spread over the flows, wait until all arrived or	*/
+/*	    net_timeout_ms passed after the last was sent, and	*/
+/*	    report each interface and its queues.  An interface	*/
+/*	    fails if one of its queues failed or it lost more	*/
+/*	    than net_loss_ppm of the frames it sent per		*/
+/*	    million.  Returns the number of interfaces that	*/
+/*	    failed.						*/
+/*								*/
+/****************************************************************/
+int fanout_test(struct if_test *tests, int count)
+{
+	struct fanout_if *ifs, *fi;
+	struct fanout_queue *q;
+	struct if_test *t;
+	struct pollfd *pfd;
+	cpu_set_t set;
+	int *cpus = NULL;
+	int i, n, busy, full, burst, ncpus = 0, failures = 0;
+	unsigned int k, seq, frames, maxq = 1;
+	unsigned long lost, pending, arrived, total = 0;
+	double deadline, progress;
+
+	net_limits(FANOUT_MAXBURST, &frames, &burst);
+	ifs = calloc(count, sizeof(*ifs));
+	pfd = calloc(count, sizeof(*pfd));
+	cpus = calloc(CPU_SETSIZE, sizeof(*cpus));
+	if (ifs == NULL || pfd == NULL || cpus == NULL) {
+		fprintf(stderr, "netfanout: malloc failed\n");
+		free(ifs);
+		free(pfd);
+		free(cpus);
+		return count;
+	}
+	if (sched_getaffinity(0, sizeof(set), &set) == 0)
+		for (i = 0; i < CPU_SETSIZE; i++)
+			if (CPU_ISSET(i, &set))
+				cpus[ncpus++] = i;
+	for (i = 0; i < count; i++) {
+		fi = &ifs[i];
+		fi->tx = -1;
+		fi->s.count = frames;
+		fi->s.burst = burst;
+		fi->nqueues = net_rxqueues(tests[i].iff->ifname);
+		if (fi->nqueues == 0)
+			fi->nqueues = 1;
+		if (fi->nqueues > MAXTHREADS - 1)
+			fi->nqueues = MAXTHREADS - 1;
+		if (fi->nqueues > maxq)
+			maxq = fi->nqueues;
+		fi->queues = calloc(fi->nqueues + 1, sizeof(*fi->queues));
+		for (k = 0; fi->queues != NULL && k <= fi->nqueues; k++)
+			fi->queues[k].sock = -1;
+	}
+	fanout_tests = tests;
+	fanout_ifs = ifs;
+	fanout_count = count;
+	fanout_flows = FANOUT_FLOWS * maxq;
+	fanout_stop = 0;
+
+	printf("PACKET_FANOUT, %d frames per interface in %u flows:\n",
+		frames, fanout_flows);
+	for (i = 0; i < count; i++) {
+		t = &tests[i];
+		fi = &ifs[i];
+		if (fi->queues == NULL ||
+		    fanout_open(t, fi, cpus, ncpus) < 0) {
+			t->failed = 1;
+			continue;
+		}
+		for (k = 0; k <= fi->nqueues; k++) {
+			q = &fi->queues[k];
+			if (pthread_create(&q->tid, NULL, fanout_worker, q)) {
+				fprintf(stderr, "netfanout: could not start "
+					"a worker\n");
+				q->t.failed = 1;
+				continue;
+			}
+			q->running = 1;
+		}
+	}
+
+	/*
+	 * Send a batch on every interface in turn.  When the windows are
+	 * full, give the workers time; a window that nothing arrived for
+	 * in net_timeout_ms holds lost frames, and is switched off.  When
+	 * no send socket takes more, wait until one does; a socket that
+	 * stays full for net_timeout_ms has stalled.
+	 */
+	progress = amtu_now();
+	do {
+		busy = 0;
+		for (i = 0; i < count; i++) {
+			if (tests[i].failed)
+				continue;
+			n = fanout_send(&tests[i], &ifs[i]);
+			if (n < 0)
+				tests[i].failed = 1;
+			else if (n > 0)
+				busy = 1;
+		}
+		if (busy)
+			continue;
+		for (i = n = full = 0; i < count; i++) {
+			if (tests[i].failed ||
+			    ifs[i].s.next == ifs[i].s.count)
+				continue;
+			if (fanout_room(&ifs[i]) == 0) {
+				full = 1;
+				continue;
+			}
+			pfd[n].fd = ifs[i].tx;
+			pfd[n].events = POLLOUT;
+			pfd[n].revents = 0;
+			n++;
+		}
+		if (full) {
+			for (i = 0, arrived = 0; i < count; i++)
+				arrived += __sync_fetch_and_add(&ifs[i].arrived,
+								0);
+			if (arrived != total) {
+				total = arrived;
+				progress = amtu_now();
+			} else if (amtu_now() - progress >
+				   net_timeout_ms / 1e3) {
+				for (i = 0; i < count; i++)
+					if (fanout_room(&ifs[i]) == 0)
+						ifs[i].unpaced = 1;
+				progress = amtu_now();
+			}
+			poll(pfd, n, 1);
+			continue;
+		}
+		if (n == 0)
+			break;
+		if (poll(pfd, n, net_timeout_ms) <= 0) {
+			for (i = 0; i < count; i++)
+				if (!tests[i].failed &&
+				    ifs[i].s.next < ifs[i].s.count) {
+					fprintf(stderr, "netfanout: sending on "
+						"%s stalled\n",
+						tests[i].iff->ifname);
+					tests[i].failed = 1;
+				}
+		}
+	} while (1);
+
+	/* Let the workers collect the rest, or until the time is up */
+	deadline = amtu_now() + net_timeout_ms / 1e3;
+	do {
+		for (i = 0, pending = 0; i < count; i++)
+			if (!tests[i].failed)
+				pending += ifs[i].s.next - __sync_fetch_and_add(
+					&ifs[i].arrived, 0);
+		if (pending)
+			poll(NULL, 0, 1);
+	} while (pending && amtu_now() < deadline);
+	fanout_stop = 1;
+	for (i = 0; i < count; i++)
+		for (k = 0; ifs[i].queues != NULL && k <= ifs[i].nqueues; k++)
+			if (ifs[i].queues[k].running)
+				pthread_join(ifs[i].queues[k].tid, NULL);
+
+	/* Charge each lost frame to the queue its flow arrived on */
+	for (i = 0; i < count; i++) {
+		fi = &ifs[i];
+		for (seq = 0; fi->s.seen != NULL && seq < fi->s.next; seq++) {
+			if (fi->s.seen[seq])
+				continue;
+			q = fi->flowq[seq % fanout_flows];
+			if (q)
+				q->lost++;
+			else
+				fi->unseen++;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		t = &tests[i];
+		fi = &ifs[i];
+		lost = fi->s.next - fi->arrived;
+		if (t->failed) {
+			printf("  %-16s failed\n", t->iff->ifname);
+		} else {
+			printf("  %-16s %lu/%u frames of %d-%u bytes arrived, "
+				"%lu lost (%.4f%%), %lu of them in flows that "
+				"never arrived\n", t->iff->ifname, fi->arrived,
+				fi->s.next, net_stream_len(&fi->s, 0),
+				fi->s.maxlen, lost,
+				fi->s.next ? 100.0 * lost / fi->s.next : 0,
+				fi->unseen);
+			if (fanout_report(fi))
+				t->failed = 1;
+		}
+		if (!t->failed &&
+		    (double)lost * 1e6 <= (double)net_loss_ppm * fi->s.next)
+			continue;
+		fprintf(stderr, "RX queue test of %s FAILED!\n",
+			t->iff->ifname);
+#ifdef HAVE_LIBLAUS
+		LAUS_LOG(("amtu failed network I/O test on the RX queues"));
+#else
+		AUDIT_LOG("amtu failed network I/O test on the RX queues", 0);
+#endif
+		failures++;
+	}
+
+	for (i = 0; i < count; i++)
+		fanout_close(&ifs[i]);
+	fanout_tests = NULL;
+	fanout_ifs = NULL;
+	fanout_count = 0;
+	free(cpus);
+	free(pfd);
+	free(ifs);
+	return failures;
+}
@@ -0,0 +1,515 @@
+//----------------------------------------------------------------------
+//
+// Module Name:  netlat.c
+//
+// Include File:  amtu.h
+//
+// Description:   Code for Abstract Machine Test Utility - latency
+//                engine of the I/O Controller-Network test.
+//
+// Notes:  This module sends net_frames frames on every interface, one
+//         per interface at a time, and takes the transmit and receive
+//         timestamps of each with SO_TIMESTAMPING.  The transmit
+//         timestamp comes from the error queue of the sending socket:
+//         the hardware one where the NIC of the sender can stamp
+//         what it sends, and otherwise the software one taken when
+//         the frame enters the device queue.  The receive timestamp
+//         of the same clock is taken by the interface the frame
+//         arrives on, as it arrives: the receive sockets drop the
+//         copies of what their own interface sends, and a frame is
+//         credited to the interface whose address it was sent from,
+//         so the frames of one interface must reach another
+//         interface under test, as on veth pairs or on ports cabled
+//         to each other.  Hardware timestamping is only widened
+//         where it was off, transmit stamps on a NIC that can stamp
+//         what it sends and the filter of all frames on one that can
+//         stamp what it receives, leaving a stamping PTP setup as it
+//         is, and is restored afterwards.  A frame only counts in
+//         the hardware statistics when both of its hardware
+//         timestamps are present.  The minimum, median, 99th
+//         percentile and maximum of the deltas are reported.
+//         The return code is the number of interfaces that failed.
+// -----------------------------------------------------------------
+// LANGUAGE:     C
+//
+// Licensed under the Common Public License v. 1.0
+// -----------------------------------------------------------------
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <syslog.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <net/if.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+#include <linux/ethtool.h>
+#include "amtu.h"
+
+/* Timestamps of one frame, 0 if not taken */
+struct lat_frame {
+	double tx_sw, tx_hw;
+	double rx_sw, rx_hw;
+	int received;
+	int sched;		/* the software transmit timestamp came */
+};
+
+/* Latency state of one interface */
+struct lat {
+	int tx;			/* sending socket */
+	int hwtx, hwrx;		/* hardware stamps of frames sent, received */
+	int changed;		/* hardware timestamping was changed */
+	struct hwtstamp_config saved;	/* to restore afterwards */
+	struct lat_frame cur;	/* frame of this round */
+	double *hw_ns, *sw_ns;	/* deltas of each clock */
+	int nhw, nsw;
+};
+
+static double ts_sec(const struct timespec *ts)
+{
+	return ts->tv_sec + ts->tv_nsec / 1e9;
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: lat_hw_enable					*/
+/*								*/
+/* PURPOSE: Switch on hardware timestamping of the frames an	*/
+/*	    interface sends, if its NIC can stamp them and it	*/
+/*	    is off, and of all the frames it receives, if its	*/
+/*	    NIC can stamp them.  The old setting is saved when	*/
+/*	    it is changed.					*/
+/*								*/
+/****************************************************************/
+static void lat_hw_enable(struct interface_info *iff, struct lat *l)
+{
+	struct ethtool_ts_info info;
+	struct hwtstamp_config cfg;
+	struct ifreq ifr;
+	unsigned int tx = SOF_TIMESTAMPING_TX_HARDWARE |
+		SOF_TIMESTAMPING_RAW_HARDWARE;
+	unsigned int rx = SOF_TIMESTAMPING_RX_HARDWARE |
+		SOF_TIMESTAMPING_RAW_HARDWARE;
+
+	memset(&ifr, 0, sizeof(ifr));
+	memcpy(ifr.ifr_name, iff->ifname, sizeof(ifr.ifr_name));
+	memset(&info, 0, sizeof(info));
+	info.cmd = ETHTOOL_GET_TS_INFO;
+	ifr.ifr_data = (void *)&info;
+	if (ioctl(l->tx, SIOCETHTOOL, &ifr) < 0)
+		return;
+	ifr.ifr_data = (void *)&l->saved;
+	if (ioctl(l->tx, SIOCGHWTSTAMP, &ifr) < 0)
+		return;
+
+	/* the one-step modes stamp every frame sent, as TX_ON does */
+	cfg = l->saved;
+	if ((info.so_timestamping & tx) == tx &&
+	    (info.tx_types & (1 << HWTSTAMP_TX_ON)) &&
+	    cfg.tx_type == HWTSTAMP_TX_OFF)
+		cfg.tx_type = HWTSTAMP_TX_ON;
+	if ((info.so_timestamping & rx) == rx &&
+	    (info.rx_filters & (1 << HWTSTAMP_FILTER_ALL)))
+		cfg.rx_filter = HWTSTAMP_FILTER_ALL;
+	if (cfg.tx_type != l->saved.tx_type ||
+	    cfg.rx_filter != l->saved.rx_filter) {
+		ifr.ifr_data = (void *)&cfg;
+		if (ioctl(l->tx, SIOCSHWTSTAMP, &ifr) < 0)
+			return;
+		l->changed = 1;
+	}
+	l->hwtx = cfg.tx_type != HWTSTAMP_TX_OFF;
+	l->hwrx = cfg.rx_filter == HWTSTAMP_FILTER_ALL;
+}
+
+static void lat_hw_restore(struct interface_info *iff, struct lat *l)
+{
+	struct ifreq ifr;
+
+	memset(&ifr, 0, sizeof(ifr));
+	memcpy(ifr.ifr_name, iff->ifname, sizeof(ifr.ifr_name));
+	ifr.ifr_data = (void *)&l->saved;
+	if (ioctl(l->tx, SIOCSHWTSTAMP, &ifr) < 0)
+		perror("netlat:could not restore hardware timestamping");
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: lat_setup						*/
+/*								*/
+/* PURPOSE: Open the sending and receiving sockets of one	*/
+/*	    interface and enable the timestamps on both.  The	*/
+/*	    transmit timestamps carry the number of the frame	*/
+/*	    and no data.					*/
+/*								*/
+/****************************************************************/
+static int lat_setup(struct if_test *t, struct lat *l, unsigned int frames)
+{
+	int flags;
+
+	l->sw_ns = calloc(frames, sizeof(double));
+	l->hw_ns = calloc(frames, sizeof(double));
+	if (l->sw_ns == NULL || l->hw_ns == NULL) {
+		fprintf(stderr, "netlat: malloc failed\n");
+		return -1;
+	}
+	l->tx = socket(PF_PACKET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (l->tx < 0) {
+		perror("netlat:socket() failed");
+		return -1;
+	}
+	lat_hw_enable(t->iff, l);
+	flags = SOF_TIMESTAMPING_TX_SCHED | SOF_TIMESTAMPING_SOFTWARE |
+		SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+	if (l->hwtx)
+		flags |= SOF_TIMESTAMPING_TX_HARDWARE |
+			 SOF_TIMESTAMPING_RAW_HARDWARE;
+	if (setsockopt(l->tx, SOL_SOCKET, SO_TIMESTAMPING, &flags,
+		       sizeof(flags)) < 0) {
+		perror("netlat:SO_TIMESTAMPING on the sending socket failed");
+		return -1;
+	}
+
+	t->rsock = open_receiver(t->iff, 1);
+	if (t->rsock < 0)
+		return -1;
+	flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+	if (l->hwrx)
+		flags |= SOF_TIMESTAMPING_RX_HARDWARE |
+			 SOF_TIMESTAMPING_RAW_HARDWARE;
+	if (setsockopt(t->rsock, SOL_SOCKET, SO_TIMESTAMPING, &flags,
+		       sizeof(flags)) < 0) {
+		perror("netlat:SO_TIMESTAMPING on the receiving socket failed");
+		return -1;
+	}
+	return 0;
+}
+
+/* The SCM_TIMESTAMPING timestamps of a message, NULL if none */
+static struct scm_timestamping *lat_stamps(struct msghdr *msg)
+{
+	struct cmsghdr *cm;
+
+	for (cm = CMSG_FIRSTHDR(msg); cm != NULL; cm = CMSG_NXTHDR(msg, cm))
+		if (cm->cmsg_level == SOL_SOCKET &&
+		    cm->cmsg_type == SCM_TIMESTAMPING)
+			return (struct scm_timestamping *)CMSG_DATA(cm);
+	return NULL;
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: lat_tx_stamps					*/
+/*								*/
+/* PURPOSE: Read the transmit timestamps of frame seq from the	*/
+/*	    error queue of the sending socket.			*/
+/*								*/
+/****************************************************************/
+static void lat_tx_stamps(struct lat *l, unsigned int seq)
+{
+	char control[256];
+	struct msghdr msg;
+	struct cmsghdr *cm;
+	struct scm_timestamping *ts;
+	struct sock_extended_err *ee;
+
+	for (;;) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(l->tx, &msg, MSG_ERRQUEUE) < 0)
+			return;
+		ts = lat_stamps(&msg);
+		ee = NULL;
+		for (cm = CMSG_FIRSTHDR(&msg); cm != NULL;
+		     cm = CMSG_NXTHDR(&msg, cm))
+			if (cm->cmsg_level == SOL_PACKET &&
+			    cm->cmsg_type == PACKET_TX_TIMESTAMP)
+				ee = (struct sock_extended_err *)CMSG_DATA(cm);
+		if (ts == NULL || ee == NULL ||
+		    ee->ee_origin != SO_EE_ORIGIN_TIMESTAMPING ||
+		    ee->ee_data != seq)
+			continue;
+		if (ee->ee_info == SCM_TSTAMP_SCHED) {
+			l->cur.tx_sw = ts_sec(&ts->ts[0]);
+			l->cur.sched = 1;
+		}
+		else if (ee->ee_info == SCM_TSTAMP_SND &&
+			 (ts->ts[2].tv_sec || ts->ts[2].tv_nsec))
+			l->cur.tx_hw = ts_sec(&ts->ts[2]);
+	}
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: lat_receive					*/
+/*								*/
+/* PURPOSE: Read the receive socket of interface j, taking	*/
+/*	    the timestamps of frame seq of each interface it	*/
+/*	    arrives from.					*/
+/*								*/
+/****************************************************************/
+static void lat_receive(struct if_test *tests, struct lat *lats, int count,
+			int j, unsigned int seq)
+{
+	unsigned char buf[NET_FRAMELEN];
+	char control[256];
+	struct sockaddr_ll from;
+	struct iovec iov;
+	struct msghdr msg;
+	struct scm_timestamping *ts;
+	struct lat *l;
+	unsigned int got;
+	int cc, k;
+
+	for (;;) {
+		iov.iov_base = buf;
+		iov.iov_len = sizeof(buf);
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_name = &from;
+		msg.msg_namelen = sizeof(from);
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		cc = recvmsg(tests[j].rsock, &msg, MSG_TRUNC);
+		if (cc < 0)
+			return;
+		k = net_sender(tests, count, &from);
+		if (k < 0) {
+			tests[j].bad++;
+			continue;
+		}
+		if (cc != NET_FRAMELEN ||
+		    net_check_frame(&tests[k], buf, cc, &got) < 0) {
+			tests[k].bad++;
+			continue;
+		}
+		l = &lats[k];
+		if (got != seq || l->cur.received)
+			continue;
+		l->cur.received = 1;
+		ts = lat_stamps(&msg);
+		if (ts == NULL)
+			continue;
+		l->cur.rx_sw = ts_sec(&ts->ts[0]);
+		if (ts->ts[2].tv_sec || ts->ts[2].tv_nsec)
+			l->cur.rx_hw = ts_sec(&ts->ts[2]);
+	}
+}
+
+static int lat_cmp(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Print min, median, p99 and max of n deltas in ns, sorting them */
+static void lat_report(const char *clock, double *ns, int n)
+{
+	if (n == 0)
+		return;
+	qsort(ns, n, sizeof(*ns), lat_cmp);
+	printf("  %-16s %s: min %.1f us, median %.1f us, p99 %.1f us, "
+		"max %.1f us\n", "", clock, ns[0] / 1e3, ns[n / 2] / 1e3,
+		ns[(n * 99 + 99) / 100 - 1] / 1e3, ns[n - 1] / 1e3);
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: latency_test					*/
+/*								*/
+/* PURPOSE: Send net_frames frames on every interface, one per	*/
+/*	    interface and round, wait up to net_timeout_ms for	*/
+/*	    each round to come back with its timestamps, and	*/
+/*	    report the latency of each interface.  Returns the	*/
+/*	    number of interfaces that failed.			*/
+/*								*/
+/****************************************************************/
+int latency_test(struct if_test *tests, int count)
+{
+	struct epoll_event ev, *events;
+	struct itimerspec its;
+	struct sockaddr_ll sll;
+	unsigned char frame[NET_FRAMELEN];
+	struct lat *lats, *l;
+	struct if_test *t;
+	unsigned int seq, frames = net_frames > 0 ? net_frames : 1;
+	int i, n, epfd, tfd, pending, expired;
+	int failures = 0;
+
+	lats = calloc(count, sizeof(*lats));
+	events = calloc(2 * count + 1, sizeof(*events));
+	for (i = 0; lats != NULL && i < count; i++)
+		lats[i].tx = -1;
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u32 = 2 * count;
+	if (lats == NULL || events == NULL || epfd < 0 || tfd < 0 ||
+	    epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev) < 0) {
+		perror("netlat:setup failed");
+		failures = count;
+		goto out;
+	}
+
+	printf("Latency, %u frames per interface:\n", frames);
+	for (i = 0; i < count; i++) {
+		t = &tests[i];
+		l = &lats[i];
+		if (lat_setup(t, l, frames) < 0) {
+			t->failed = 1;
+			continue;
+		}
+		/* transmit timestamps raise EPOLLERR, which is always on */
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.u32 = 2 * i;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, t->rsock, &ev) < 0) {
+			perror("netlat:epoll_ctl failed");
+			t->failed = 1;
+			continue;
+		}
+		ev.events = 0;
+		ev.data.u32 = 2 * i + 1;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, l->tx, &ev) < 0) {
+			perror("netlat:epoll_ctl failed");
+			t->failed = 1;
+		}
+	}
+
+	/*
+	 * The kernel switches receive timestamps on from a work queue,
+	 * so give it a moment before the first frame is sent.
+	 */
+	usleep(10000);
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = net_timeout_ms / 1000;
+	its.it_value.tv_nsec = (net_timeout_ms % 1000) * 1000000L + 1;
+	for (seq = 0; seq < frames; seq++) {
+		net_frame(frame, seq, NET_FRAMELEN);
+		for (i = 0; i < count; i++) {
+			t = &tests[i];
+			l = &lats[i];
+			if (t->failed)
+				continue;
+			memset(&l->cur, 0, sizeof(l->cur));
+			memset(&sll, 0, sizeof(sll));
+			sll.sll_family = AF_PACKET;
+			sll.sll_ifindex = t->iff->ifindex;
+			sll.sll_protocol = htons(ETH_P_LOOP);
+			sll.sll_halen = t->iff->halen;
+			memcpy(sll.sll_addr, t->iff->lladdr, t->iff->halen);
+			if (seq == 0)
+				t->sent = amtu_now();
+			if (sendto(l->tx, frame, sizeof(frame), 0,
+				   (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+				perror("netlat:sendto() failed");
+				t->failed = 1;
+			}
+		}
+
+		expired = timerfd_settime(tfd, 0, &its, NULL) < 0;
+		while (!expired) {
+			for (i = pending = 0; i < count; i++)
+				if (!tests[i].failed &&
+				    (!lats[i].cur.received ||
+				     !lats[i].cur.sched))
+					pending++;
+			if (!pending)
+				break;
+			n = epoll_wait(epfd, events, 2 * count + 1, -1);
+			if (n < 0) {
+				perror("netlat:epoll_wait failed");
+				break;
+			}
+			for (i = 0; i < n; i++) {
+				if (events[i].data.u32 == 2 * (unsigned)count)
+					expired = 1;
+				else if (events[i].data.u32 & 1)
+					lat_tx_stamps(
+						&lats[events[i].data.u32 / 2],
+						seq);
+				else
+					lat_receive(tests, lats, count,
+						events[i].data.u32 / 2, seq);
+			}
+		}
+
+		for (i = 0; i < count; i++) {
+			t = &tests[i];
+			l = &lats[i];
+			if (t->failed)
+				continue;
+			lat_tx_stamps(l, seq);
+			if (!l->cur.received)
+				continue;
+			if (t->frames++ == 0)
+				t->rtt = amtu_now() - t->sent;
+			if (l->cur.tx_hw > 0 && l->cur.rx_hw > 0)
+				l->hw_ns[l->nhw++] =
+					(l->cur.rx_hw - l->cur.tx_hw) * 1e9;
+			else if (l->cur.tx_sw > 0 && l->cur.rx_sw > 0)
+				l->sw_ns[l->nsw++] =
+					(l->cur.rx_sw - l->cur.tx_sw) * 1e9;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		t = &tests[i];
+		l = &lats[i];
+		if (t->failed) {
+			printf("  %-16s failed\n", t->iff->ifname);
+		} else {
+			printf("  %-16s %lu/%u frames, %d hardware and %d "
+				"software timestamped\n", t->iff->ifname,
+				t->frames, frames, l->nhw, l->nsw);
+			lat_report("hardware", l->hw_ns, l->nhw);
+			lat_report("software", l->sw_ns, l->nsw);
+		}
+		if (!t->failed && !t->bad &&
+		    t->frames == frames)
+			continue;
+		fprintf(stderr, "Latency test of %s FAILED!\n",
+			t->iff->ifname);
+#ifdef HAVE_LIBLAUS
+		LAUS_LOG(("amtu failed network I/O test on latency"));
+#else
+		AUDIT_LOG("amtu failed network I/O test on latency", 0);
+#endif
+		failures++;
+	}
+
+out:
+	for (i = 0; lats != NULL && i < count; i++) {
+		l = &lats[i];
+		if (l->changed)
+			lat_hw_restore(tests[i].iff, l);
+		if (l->tx >= 0)
+			close(l->tx);
+		if (tests[i].rsock >= 0)
+			close(tests[i].rsock);
+		free(l->hw_ns);
+		free(l->sw_ns);
+	}
+	if (tfd >= 0)
+		close(tfd);
+	if (epfd >= 0)
+		close(epfd);
+	free(events);
+	free(lats);
+	return failures;
+}
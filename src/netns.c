@@ -0,0 +1,395 @@
+//----------------------------------------------------------------------
+//
+// Module Name:  netns.c
+//
+// Include File:  amtu.h
+//
+// Description:   Code for Abstract Machine Test Utility - private
+//                network namespace of the I/O Controller-Network test.
+//
+// Notes:  The network test needs Ethernet devices that are up and have
+//         a carrier, which build machines and containers often lack.
+//         With net_veth set, networkio() runs in a child process in a
+//         network namespace of its own instead, holding
+//         net_veth veth pairs named amtu<n>a and amtu<n>b, each up
+//         with NETNS_QUEUES TX and RX queues, so that the RX queue
+//         engine has several queues to spread its flows over, an
+//         IPv4 address and, with net_netem_delay_us or
+//         net_netem_loss_ppm, a netem qdisc delaying or dropping what
+//         the a side sends.  Everything is configured through
+//         rtnetlink and goes away with the child.
+//         The return codes are as follows:
+//         -1 = failure occurred
+//          0 = success
+// -----------------------------------------------------------------
+// LANGUAGE:     C
+//
+// Licensed under the Common Public License v. 1.0
+// -----------------------------------------------------------------
+
+#define _GNU_SOURCE
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <syslog.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+#include <linux/veth.h>
+#include <linux/pkt_sched.h>
+#include "amtu.h"
+
+#define NL_BUFSIZE	1024
+#define NETNS_LINKWAIT	200	/* 10 ms waits for a veth carrier */
+#define NETNS_SETTLE	20	/* ms until its queue is running */
+#define NETNS_QUEUES	4	/* TX and RX queues of each veth end */
+
+/* Start a netlink request of type with the family header hdr */
+static struct nlmsghdr *nl_msg(void *buf, int type, int flags,
+			       const void *hdr, int hdrlen)
+{
+	struct nlmsghdr *n = buf;
+
+	memset(buf, 0, NL_BUFSIZE);
+	n->nlmsg_len = NLMSG_LENGTH(hdrlen);
+	n->nlmsg_type = type;
+	n->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+	memcpy(NLMSG_DATA(n), hdr, hdrlen);
+	return n;
+}
+
+/* Append len raw bytes to a request */
+static void nl_raw(struct nlmsghdr *n, const void *data, int len)
+{
+	memcpy((char *)n + NLMSG_ALIGN(n->nlmsg_len), data, len);
+	n->nlmsg_len = NLMSG_ALIGN(n->nlmsg_len) + RTA_ALIGN(len);
+}
+
+/* Append an attribute, and return it for nesting */
+static struct rtattr *nl_attr(struct nlmsghdr *n, int type, const void *data,
+			      int len)
+{
+	struct rtattr *rta;
+
+	rta = (struct rtattr *)((char *)n + NLMSG_ALIGN(n->nlmsg_len));
+	rta->rta_type = type;
+	rta->rta_len = RTA_LENGTH(len);
+	if (len)
+		memcpy(RTA_DATA(rta), data, len);
+	n->nlmsg_len = NLMSG_ALIGN(n->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+	return rta;
+}
+
+/* Close a nested attribute opened by nl_attr() */
+static void nl_end(struct nlmsghdr *n, struct rtattr *nest)
+{
+	nest->rta_len = (char *)n + n->nlmsg_len - (char *)nest;
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: nl_talk						*/
+/*								*/
+/* PURPOSE: Send a request on the rtnetlink socket and wait for	*/
+/*	    its acknowledgement.  Returns 0, or -errno.		*/
+/*								*/
+/****************************************************************/
+static int nl_talk(int sock, struct nlmsghdr *n)
+{
+	char buf[NL_BUFSIZE];
+	struct nlmsghdr *r;
+	struct nlmsgerr *err;
+	int cc;
+
+	if (send(sock, n, n->nlmsg_len, 0) < 0)
+		return -errno;
+	for (;;) {
+		cc = recv(sock, buf, sizeof(buf), 0);
+		if (cc < 0)
+			return -errno;
+		for (r = (struct nlmsghdr *)buf; NLMSG_OK(r, (unsigned int)cc);
+		     r = NLMSG_NEXT(r, cc)) {
+			if (r->nlmsg_type != NLMSG_ERROR)
+				continue;
+			err = NLMSG_DATA(r);
+			return err->error;
+		}
+	}
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: netns_veth						*/
+/*								*/
+/* PURPOSE: Create veth pair n, with NETNS_QUEUES queues each	*/
+/*	    way on both ends, bring both ends up and give them	*/
+/*	    the addresses 10.200.n.1 and 10.200.n.2.		*/
+/*								*/
+/****************************************************************/
+static int netns_veth(int sock, int n)
+{
+	char buf[NL_BUFSIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+	char name[2][IFNAMSIZ];
+	struct nlmsghdr *nh;
+	struct rtattr *info, *data, *peer;
+	struct ifinfomsg ifi;
+	struct ifaddrmsg ifa;
+	struct in_addr addr;
+	char ip[32];
+	unsigned int queues = NETNS_QUEUES;
+	int i, rc, index;
+
+	snprintf(name[0], IFNAMSIZ, "amtu%da", n);
+	snprintf(name[1], IFNAMSIZ, "amtu%db", n);
+
+	memset(&ifi, 0, sizeof(ifi));
+	ifi.ifi_family = AF_UNSPEC;
+	nh = nl_msg(buf, RTM_NEWLINK, NLM_F_CREATE | NLM_F_EXCL, &ifi,
+		    sizeof(ifi));
+	nl_attr(nh, IFLA_IFNAME, name[0], strlen(name[0]) + 1);
+	nl_attr(nh, IFLA_NUM_TX_QUEUES, &queues, sizeof(queues));
+	nl_attr(nh, IFLA_NUM_RX_QUEUES, &queues, sizeof(queues));
+	info = nl_attr(nh, IFLA_LINKINFO, NULL, 0);
+	nl_attr(nh, IFLA_INFO_KIND, "veth", 4);
+	data = nl_attr(nh, IFLA_INFO_DATA, NULL, 0);
+	peer = nl_attr(nh, VETH_INFO_PEER, NULL, 0);
+	nl_raw(nh, &ifi, sizeof(ifi));
+	nl_attr(nh, IFLA_IFNAME, name[1], strlen(name[1]) + 1);
+	nl_attr(nh, IFLA_NUM_TX_QUEUES, &queues, sizeof(queues));
+	nl_attr(nh, IFLA_NUM_RX_QUEUES, &queues, sizeof(queues));
+	nl_end(nh, peer);
+	nl_end(nh, data);
+	nl_end(nh, info);
+	rc = nl_talk(sock, nh);
+	if (rc < 0) {
+		fprintf(stderr, "Could not create veth pair %s: %s\n",
+			name[0], strerror(-rc));
+		return -1;
+	}
+
+	for (i = 0; i < 2; i++) {
+		index = if_nametoindex(name[i]);
+		memset(&ifa, 0, sizeof(ifa));
+		ifa.ifa_family = AF_INET;
+		ifa.ifa_prefixlen = 24;
+		ifa.ifa_index = index;
+		snprintf(ip, sizeof(ip), "10.200.%d.%d", n, i + 1);
+		inet_pton(AF_INET, ip, &addr);
+		nh = nl_msg(buf, RTM_NEWADDR, NLM_F_CREATE | NLM_F_EXCL, &ifa,
+			    sizeof(ifa));
+		nl_attr(nh, IFA_LOCAL, &addr, sizeof(addr));
+		nl_attr(nh, IFA_ADDRESS, &addr, sizeof(addr));
+		rc = nl_talk(sock, nh);
+		if (rc < 0) {
+			fprintf(stderr, "Could not add %s to %s: %s\n", ip,
+				name[i], strerror(-rc));
+			return -1;
+		}
+
+		memset(&ifi, 0, sizeof(ifi));
+		ifi.ifi_family = AF_UNSPEC;
+		ifi.ifi_index = index;
+		ifi.ifi_flags = IFF_UP;
+		ifi.ifi_change = IFF_UP;
+		nh = nl_msg(buf, RTM_NEWLINK, 0, &ifi, sizeof(ifi));
+		rc = nl_talk(sock, nh);
+		if (rc < 0) {
+			fprintf(stderr, "Could not bring %s up: %s\n",
+				name[i], strerror(-rc));
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: netns_netem					*/
+/*								*/
+/* PURPOSE: Install a netem root qdisc on the a side of veth	*/
+/*	    pair n, delaying each frame by net_netem_delay_us	*/
+/*	    and dropping net_netem_loss_ppm per million.	*/
+/*								*/
+/****************************************************************/
+static int netns_netem(int sock, int n)
+{
+	char buf[NL_BUFSIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+	char name[IFNAMSIZ];
+	struct nlmsghdr *nh;
+	struct rtattr *opt;
+	struct tcmsg tcm;
+	struct tc_netem_qopt qopt;
+	long long delay;
+
+	snprintf(name, IFNAMSIZ, "amtu%da", n);
+	memset(&tcm, 0, sizeof(tcm));
+	tcm.tcm_family = AF_UNSPEC;
+	tcm.tcm_ifindex = if_nametoindex(name);
+	tcm.tcm_parent = TC_H_ROOT;
+	memset(&qopt, 0, sizeof(qopt));
+	qopt.limit = 1000;
+	qopt.loss = (unsigned int)(net_netem_loss_ppm / 1e6 * 4294967295.0);
+	delay = net_netem_delay_us * 1000LL;
+
+	nh = nl_msg(buf, RTM_NEWQDISC, NLM_F_CREATE | NLM_F_EXCL, &tcm,
+		    sizeof(tcm));
+	nl_attr(nh, TCA_KIND, "netem", 6);
+	opt = nl_attr(nh, TCA_OPTIONS, NULL, 0);
+	nl_raw(nh, &qopt, sizeof(qopt));
+	nl_attr(nh, TCA_NETEM_LATENCY64, &delay, sizeof(delay));
+	nl_end(nh, opt);
+	return nl_talk(sock, nh);
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: netns_wait						*/
+/*								*/
+/* PURPOSE: Wait until both ends of every veth pair are	*/
+/*	    running.  The kernel turns the carrier on from a	*/
+/*	    workqueue after the link is brought up, and		*/
+/*	    networkio() skips a link without one.  The queue	*/
+/*	    of the link is only activated right after that, so	*/
+/*	    NETNS_SETTLE ms more are given before frames are	*/
+/*	    sent.						*/
+/*								*/
+/****************************************************************/
+static int netns_wait(void)
+{
+	struct ifreq ifr;
+	int i, n, sock, tries = 0;
+
+	sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (sock < 0) {
+		perror("networkio:socket failed");
+		return -1;
+	}
+	for (i = 0; i < 2 * net_veth; ) {
+		memset(&ifr, 0, sizeof(ifr));
+		n = snprintf(ifr.ifr_name, IFNAMSIZ, "amtu%d%c", i / 2,
+			     i % 2 ? 'b' : 'a');
+		if (n < 0 || ioctl(sock, SIOCGIFFLAGS, &ifr) < 0)
+			break;
+		if (ifr.ifr_flags & IFF_RUNNING) {
+			i++;
+			continue;
+		}
+		if (++tries > NETNS_LINKWAIT)
+			break;
+		usleep(10000);
+	}
+	close(sock);
+	if (i < 2 * net_veth) {
+		fprintf(stderr, "amtu%d%c did not come up\n", i / 2,
+			i % 2 ? 'b' : 'a');
+		return -1;
+	}
+	usleep(NETNS_SETTLE * 1000);
+	return 0;
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: netns_setup					*/
+/*								*/
+/* PURPOSE: Move the calling process into a new network	*/
+/*	    namespace and build the veth pairs in it.  A netem	*/
+/*	    qdisc that cannot be installed is reported, and the	*/
+/*	    test runs without it.				*/
+/*								*/
+/****************************************************************/
+static int netns_setup(void)
+{
+	int i, rc, sock;
+
+	if (unshare(CLONE_NEWNET) < 0) {
+		perror("networkio:unshare failed");
+		return -1;
+	}
+	sock = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (sock < 0) {
+		perror("networkio:netlink socket failed");
+		return -1;
+	}
+	for (i = 0; i < net_veth; i++) {
+		if (netns_veth(sock, i) < 0) {
+			close(sock);
+			return -1;
+		}
+		if (!net_netem_delay_us && !net_netem_loss_ppm)
+			continue;
+		rc = netns_netem(sock, i);
+		if (rc < 0) {
+			fprintf(stderr, "netem not available on amtu%da (%s), "
+				"testing without delay and loss\n", i,
+				strerror(-rc));
+			net_netem_delay_us = net_netem_loss_ppm = 0;
+		}
+	}
+	close(sock);
+	return netns_wait();
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: netns_run						*/
+/*								*/
+/* PURPOSE: Run networkio() in a child process in a private	*/
+/*	    network namespace holding net_veth veth pairs.	*/
+/*								*/
+/****************************************************************/
+int netns_run(int argc, char *argv[])
+{
+	pid_t pid;
+	int rc, stat;
+
+	printf("Network I/O Tests in a private namespace, %d veth pairs",
+		net_veth);
+	if (net_netem_delay_us || net_netem_loss_ppm)
+		printf(", netem delay %d us, loss %d ppm", net_netem_delay_us,
+			net_netem_loss_ppm);
+	printf("\n");
+	fflush(stdout);
+
+	pid = fork();
+	if (pid == 0) {
+		if (netns_setup() < 0) {
+			fflush(stdout);
+			_exit(2);
+		}
+		net_veth = 0;
+		rc = networkio(argc, argv);
+		fflush(stdout);
+		_exit(rc < 0 ? 1 : 0);
+	}
+	if (pid == -1) {
+		perror("networkio:fork failed");
+		return -1;
+	}
+	if (waitpid(pid, &stat, 0) < 0) {
+		perror("networkio:waitpid failed");
+		return -1;
+	}
+	if (!WIFEXITED(stat) || WEXITSTATUS(stat) != 0) {
+		if (WIFEXITED(stat) && WEXITSTATUS(stat) == 2) {
+			printf("Network I/O Controller Test Failed.\n");
+#ifdef HAVE_LIBLAUS
+			LAUS_LOG(("amtu - could not set up the network namespace"));
+#else
+			AUDIT_LOG("amtu - could not set up the network namespace", 0);
+#endif
+		}
+		return -1;
+	}
+	return 0;
+}
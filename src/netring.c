@@ -0,0 +1,707 @@
+//----------------------------------------------------------------------
+//
+// Module Name:  netring.c
+//
+// Include File:  amtu.h
+//
+// Description:   Code for Abstract Machine Test Utility - packet ring
+//                and batch engines of the I/O Controller-Network test.
+//
+// Notes:  The socket engine of networkio.c sends one packet per
+//         interface and copies it back with recvfrom().  This module
+//         sends net_frames frames per interface instead, through
+//         memory mapped TPACKET_V3 rings: a PACKET_TX_RING socket and
+//         a PACKET_RX_RING socket per interface, kept open for the
+//         whole test.  Frames are written into the TX ring in bursts
+//         of net_burst and handed to the kernel with one sendto(),
+//         and the RX rings are drained between the batches, each
+//         frame being verified where the kernel placed it, without a
+//         copy.  A TX ring socket cannot have an RX ring as well,
+//         hence the two sockets.  The RX sockets only take frames as
+//         they arrive, not the copies of what their own interface
+//         sends, and a frame is credited to the interface whose
+//         address it was sent from, so the frames of one interface
+//         must reach another interface under test, as on veth pairs
+//         or on ports cabled to each other.  Every frame carries its
+//         sequence number, so lost, reordered and duplicated frames
+//         are counted.  With net_sweep the frame length is a function
+//         of the sequence number, stepping from NET_MINFRAME to the
+//         MTU of the interface by NET_STRIDE and wrapping around, so
+//         every length, jumbo frames included, is sent; a frame of
+//         the wrong length counts as corrupted.  The rings are sized
+//         for the largest frame and net_burst frames per batch.
+//         Where the rings cannot be set up, and for every interface
+//         with net_engine 3, the same stream goes through a plain send
+//         and receive socket per interface instead, kept open for the
+//         whole test, net_burst frames per sendmmsg() and recvmmsg().
+//         The send and receive calls are counted, and reported per
+//         verified frame.
+//         The return code is the number of interfaces that failed.
+// -----------------------------------------------------------------
+// LANGUAGE:     C
+//
+// Licensed under the Common Public License v. 1.0
+// -----------------------------------------------------------------
+
+#define _GNU_SOURCE
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <syslog.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include "amtu.h"
+
+#define RING_BLOCK	(1 << 17)	/* bytes per ring block */
+#define RING_FRAME	2048		/* smallest TX frame slot */
+#define RING_RXBLOCKS	16		/* at least, per ring */
+#define RING_TXBLOCKS	4
+#define RING_MAXBURST	4096
+#define RING_TOV	10	/* ms before a partly filled block is retired */
+
+/* TX frames hold their data right after the aligned header */
+#define RING_TXDATA	TPACKET_ALIGN(sizeof(struct tpacket3_hdr))
+
+/* Rings of one interface */
+struct ring {
+	struct net_stream s;	/* the frames sent and received */
+	int tx;			/* TX ring socket */
+	unsigned char *txmap;
+	unsigned int txframe;	/* bytes per TX frame slot */
+	unsigned int txblocks;
+	unsigned int txframes;
+	unsigned int txslot;	/* next TX frame slot to fill */
+	int kick;		/* frames queued but not handed over */
+	unsigned char *rxmap;	/* RX ring, of if_test rsock */
+	unsigned int rxblocks;
+	unsigned int rxblock;	/* next RX block to read */
+	int mmsg;		/* no rings, sendmmsg() and recvmmsg() */
+	unsigned char *txbuf;	/* net_burst frames of maxlen to send */
+	unsigned char *rxbuf;	/* and to receive */
+	struct mmsghdr *txmsg;
+	struct mmsghdr *rxmsg;
+	struct sockaddr_ll *from;	/* senders of the received frames */
+	struct iovec *iov;	/* net_burst to send, then to receive */
+	struct sockaddr_ll dest;
+	unsigned long syscalls;	/* send and receive calls */
+};
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: ring_open						*/
+/*								*/
+/* PURPOSE: Set up a TPACKET_V3 ring of blocks blocks of	*/
+/*	    frames of frame bytes on a new			*/
+/*	    PF_PACKET socket and map it.  RX rings retire a	*/
+/*	    block after RING_TOV ms even when not full; the	*/
+/*	    kernel rejects that setting on TX rings.		*/
+/*								*/
+/****************************************************************/
+static int ring_open(int type, int blocks, int frame, unsigned char **map)
+{
+	struct tpacket_req3 req;
+	int sock, version = TPACKET_V3;
+
+	sock = socket(PF_PACKET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (sock < 0) {
+		perror("netring:socket() failed");
+		return -1;
+	}
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = RING_BLOCK;
+	req.tp_block_nr = blocks;
+	req.tp_frame_size = frame;
+	req.tp_frame_nr = blocks * (RING_BLOCK / frame);
+	if (type == PACKET_RX_RING)
+		req.tp_retire_blk_tov = RING_TOV;
+	if (setsockopt(sock, SOL_PACKET, PACKET_VERSION, &version,
+		       sizeof(version)) < 0 ||
+	    setsockopt(sock, SOL_PACKET, type, &req, sizeof(req)) < 0) {
+		perror("netring:could not set up a TPACKET_V3 ring");
+		close(sock);
+		return -1;
+	}
+	*map = mmap(NULL, (size_t)blocks * RING_BLOCK, PROT_READ | PROT_WRITE,
+		    MAP_SHARED, sock, 0);
+	if (*map == MAP_FAILED) {
+		perror("netring:mmap of the ring failed");
+		*map = NULL;
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+/* Unmap the rings of one interface and close their sockets */
+static void ring_close(struct if_test *t, struct ring *r)
+{
+	if (r->txmap)
+		munmap(r->txmap, (size_t)r->txblocks * RING_BLOCK);
+	if (r->rxmap)
+		munmap(r->rxmap, (size_t)r->rxblocks * RING_BLOCK);
+	r->txmap = r->rxmap = NULL;
+	if (r->tx >= 0)
+		close(r->tx);
+	if (t->rsock >= 0)
+		close(t->rsock);
+	r->tx = t->rsock = -1;
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: ring_map						*/
+/*								*/
+/* PURPOSE: Open the TX and RX rings of one interface, each	*/
+/*	    holding at least two bursts of the longest frame.	*/
+/*	    The RX socket gets the filter before it is bound,	*/
+/*	    so only our frames ever reach its ring.		*/
+/*								*/
+/****************************************************************/
+static int ring_map(struct if_test *t, struct ring *r)
+{
+	struct sockaddr_ll sll;
+	unsigned int per;
+
+	r->txframe = RING_FRAME;
+	while (r->txframe < RING_TXDATA + r->s.maxlen)
+		r->txframe *= 2;
+	per = RING_BLOCK / r->txframe;
+	r->txblocks = (2 * r->s.burst + per - 1) / per;
+	if (r->txblocks < RING_TXBLOCKS)
+		r->txblocks = RING_TXBLOCKS;
+	r->txframes = r->txblocks * per;
+	r->rxblocks = (2 * r->s.burst * r->txframe + RING_BLOCK - 1) /
+		RING_BLOCK;
+	if (r->rxblocks < RING_RXBLOCKS)
+		r->rxblocks = RING_RXBLOCKS;
+
+	r->tx = ring_open(PACKET_TX_RING, r->txblocks, r->txframe, &r->txmap);
+	if (r->tx < 0)
+		return -1;
+	t->rsock = ring_open(PACKET_RX_RING, r->rxblocks, RING_FRAME,
+			     &r->rxmap);
+	if (t->rsock < 0)
+		return -1;
+	if (net_attach_filter(t->rsock, 1) < 0)
+		return -1;
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_ifindex = t->iff->ifindex;
+	sll.sll_protocol = htons(ETH_P_ALL);
+	if (bind(t->rsock, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+		perror("netring:bind failed");
+		return -1;
+	}
+	return 0;
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: mmsg_open						*/
+/*								*/
+/* PURPOSE: Open the send and receive sockets of one interface	*/
+/*	    for sendmmsg() and recvmmsg(), and set up the	*/
+/*	    messages of a batch, each with a buffer of the	*/
+/*	    longest frame.  The receive buffer is made to hold	*/
+/*	    two bursts, beyond rmem_max where we may.		*/
+/*								*/
+/****************************************************************/
+static int mmsg_open(struct if_test *t, struct ring *r)
+{
+	struct iovec *iov;
+	int i, rcvbuf;
+
+	r->txbuf = malloc((size_t)r->s.burst * r->s.maxlen);
+	r->rxbuf = malloc((size_t)r->s.burst * r->s.maxlen);
+	r->txmsg = calloc(r->s.burst, sizeof(*r->txmsg));
+	r->rxmsg = calloc(r->s.burst, sizeof(*r->rxmsg));
+	r->from = calloc(r->s.burst, sizeof(*r->from));
+	r->iov = calloc(2 * r->s.burst, sizeof(*r->iov));
+	if (r->txbuf == NULL || r->rxbuf == NULL || r->txmsg == NULL ||
+	    r->rxmsg == NULL || r->from == NULL || r->iov == NULL) {
+		fprintf(stderr, "netring: malloc failed\n");
+		return -1;
+	}
+	net_dest(t->iff, &r->dest);
+	for (i = 0; i < r->s.burst; i++) {
+		iov = &r->iov[i];
+		iov->iov_base = r->txbuf + (size_t)i * r->s.maxlen;
+		r->txmsg[i].msg_hdr.msg_name = &r->dest;
+		r->txmsg[i].msg_hdr.msg_namelen = sizeof(r->dest);
+		r->txmsg[i].msg_hdr.msg_iov = iov;
+		r->txmsg[i].msg_hdr.msg_iovlen = 1;
+		iov = &r->iov[r->s.burst + i];
+		iov->iov_base = r->rxbuf + (size_t)i * r->s.maxlen;
+		iov->iov_len = r->s.maxlen;
+		r->rxmsg[i].msg_hdr.msg_name = &r->from[i];
+		r->rxmsg[i].msg_hdr.msg_iov = iov;
+		r->rxmsg[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	r->tx = open_sender(t->iff);
+	if (r->tx < 0)
+		return -1;
+	t->rsock = open_receiver(t->iff, 1);
+	if (t->rsock < 0)
+		return -1;
+	rcvbuf = 2 * r->s.burst * (r->s.maxlen + RING_TXDATA);
+	if (setsockopt(t->rsock, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf,
+		       sizeof(rcvbuf)) < 0)
+		setsockopt(t->rsock, SOL_SOCKET, SO_RCVBUF, &rcvbuf,
+			   sizeof(rcvbuf));
+	return 0;
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: ring_setup						*/
+/*								*/
+/* PURPOSE: Size the frames of one interface and open its	*/
+/*	    rings, or its sockets for sendmmsg() and recvmmsg()	*/
+/*	    with net_engine 3 or if it has no packet rings.	*/
+/*								*/
+/****************************************************************/
+static int ring_setup(struct if_test *t, struct ring *r)
+{
+	r->s.maxlen = t->iff->mtu;
+	if (!net_sweep && r->s.maxlen > NET_FRAMELEN)
+		r->s.maxlen = NET_FRAMELEN;
+	if (r->s.maxlen > RING_BLOCK / 2)
+		r->s.maxlen = RING_BLOCK / 2;
+	if (r->s.maxlen < NET_MINFRAME)
+		r->s.maxlen = NET_MINFRAME;
+	r->s.seen = calloc(r->s.count, 1);
+	if (r->s.seen == NULL) {
+		fprintf(stderr, "netring: malloc failed\n");
+		return -1;
+	}
+
+	r->mmsg = net_engine == NET_ENGINE_MMSG;
+	if (!r->mmsg && ring_map(t, r) < 0) {
+		ring_close(t, r);
+		printf("  %-16s no packet rings, using sendmmsg() and "
+			"recvmmsg()\n", t->iff->ifname);
+		r->mmsg = 1;
+	}
+	if (r->mmsg)
+		return mmsg_open(t, r);
+	return 0;
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: mmsg_send						*/
+/*								*/
+/* PURPOSE: Send up to net_burst frames on the send socket of	*/
+/*	    one interface with one sendmmsg().  Returns the	*/
+/*	    number sent, or -1 on error.			*/
+/*								*/
+/****************************************************************/
+static int mmsg_send(struct if_test *t, struct ring *r)
+{
+	int n, len, sent;
+
+	for (n = 0; n < r->s.burst && r->s.next + n < r->s.count; n++) {
+		len = net_stream_len(&r->s, r->s.next + n);
+		net_frame(r->txbuf + (size_t)n * r->s.maxlen, r->s.next + n,
+			  len);
+		r->iov[n].iov_len = len;
+	}
+	if (n == 0)
+		return 0;
+	if (r->s.next == 0)
+		t->sent = amtu_now();
+	r->syscalls++;
+	sent = sendmmsg(r->tx, r->txmsg, n, MSG_DONTWAIT);
+	if (sent < 0) {
+		if (errno == EAGAIN || errno == ENOBUFS)
+			return 0;
+		perror("netring:sendmmsg() failed");
+		return -1;
+	}
+	r->s.next += sent;
+	return sent;
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: ring_send						*/
+/*								*/
+/* PURPOSE: Queue up to net_burst frames in the TX ring of one	*/
+/*	    interface and hand them to the kernel.  Returns the	*/
+/*	    number queued, or -1 on error.			*/
+/*								*/
+/****************************************************************/
+static int ring_send(struct if_test *t, struct ring *r)
+{
+	struct tpacket3_hdr *ph;
+	struct sockaddr_ll sll;
+	int len, queued = 0;
+
+	if (r->mmsg)
+		return mmsg_send(t, r);
+
+	while (queued < r->s.burst && r->s.next < r->s.count) {
+		ph = (struct tpacket3_hdr *)(r->txmap +
+			(size_t)r->txslot * r->txframe);
+		if (ph->tp_status == TP_STATUS_WRONG_FORMAT) {
+			fprintf(stderr, "netring: frame rejected on %s\n",
+				t->iff->ifname);
+			return -1;
+		}
+		if (ph->tp_status != TP_STATUS_AVAILABLE)
+			break;
+		len = net_stream_len(&r->s, r->s.next);
+		net_frame((unsigned char *)ph + RING_TXDATA, r->s.next, len);
+		ph->tp_len = len;
+		ph->tp_next_offset = 0;
+		__sync_synchronize();
+		ph->tp_status = TP_STATUS_SEND_REQUEST;
+		r->txslot = (r->txslot + 1) % r->txframes;
+		if (r->s.next++ == 0)
+			t->sent = amtu_now();
+		queued++;
+	}
+	if (queued)
+		r->kick = 1;
+	if (!r->kick)
+		return 0;
+
+	net_dest(t->iff, &sll);
+	r->syscalls++;
+	if (sendto(r->tx, NULL, 0, MSG_DONTWAIT, (struct sockaddr *)&sll,
+		   sizeof(sll)) < 0) {
+		if (errno == EAGAIN || errno == ENOBUFS)
+			return queued;
+		perror("netring:sendto() failed");
+		return -1;
+	}
+
+	/* With the send buffer full the kernel stops early, but succeeds */
+	ph = (struct tpacket3_hdr *)(r->txmap + (size_t)((r->txslot +
+		r->txframes - 1) % r->txframes) * r->txframe);
+	if (ph->tp_status == TP_STATUS_SEND_REQUEST)
+		return queued;
+	r->kick = 0;
+	return queued ? queued : 1;
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: mmsg_receive					*/
+/*								*/
+/* PURPOSE: Drain the receive socket of interface j,		*/
+/*	    net_burst frames per recvmmsg(), until it returns	*/
+/*	    fewer, crediting each frame to its sender.		*/
+/*								*/
+/****************************************************************/
+static void mmsg_receive(struct if_test *tests, struct ring *rings,
+			 int count, int j)
+{
+	struct ring *r = &rings[j];
+	struct msghdr *mh;
+	int i, k, n;
+	double now;
+
+	do {
+		for (i = 0; i < r->s.burst; i++)
+			r->rxmsg[i].msg_hdr.msg_namelen = sizeof(r->from[i]);
+		r->syscalls++;
+		n = recvmmsg(tests[j].rsock, r->rxmsg, r->s.burst,
+			     MSG_DONTWAIT, NULL);
+		now = amtu_now();
+		for (i = 0; i < n; i++) {
+			mh = &r->rxmsg[i].msg_hdr;
+			k = net_sender(tests, count, &r->from[i]);
+			if (k < 0) {
+				tests[j].bad++;
+				continue;
+			}
+			net_account(&tests[k], &rings[k].s,
+				    mh->msg_iov->iov_base,
+				    mh->msg_flags & MSG_TRUNC ? -1 :
+				    (int)r->rxmsg[i].msg_len, now);
+		}
+	} while (n == r->s.burst);
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: ring_receive					*/
+/*								*/
+/* PURPOSE: Verify the frames of every block the kernel handed	*/
+/*	    over in the RX ring of interface j, each against	*/
+/*	    the stream of the interface it was sent from, and	*/
+/*	    give the blocks back.				*/
+/*								*/
+/****************************************************************/
+static void ring_receive(struct if_test *tests, struct ring *rings,
+			 int count, int j)
+{
+	struct ring *r = &rings[j];
+	struct tpacket_block_desc *bd;
+	struct tpacket3_hdr *ph;
+	unsigned int i;
+	int k;
+	double now;
+
+	if (r->mmsg) {
+		mmsg_receive(tests, rings, count, j);
+		return;
+	}
+	for (;;) {
+		bd = (struct tpacket_block_desc *)(r->rxmap +
+			(size_t)r->rxblock * RING_BLOCK);
+		if (!(bd->hdr.bh1.block_status & TP_STATUS_USER))
+			return;
+		__sync_synchronize();
+		now = amtu_now();
+		ph = (struct tpacket3_hdr *)((unsigned char *)bd +
+			bd->hdr.bh1.offset_to_first_pkt);
+		for (i = 0; i < bd->hdr.bh1.num_pkts; i++) {
+			/* the address follows the header, as on TX */
+			k = net_sender(tests, count, (struct sockaddr_ll *)
+				       ((unsigned char *)ph + RING_TXDATA));
+			if (k < 0)
+				tests[j].bad++;
+			else
+				net_account(&tests[k], &rings[k].s,
+					    (unsigned char *)ph + ph->tp_mac,
+					    ph->tp_snaplen != ph->tp_len ? -1 :
+					    (int)ph->tp_snaplen, now);
+			ph = (struct tpacket3_hdr *)((unsigned char *)ph +
+				ph->tp_next_offset);
+		}
+		__sync_synchronize();
+		bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+		r->rxblock = (r->rxblock + 1) % r->rxblocks;
+	}
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: ring_test						*/
+/*								*/
+/* PURPOSE: Send net_frames frames on every interface through	*/
+/*	    the TX rings, collect them from the RX rings until	*/
+/*	    all came back or net_timeout_ms passed after the	*/
+/*	    last was sent, and report each interface, with the	*/
+/*	    system calls it took per verified frame.  An	*/
+/*	    interface fails on a corrupted frame or if it lost	*/
+/*	    more than net_loss_ppm frames per million.  Returns	*/
+/*	    the number of interfaces that failed.		*/
+/*								*/
+/****************************************************************/
+int ring_test(struct if_test *tests, int count)
+{
+	struct epoll_event ev, *events;
+	struct tpacket_stats_v3 st;
+	struct itimerspec its;
+	struct pollfd *pfd;
+	struct ring *rings, *r;
+	struct if_test *t;
+	socklen_t len;
+	int i, n, epfd, tfd, busy, pending, expired = 0;
+	int burst, failures = 0;
+	unsigned int frames;
+	unsigned long lost, waits = 0, calls = 0, verified = 0;
+	double elapsed;
+
+	net_limits(RING_MAXBURST, &frames, &burst);
+	rings = calloc(count, sizeof(*rings));
+	pfd = calloc(count, sizeof(*pfd));
+	events = calloc(count + 1, sizeof(*events));
+	for (i = 0; rings != NULL && i < count; i++)
+		rings[i].tx = -1;
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u32 = count;
+	if (rings == NULL || pfd == NULL || events == NULL || epfd < 0 ||
+	    tfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev) < 0) {
+		perror("netring:setup failed");
+		failures = count;
+		goto out;
+	}
+
+	printf("%s, %d frames per interface in bursts of %d:\n",
+		net_engine == NET_ENGINE_MMSG ? "Batched sockets" :
+		"Packet rings", frames, burst);
+	for (i = 0; i < count; i++) {
+		t = &tests[i];
+		r = &rings[i];
+		r->s.count = frames;
+		r->s.burst = burst;
+		if (ring_setup(t, r) < 0) {
+			t->failed = 1;
+			continue;
+		}
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.u32 = i;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, t->rsock, &ev) < 0) {
+			perror("netring:epoll_ctl failed");
+			t->failed = 1;
+		}
+	}
+
+	/*
+	 * Send a batch on every interface in turn and drain the RX rings
+	 * in between.  When no TX ring has a free slot, wait until one
+	 * has; a ring that stays full for net_timeout_ms has stalled.
+	 */
+	do {
+		busy = 0;
+		for (i = 0; i < count; i++) {
+			t = &tests[i];
+			r = &rings[i];
+			if (t->failed)
+				continue;
+			n = ring_send(t, r);
+			if (n < 0)
+				t->failed = 1;
+			else if (n > 0)
+				busy = 1;
+		}
+		for (i = 0; i < count; i++)
+			if (!tests[i].failed)
+				ring_receive(tests, rings, count, i);
+		if (busy)
+			continue;
+		for (i = n = 0; i < count; i++) {
+			if (tests[i].failed || (rings[i].s.next ==
+			    rings[i].s.count && !rings[i].kick))
+				continue;
+			pfd[n].fd = rings[i].tx;
+			pfd[n].events = POLLOUT;
+			pfd[n].revents = 0;
+			n++;
+		}
+		if (n == 0)
+			break;
+		waits++;
+		if (poll(pfd, n, net_timeout_ms) <= 0) {
+			for (i = 0; i < count; i++)
+				if (!tests[i].failed && (rings[i].kick ||
+				    rings[i].s.next < rings[i].s.count)) {
+					fprintf(stderr, "netring: TX ring of "
+						"%s stalled\n",
+						tests[i].iff->ifname);
+					tests[i].failed = 1;
+				}
+		}
+	} while (1);
+
+	/* Collect the rest until all came back or the timer fires */
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = net_timeout_ms / 1000;
+	its.it_value.tv_nsec = (net_timeout_ms % 1000) * 1000000L + 1;
+	if (timerfd_settime(tfd, 0, &its, NULL) < 0) {
+		perror("netring:timerfd_settime failed");
+		expired = 1;
+	}
+	while (!expired) {
+		for (i = pending = 0; i < count; i++)
+			if (!tests[i].failed &&
+			    tests[i].frames < rings[i].s.next)
+				pending++;
+		if (!pending)
+			break;
+		waits++;
+		n = epoll_wait(epfd, events, count + 1, -1);
+		if (n < 0) {
+			perror("netring:epoll_wait failed");
+			break;
+		}
+		for (i = 0; i < n; i++) {
+			if (events[i].data.u32 == (unsigned int)count)
+				expired = 1;
+			else
+				ring_receive(tests, rings, count,
+					     events[i].data.u32);
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		t = &tests[i];
+		r = &rings[i];
+		memset(&st, 0, sizeof(st));
+		len = sizeof(st);
+		if (t->rsock >= 0)
+			getsockopt(t->rsock, SOL_PACKET, PACKET_STATISTICS,
+				   &st, &len);
+		lost = r->s.next - t->frames;
+		if (t->failed) {
+			printf("  %-16s failed\n", t->iff->ifname);
+		} else {
+			elapsed = t->last - t->sent;
+			printf("  %-16s %lu/%u frames of %d-%u bytes, "
+				"%.0f frames/s, %.1f Mbit/s\n", t->iff->ifname,
+				t->frames, r->s.next, net_stream_len(&r->s, 0),
+				r->s.maxlen,
+				elapsed > 0 ? t->frames / elapsed : 0,
+				elapsed > 0 ? t->bytes * 8 / elapsed / 1e6 : 0);
+			printf("  %-16s first %.3f ms, %lu lost (%.4f%%), "
+				"%lu reordered, %lu duplicated, %lu corrupted, "
+				"%u dropped by the %s\n", "",
+				t->frames ? t->rtt * 1e3 : 0, lost,
+				r->s.next ? 100.0 * lost / r->s.next : 0,
+				t->reordered, t->dups, t->bad, st.tp_drops,
+				r->mmsg ? "socket" : "ring");
+			if (t->syndrome)
+				printf("  %-16s bits 0x%02x differed in the "
+					"corrupted frames\n", "", t->syndrome);
+			printf("  %-16s %lu send and receive calls, %.3f per "
+				"verified frame\n", "", r->syscalls,
+				t->frames ? (double)r->syscalls / t->frames : 0);
+			calls += r->syscalls;
+			verified += t->frames;
+		}
+		if (!t->failed && !t->bad &&
+		    (double)lost * 1e6 <= (double)net_loss_ppm * r->s.next)
+			continue;
+		fprintf(stderr, "Packet ring test of %s FAILED!\n",
+			t->iff->ifname);
+#ifdef HAVE_LIBLAUS
+		LAUS_LOG(("amtu failed network I/O test on the packet rings"));
+#else
+		AUDIT_LOG("amtu failed network I/O test on the packet rings", 0);
+#endif
+		failures++;
+	}
+	printf("%lu system calls in all, %lu of them waits, %.3f per "
+		"verified frame\n", calls + waits, waits,
+		verified ? (double)(calls + waits) / verified : 0);
+
+out:
+	for (i = 0; rings != NULL && i < count; i++) {
+		r = &rings[i];
+		ring_close(&tests[i], r);
+		free(r->s.seen);
+		free(r->txbuf);
+		free(r->rxbuf);
+		free(r->txmsg);
+		free(r->rxmsg);
+		free(r->from);
+		free(r->iov);
+	}
+	if (tfd >= 0)
+		close(tfd);
+	if (epfd >= 0)
+		close(epfd);
+	free(events);
+	free(pfd);
+	free(rings);
+	return failures;
+}
@@ -35,33 +35,35 @@
 #include <unistd.h>
 #include <time.h>
 #include <string.h>
+#include <dirent.h>
 #include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include <netinet/in.h>
 #include <net/if.h>
-#include <ifaddrs.h>
 #include <linux/if_ether.h>
 #include <linux/if_packet.h>
+#include <linux/filter.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/sockios.h>
+#include <linux/ethtool.h>
 #include <net/if_arp.h>
-#include <sys/stat.h>
-#include <limits.h>
-#include <ctype.h>
+#include <fnmatch.h>
 #include <syslog.h>
 #include "amtu.h"
 
-#define MAXMSGSIZE	512
-#define MAX_INTERFACES	32
-#define MSGSIZE		512
-#define MAXTRIES	5
+#define NL_DUMPSIZE	32768	/* receive buffer of the link dump */
+#define CRC32C_POLY	0x82f63b78	/* Castagnoli, bit reversed */
 
-struct interface_info {
-	unsigned int ifindex;
-	char *ifname;
-	unsigned char lladdr[14];
-};
-
-struct interface_info *interface_list[MAX_INTERFACES];
+struct interface_info *interface_list;
 int ifcount;
-char msgstr[MSGSIZE];
+unsigned char msgstr[2 * MSGSIZE];
+static unsigned int msgseed;	/* seed of msgstr */
+static unsigned int crc32c_table[256];
+
+/* Vector the payload is compared in, 16 bytes on every architecture */
+typedef unsigned long long net_vec __attribute__((vector_size(16)));
 
 /****************************************************************/
 /*								*/
@@ -72,40 +74,41 @@ char msgstr[MSGSIZE];
 /****************************************************************/
 void cleanup()
 {
-	int i;
+	free(interface_list);
+	interface_list = NULL;
+	ifcount = 0;
+}
 
-	for (i = 0; i < ifcount; i++)
-		if (interface_list[i]) {
-			free(interface_list[i]->ifname);
-			free(interface_list[i]);
-		}
+/* Fill in the link address frames to iff are sent to */
+void net_dest(struct interface_info *iff, struct sockaddr_ll *sll)
+{
+	memset(sll, 0, sizeof(*sll));
+	sll->sll_family = AF_PACKET;
+	sll->sll_ifindex = iff->ifindex;
+	sll->sll_protocol = htons(ETH_P_LOOP);
+	sll->sll_halen = iff->halen;
+	memcpy(sll->sll_addr, iff->lladdr, iff->halen);
 }
 
 /****************************************************************/
 /*								*/
-/* FUNCTION: send_packet					*/
+/* FUNCTION: open_sender					*/
 /* 								*/
-/* PURPOSE: Prepare and send packet containing randmon string	*/ 
-/* 	    to network device.Use PF_PACKET so we can talk	*/
-/* 	    directly to the network device.			*/
+/* PURPOSE: Open a non-blocking PF_PACKET socket bound to the	*/ 
+/* 	    network device, kept open for the whole test.  Use	*/
+/* 	    PF_PACKET so we can talk directly to the device.	*/
 /*								*/
 /****************************************************************/
-int send_packet(struct interface_info *iff)
+int open_sender(struct interface_info *iff)
 {
 	int ssock_fd;
-	int numc, len;
 	struct sockaddr_ll send_info;
 	
 	/* PF_PACKET requires generic sockaddr_ll structure */
-
-	memset(&send_info, 0, sizeof(send_info));
-	send_info.sll_family = AF_PACKET;
-	send_info.sll_ifindex = iff->ifindex;
-	send_info.sll_protocol = htons(ETH_P_LOOP);
-	send_info.sll_halen = sizeof(send_info.sll_addr);
-	memcpy(send_info.sll_addr, iff->lladdr, sizeof(send_info.sll_addr));
+	net_dest(iff, &send_info);
 	
-	ssock_fd = socket(PF_PACKET, SOCK_DGRAM, 0);
+	ssock_fd = socket(PF_PACKET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+			  0);
 
 	if (ssock_fd < 0) {
 		perror("send_packet:socket() failed");
@@ -117,8 +120,8 @@ int send_packet(struct interface_info *iff)
 		return(-1) ;
 	}
 	
-	len = sizeof(send_info);	
-	if (bind(ssock_fd, (struct sockaddr *)&send_info, len) < 0) {
+	if (bind(ssock_fd, (struct sockaddr *)&send_info,
+		 sizeof(send_info)) < 0) {
 		perror("send_packet:bind() failed");
 #ifdef HAVE_LIBLAUS
 		LAUS_LOG(("amtu failed network I/O test on bind to a socket"));
@@ -128,9 +131,27 @@ int send_packet(struct interface_info *iff)
 		close(ssock_fd);
 		return(-1);
 	}
+	return ssock_fd;
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: send_packet					*/
+/* 								*/
+/* PURPOSE: Send a packet containing the random pattern on the	*/ 
+/* 	    send socket of the interface under test.		*/
+/*								*/
+/****************************************************************/
+int send_packet(struct if_test *t)
+{
+	int numc;
+	struct sockaddr_ll send_info;
+	unsigned char frame[NET_FRAMELEN];
 
 	/* send the random message on the interface under test */
-	numc = sendto(ssock_fd, msgstr, sizeof(msgstr), 0, 
+	net_dest(t->iff, &send_info);
+	net_frame(frame, 0, sizeof(frame));
+	numc = sendto(t->ssock, frame, sizeof(frame), 0, 
 		      (struct sockaddr *)&send_info, sizeof(send_info));
 	if (numc < 0) {
 		perror("send_packet:sendto() failed");
@@ -139,215 +160,777 @@ int send_packet(struct interface_info *iff)
 #else
 		AUDIT_LOG("amtu failed network I/O tests on sendto()", 0);
 #endif
-		close(ssock_fd);
 		return(-1);
 	}
-	
-	close(ssock_fd);
 	return 0;
 }
 
-int sysfs_present(const char *path)
+/****************************************************************/
+/*								*/
+/* FUNCTION: net_match						*/
+/*								*/
+/* PURPOSE: Whether name matches one of the colon separated	*/
+/*	    shell patterns in patterns.				*/
+/*								*/
+/****************************************************************/
+int net_match(const char *patterns, const char *name)
 {
-	struct stat st;
-	return stat(path, &st);
+	char *list, *p, *save = NULL;
+	int match = 0;
+
+	list = strdup(patterns);
+	if (list == NULL)
+		return 0;
+	for (p = strtok_r(list, ":", &save); p && !match;
+	     p = strtok_r(NULL, ":", &save))
+		match = fnmatch(p, name, 0) == 0;
+	free(list);
+	return match;
 }
 
-int get_sysfs_value(const char *sysfs_path)
+/****************************************************************/
+/*								*/
+/* FUNCTION: net_rxqueues					*/
+/*								*/
+/* PURPOSE: Count the RX queues an interface has in use, which	*/
+/*	    may be fewer than it was allocated: its RX and	*/
+/*	    combined channels from ETHTOOL_GCHANNELS, or its	*/
+/*	    rx-* queues in sysfs if the driver does not report	*/
+/*	    channels.  Returns 0 if neither is known.  Only the	*/
+/*	    engines that need it ask, for the interfaces they	*/
+/*	    test, to keep the discovery to one link dump.	*/
+/*								*/
+/****************************************************************/
+unsigned int net_rxqueues(const char *ifname)
 {
-	FILE *f;
-	int value = -1;
+	struct ethtool_channels ch;
+	struct ifreq ifr;
+	struct dirent *de;
+	char path[64];
+	unsigned int n = 0;
+	DIR *dir;
+	int sock;
 
-	f = fopen(sysfs_path, "r");
-	if (f) {
-		fscanf(f, "%d", &value);
-		fclose(f);
+	sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (sock >= 0) {
+		memset(&ch, 0, sizeof(ch));
+		ch.cmd = ETHTOOL_GCHANNELS;
+		memset(&ifr, 0, sizeof(ifr));
+		memcpy(ifr.ifr_name, ifname, sizeof(ifr.ifr_name));
+		ifr.ifr_data = (void *)&ch;
+		if (ioctl(sock, SIOCETHTOOL, &ifr) == 0)
+			n = ch.rx_count + ch.combined_count;
+		close(sock);
+		if (n > 0)
+			return n;
 	}
 
-	return value;
+	snprintf(path, sizeof(path), "/sys/class/net/%s/queues", ifname);
+	dir = opendir(path);
+	if (dir == NULL)
+		return 0;
+	while ((de = readdir(dir)) != NULL)
+		if (strncmp(de->d_name, "rx-", 3) == 0)
+			n++;
+	closedir(dir);
+	return n;
 }
 
-int get_interface_type(const char *if_name)
+/****************************************************************/
+/*								*/
+/* FUNCTION: add_interface					*/
+/*								*/
+/* PURPOSE: Check one link of the RTM_GETLINK dump and add it	*/
+/*	    to interface_list if it is to be tested: a		*/
+/*	    configured ethernet or token ring device that is	*/
+/*	    up, running and has a carrier, and that passes the	*/
+/*	    net_include and net_exclude patterns.  Returns -1	*/
+/*	    if the list cannot grow.				*/
+/*								*/
+/****************************************************************/
+int add_interface(struct nlmsghdr *nh, int *size)
 {
-	char sysfs_if_type[PATH_MAX];
-	int type = -1;
+	struct ifinfomsg *ifi = NLMSG_DATA(nh);
+	struct interface_info info, *list;
+	struct rtattr *rta;
+	int len, carrier = -1;
 
-	if (snprintf(sysfs_if_type, PATH_MAX,
-		"/sys/class/net/%s/type", if_name) > 0) {
-		type = get_sysfs_value(sysfs_if_type);
+	memset(&info, 0, sizeof(info));
+	info.ifindex = ifi->ifi_index;
+	len = IFLA_PAYLOAD(nh);
+	for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		switch (rta->rta_type) {
+		case IFLA_IFNAME:
+			strncpy(info.ifname, RTA_DATA(rta), IFNAMSIZ - 1);
+			break;
+		case IFLA_MTU:
+			info.mtu = *(unsigned int *)RTA_DATA(rta);
+			break;
+		case IFLA_CARRIER:
+			carrier = *(unsigned char *)RTA_DATA(rta);
+			break;
+		case IFLA_ADDRESS:
+			info.halen = RTA_PAYLOAD(rta);
+			if (info.halen > sizeof(info.lladdr))
+				info.halen = sizeof(info.lladdr);
+			memcpy(info.lladdr, RTA_DATA(rta), info.halen);
+			break;
+		}
 	}
-	return type;
-}
 
-int get_interface_carrier(const char *if_name)
-{
-	char sysfs_if_carrier[PATH_MAX];
-	int carrier = 0;
+	if (debug)
+		printf("if: %7s, type: %4d, carrier: %3d\n",
+			info.ifname, ifi->ifi_type, carrier);
+
+	/* only testing ethernet and tokenring */
+	if (ifi->ifi_type != ARPHRD_ETHER &&
+	    ifi->ifi_type != ARPHRD_IEEE802_TR)
+		return 0;
+	/* interface needs to be up and operative, with carrier */
+	if ((ifi->ifi_flags & (IFF_UP|IFF_RUNNING)) != (IFF_UP|IFF_RUNNING) ||
+	    carrier != 1)
+		return 0;
+	if (ifi->ifi_flags & IFF_LOOPBACK)
+		return 0;
+	if ((ifi->ifi_flags &
+	    (IFF_MULTICAST|IFF_BROADCAST|IFF_POINTOPOINT)) == 0)
+		return 0;
+	if (net_include && !net_match(net_include, info.ifname))
+		return 0;
+	if (net_exclude && net_match(net_exclude, info.ifname))
+		return 0;
 
-	if (snprintf(sysfs_if_carrier, PATH_MAX,
-		"/sys/class/net/%s/carrier", if_name) > 0) {
-		carrier = get_sysfs_value(sysfs_if_carrier);
+	/* If could not find link address, return with an error. */
+	if (info.halen == 0) {
+		fprintf(stderr, "no link address for %s.\n", info.ifname);
+#ifdef HAVE_LIBLAUS
+		LAUS_LOG(("amtu failed network I/O test, could not find a link address"));
+#else
+		AUDIT_LOG("amtu failed network I/O test, could not find a link address", 0);
+#endif
+		return -1;
 	}
-	return carrier;
+
+	if (ifcount == *size) {
+		*size = *size ? 2 * *size : 16;
+		list = realloc(interface_list, *size * sizeof(*list));
+		if (list == NULL) {
+			fprintf(stderr, "get_interfaces: malloc failed\n");
+#ifdef HAVE_LIBLAUS
+			LAUS_LOG(("amtu failed network I/O test in malloc"));
+#else
+			AUDIT_LOG("amtu failed network I/O test in malloc", 0);
+#endif
+			return -1;
+		}
+		interface_list = list;
+	}
+	interface_list[ifcount++] = info;
+	return 0;
 }
 
 /****************************************************************/
 /*								*/
 /* FUNCTION: get_interfaces					*/
 /*								*/
-/* PURPOSE: Get list of network interfaces from the kernel.	*/
+/* PURPOSE: Get list of network interfaces from the kernel,	*/
+/*	    with one RTM_GETLINK dump that gives the type,	*/
+/*	    flags, carrier, MTU and link address of each.	*/
 /*	    AMTU will test only configured ethernet and token 	*/
 /*	    ring interfaces.					*/
 /*								*/
 /****************************************************************/
 int get_interfaces()
 {
-	struct ifaddrs *ifaddrs, *ifa;
-	int i, j = 0;
-	
-	if (getifaddrs(&ifaddrs) == -1) {
-		perror("get_interfaces: getifaddrs failed");	
+	struct {
+		struct nlmsghdr nh;
+		struct ifinfomsg ifi;
+	} req;
+	struct nlmsghdr *nh;
+	char *buf;
+	int sock, cc, done = 0, size = 0, rc = -1;
+
+	buf = malloc(NL_DUMPSIZE);
+	sock = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	memset(&req, 0, sizeof(req));
+	req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(req.ifi));
+	req.nh.nlmsg_type = RTM_GETLINK;
+	req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.ifi.ifi_family = AF_UNSPEC;
+	if (buf == NULL || sock < 0 ||
+	    send(sock, &req, req.nh.nlmsg_len, 0) < 0) {
+		perror("get_interfaces: RTM_GETLINK failed");	
 #ifdef HAVE_LIBLAUS
-		LAUS_LOG(("amtu failed network I/O tests in getifaddrs()"));	
+		LAUS_LOG(("amtu failed network I/O tests in RTM_GETLINK"));	
 #else
-		AUDIT_LOG("amtu failed network I/O tests in getifaddrs()", 0);	
+		AUDIT_LOG("amtu failed network I/O tests in RTM_GETLINK", 0);	
 #endif
+		goto out;
+	}
+
+	while (!done) {
+		cc = recv(sock, buf, NL_DUMPSIZE, 0);
+		if (cc < 0) {
+			perror("get_interfaces: recv failed");
+			goto out;
+		}
+		for (nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, (unsigned)cc);
+		     nh = NLMSG_NEXT(nh, cc)) {
+			if (nh->nlmsg_type == NLMSG_DONE) {
+				done = 1;
+				break;
+			}
+			if (nh->nlmsg_type == NLMSG_ERROR) {
+				fprintf(stderr, "get_interfaces: RTM_GETLINK "
+					"dump failed\n");
+				goto out;
+			}
+			if (nh->nlmsg_type == RTM_NEWLINK &&
+			    add_interface(nh, &size) < 0)
+				goto out;
+		}
+	}
+	rc = ifcount;
+
+out:
+	if (sock >= 0)
+		close(sock);
+	free(buf);
+	return rc;
+}
+
+/*
+ * Socket filter of the receive sockets: accept only ETH_P_LOOP frames
+ * whose payload starts with NET_MAGIC, so the kernel drops all other
+ * traffic of the interface instead of copying it to us.
+ */
+static struct sock_filter net_filter[] = {
+	BPF_STMT(BPF_LD | BPF_H | BPF_ABS, SKF_AD_OFF + SKF_AD_PROTOCOL),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_LOOP, 0, 3),
+	BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 0),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+		 (NET_MAGIC[0] << 24) | (NET_MAGIC[1] << 16) |
+		 (NET_MAGIC[2] << 8) | NET_MAGIC[3], 0, 1),
+	BPF_STMT(BPF_RET | BPF_K, 0xffff),
+	BPF_STMT(BPF_RET | BPF_K, 0),
+};
+
+/*
+ * The same frames as they arrive, not as they leave, so that only
+ * frames that went through the NIC or the wire are seen, on the
+ * interface that received them.  An arriving ETH_P_LOOP is taken for
+ * an 802.3 length, so the type is read from the Ethernet header and
+ * not from the protocol of the frame.
+ */
+static struct sock_filter net_rx_filter[] = {
+	BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_AD_OFF + SKF_AD_PKTTYPE),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, PACKET_OUTGOING, 5, 0),
+	BPF_STMT(BPF_LD | BPF_H | BPF_ABS, SKF_LL_OFF + 2 * ETH_ALEN),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_LOOP, 0, 3),
+	BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 0),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+		 (NET_MAGIC[0] << 24) | (NET_MAGIC[1] << 16) |
+		 (NET_MAGIC[2] << 8) | NET_MAGIC[3], 0, 1),
+	BPF_STMT(BPF_RET | BPF_K, 0xffff),
+	BPF_STMT(BPF_RET | BPF_K, 0),
+};
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: net_attach_filter					*/
+/*								*/
+/* PURPOSE: Attach the socket filter passing only our packets,	*/
+/*	    only the arriving ones with arrivals, to a		*/
+/*	    PF_PACKET socket that is not bound yet.		*/
+/*								*/
+/****************************************************************/
+int net_attach_filter(int sock, int arrivals)
+{
+	struct sock_fprog prog;
+
+	if (arrivals) {
+		prog.len = sizeof(net_rx_filter) / sizeof(net_rx_filter[0]);
+		prog.filter = net_rx_filter;
+	} else {
+		prog.len = sizeof(net_filter) / sizeof(net_filter[0]);
+		prog.filter = net_filter;
+	}
+	if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &prog,
+		       sizeof(prog)) < 0) {
+		perror("networkio:SO_ATTACH_FILTER failed");
 		return -1;
 	}
-	
-	/* Find ipv4 and ipv6 configured interfaces */
-	for (ifa = ifaddrs; ifa != NULL; ifa = ifa->ifa_next) {
-	
-		struct interface_info *np;
-		int found = 0;
+	return 0;
+}
 
-		if (sysfs_present("/sys/class/net") == 0) {
-			int if_type = -1;
-			int if_carrier = 0;
+/****************************************************************/
+/*								*/
+/* FUNCTION: net_pattern					*/
+/*								*/
+/* PURPOSE: Build the payload pattern of seed in msgstr: every	*/
+/*	    byte value once, in an order drawn from seed, then	*/
+/*	    walking ones and walking zeros, so that each data	*/
+/*	    line is seen stuck at either level.  The pattern is	*/
+/*	    stored twice, so that any rotation of it can be	*/
+/*	    read in one piece.					*/
+/*								*/
+/****************************************************************/
+void net_pattern(unsigned int seed)
+{
+	unsigned int i, j, crc;
+	unsigned char c;
 
-			if_type = get_interface_type(ifa->ifa_name);
-			if_carrier = get_interface_carrier(ifa->ifa_name);
+	msgseed = seed;
+	srandom(seed);
+	for (i = 0; i < 256; i++)
+		msgstr[i] = i;
+	for (i = 255; i > 0; i--) {
+		j = random() % (i + 1);
+		c = msgstr[i];
+		msgstr[i] = msgstr[j];
+		msgstr[j] = c;
+	}
+	for (i = 256; i < MSGSIZE; i++)
+		msgstr[i] = i & 8 ? ~(1 << (i & 7)) : 1 << (i & 7);
+	memcpy(msgstr + MSGSIZE, msgstr, MSGSIZE);
 
-			if (debug)
-				printf("if: %7s, type: %4d, carrier: %3d\n",
-					ifa->ifa_name, if_type, if_carrier);
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+		crc32c_table[i] = crc;
+	}
+}
 
-			/* only testing ethernet and tokenring */
-			if (if_type != ARPHRD_ETHER &&
-			    if_type != ARPHRD_IEEE802_TR)
-				continue;
+static void net_put32(unsigned char *p, unsigned int v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
 
-			/* only testing if carrier present */
-			if (if_carrier != 1)
-				continue;
-		} else {
-			/* with no sysfs, just fall back to old way */
-			if ((strncmp(ifa->ifa_name, "eth", 3) != 0) &&
-			    (strncmp(ifa->ifa_name, "tr", 2) != 0))
-				continue;
-		}
+static unsigned int net_get32(const unsigned char *p)
+{
+	return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
 
-		/* check family */
-		if (ifa->ifa_addr->sa_family != AF_INET && 
-	            ifa->ifa_addr->sa_family != AF_INET6)
-			continue;
-		/* interface needs to be up and operative */
-		if ((ifa->ifa_flags & (IFF_UP|IFF_RUNNING)) == 0)
-			continue;
-		if (ifa->ifa_flags & IFF_LOOPBACK)
-			continue;
-		if ((ifa->ifa_flags &
-		    (IFF_MULTICAST|IFF_BROADCAST|IFF_POINTOPOINT)) == 0)
-			continue;
-			
-		/* Any interface that makes it up to now can be added to
- 		 * our interface list. 
- 		 */
-
-		/* Note: We test the network device.
- 		 * Thus we use the MAC address associated with the configured
- 		 * interfaces. If an interface has both ipv4 and ipv6
- 		 * we could have it in our list twice, so check for duplicates.
- 		 */
- 		 
-		for (i = 0; i < j; i++) {
-			if (strncmp(interface_list[i]->ifname, ifa->ifa_name, 
-			    sizeof(ifa->ifa_name)) == 0) {
-				found = 1;
-				break;
+static unsigned int crc32c(unsigned int crc, const unsigned char *p, int n)
+{
+	while (n-- > 0)
+		crc = crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+/* CRC32C of a frame, all but its CRC field in the last header word */
+static unsigned int net_crc(const unsigned char *buf, int len)
+{
+	unsigned int crc;
+
+	crc = crc32c(~0U, buf, NET_HDRLEN - 4);
+	return ~crc32c(crc, buf + NET_HDRLEN, len - NET_HDRLEN);
+}
+
+/*
+ * Offset of the first byte in which the n bytes at a and b differ, or
+ * -1.  They are compared 64 bytes at a time, four vectors XORed and
+ * ORed together, and only a block that differs is looked at bytewise.
+ */
+static int net_compare(const unsigned char *a, const unsigned char *b, int n)
+{
+	net_vec x[4], y[4], d;
+	int i = 0, k;
+
+	for (; i + (int)sizeof(x) <= n; i += sizeof(x)) {
+		memcpy(x, a + i, sizeof(x));
+		memcpy(y, b + i, sizeof(y));
+		d = (x[0] ^ y[0]) | (x[1] ^ y[1]) | (x[2] ^ y[2]) |
+			(x[3] ^ y[3]);
+		if (d[0] | d[1])
+			break;
+	}
+	for (k = i; k < n; k++)
+		if (a[k] != b[k])
+			return k;
+	return -1;
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: net_frame						*/
+/*								*/
+/* PURPOSE: Build frame number seq of a test, len bytes long:	*/
+/*	    the magic, the sequence number, the seed of the	*/
+/*	    pattern and the CRC32C of the frame, all stored	*/
+/*	    big-endian, then the payload pattern, rotated by	*/
+/*	    seq so that no two frames carry the same data.	*/
+/*								*/
+/****************************************************************/
+void net_frame(unsigned char *buf, unsigned int seq, int len)
+{
+	int i, n;
+
+	memcpy(buf, NET_MAGIC, 4);
+	net_put32(buf + 4, seq);
+	net_put32(buf + 8, msgseed);
+	for (i = NET_HDRLEN; i < len; i += n) {
+		n = len - i < MSGSIZE ? len - i : MSGSIZE;
+		memcpy(buf + i, msgstr + (i - NET_HDRLEN + seq) % MSGSIZE, n);
+	}
+	net_put32(buf + 12, net_crc(buf, len));
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: net_check_frame					*/
+/*								*/
+/* PURPOSE: Verify the len bytes of a frame built by		*/
+/*	    net_frame() on interface t and return its sequence	*/
+/*	    number in seq.  Returns -1 if the frame is not	*/
+/*	    intact, and reports the first NET_REPORTS such	*/
+/*	    frames: for a corrupted payload the offset of the	*/
+/*	    first bad byte and the bit syndrome, the bits that	*/
+/*	    differ from what was sent.  The caller checks that	*/
+/*	    len is the length of frame seq.			*/
+/*								*/
+/****************************************************************/
+int net_check_frame(struct if_test *t, const unsigned char *buf, int len,
+		    unsigned int *seq)
+{
+	const unsigned char *want;
+	unsigned int s, seed, bits = 0;
+	int i, k, d, n, first = -1, bytes = 0;
+	unsigned char sent = 0, got = 0;
+
+	if (len < NET_HDRLEN || memcmp(buf, NET_MAGIC, 4) != 0)
+		return -1;
+	s = net_get32(buf + 4);
+	seed = net_get32(buf + 8);
+	if (seed != msgseed) {
+		if (t->reports++ < NET_REPORTS)
+			printf("  %-16s frame %u has seed 0x%08x, not "
+				"0x%08x\n", t->iff->ifname, s, seed, msgseed);
+		return -1;
+	}
+
+	for (i = NET_HDRLEN; i < len; i += n) {
+		n = len - i < MSGSIZE ? len - i : MSGSIZE;
+		want = msgstr + (i - NET_HDRLEN + s) % MSGSIZE;
+		for (d = 0; (k = net_compare(buf + i + d, want + d,
+		     n - d)) >= 0; d++) {
+			d += k;
+			if (first < 0) {
+				first = i + d;
+				sent = want[d];
+				got = buf[i + d];
 			}
+			bits |= buf[i + d] ^ want[d];
+			bytes++;
 		}
-			
-		/* add to our list if it hasn't been added yet. */
-		if (!found) {
-			np = (struct interface_info *)malloc(sizeof(*np));
-			if (np == NULL) {
-				fprintf(stderr, "get_interfaces: malloc failed\n");
+	}
+	if (bytes) {
+		t->syndrome |= bits;
+		if (t->reports++ < NET_REPORTS)
+			printf("  %-16s frame %u corrupted at offset %d of "
+				"%d: sent 0x%02x, got 0x%02x, syndrome "
+				"0x%02x; %d bytes differ in bits 0x%02x\n",
+				t->iff->ifname, s, first, len, sent, got,
+				sent ^ got, bytes, bits);
+		return -1;
+	}
+	if (net_get32(buf + 12) != net_crc(buf, len)) {
+		if (t->reports++ < NET_REPORTS)
+			printf("  %-16s frame %u of %d bytes fails its "
+				"CRC32C\n", t->iff->ifname, s, len);
+		return -1;
+	}
+	*seq = s;
+	return 0;
+}
+
+/* Length of frame seq of a stream, sweeping the sizes with net_sweep */
+int net_stream_len(struct net_stream *s, unsigned int seq)
+{
+	if (!net_sweep)
+		return s->maxlen;
+	return NET_MINFRAME + (seq * NET_STRIDE) %
+		(s->maxlen - NET_MINFRAME + 1);
+}
+
+/* Frames per interface, and per batch up to maxburst, to send */
+void net_limits(int maxburst, unsigned int *frames, int *burst)
+{
+	*frames = net_frames > 0 ? net_frames : 1;
+	*burst = net_burst > 0 ? net_burst : 1;
+	if (*burst > maxburst)
+		*burst = maxburst;
+}
+
+/* Index of the interface under test a frame came from, -1 if none */
+int net_sender(struct if_test *tests, int count,
+	       const struct sockaddr_ll *from)
+{
+	int k;
+
+	for (k = 0; k < count; k++)
+		if (from->sll_halen == tests[k].iff->halen &&
+		    memcmp(from->sll_addr, tests[k].iff->lladdr,
+			   from->sll_halen) == 0)
+			return k;
+	return -1;
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: net_account					*/
+/*								*/
+/* PURPOSE: Verify and count one frame of stream s of		*/
+/*	    interface t, len bytes received at now, len being	*/
+/*	    -1 if it was truncated.  A frame is good if it is	*/
+/*	    intact and of the length its sequence number calls	*/
+/*	    for.						*/
+/*								*/
+/****************************************************************/
+void net_account(struct if_test *t, struct net_stream *s,
+		 const unsigned char *data, int len, double now)
+{
+	unsigned int seq;
+
+	if (len < 0 || net_check_frame(t, data, len, &seq) < 0 ||
+	    seq >= s->next || len != net_stream_len(s, seq)) {
+		t->bad++;
+	} else if (s->seen[seq]) {
+		t->dups++;
+	} else {
+		s->seen[seq] = 1;
+		if (seq + 1 < s->high)
+			t->reordered++;
+		else
+			s->high = seq + 1;
+		if (t->frames++ == 0)
+			t->rtt = now - t->sent;
+		t->bytes += len;
+		t->last = now;
+	}
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: open_receiver					*/
+/*								*/
+/* PURPOSE: Open a non-blocking PF_PACKET socket receiving	*/
+/*	    our packets on one interface, only the ones that	*/
+/*	    arrive on it with arrivals.  It is created with	*/
+/*	    protocol 0, which receives nothing, and only bound	*/
+/*	    once the filter is attached, so nothing unfiltered	*/
+/*	    can be queued.					*/
+/*								*/
+/****************************************************************/
+int open_receiver(struct interface_info *iff, int arrivals)
+{
+	struct sockaddr_ll rcv_info;
+	int rsock_fd;
+
+	rsock_fd = socket(PF_PACKET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+			  0);
+	if (rsock_fd < 0) {
+		perror("networkio:socket() failed");
 #ifdef HAVE_LIBLAUS
-				LAUS_LOG(("amtu failed network I/O test in malloc"));
+		LAUS_LOG(("amtu failed network I/O tests on creating PF_PACKET socket"));
 #else
-				AUDIT_LOG("amtu failed network I/O test in malloc", 0);
+		AUDIT_LOG("amtu failed network I/O tests on creating PF_PACKET socket", 0);
 #endif
-				freeifaddrs(ifaddrs);
-				return -1;
-			}	 
-	
-			np->ifindex = if_nametoindex(ifa->ifa_name);
-			/* need to malloc size of string plus null terminator */
-			np->ifname = (char *)malloc(sizeof(ifa->ifa_name) + 1);
-			if (np->ifname == NULL) {
-				fprintf(stderr,"get_interfaces:malloc np->ifname failed\n");
+		return -1;
+	}
+
+	if (net_attach_filter(rsock_fd, arrivals) < 0) {
+		close(rsock_fd);
+		return -1;
+	}
+
+	/* bind socket to interface so that we receive packets
+	 * destined only for this interface.  ETH_P_ALL is needed to
+	 * see the packets we send.
+	 */
+	memset(&rcv_info, 0, sizeof(rcv_info));
+	rcv_info.sll_family = AF_PACKET;
+	rcv_info.sll_ifindex = iff->ifindex;
+	rcv_info.sll_protocol = htons(ETH_P_ALL);
+	if (bind(rsock_fd, (struct sockaddr *)&rcv_info, sizeof(rcv_info)) < 0) {
+		perror("networkio:bind failed");
 #ifdef HAVE_LIBLAUS
-				LAUS_LOG(("amtu failed network I/O test in malloc np->ifname"));
+		LAUS_LOG(("amtu failed network I/O test on bind to socket"));
 #else
-				AUDIT_LOG("amtu failed network I/O test in malloc np->ifname", 0);
+		AUDIT_LOG("amtu failed network I/O test on bind to socket", 0);
 #endif
-				freeifaddrs(ifaddrs);
-				free(np);
-				return -1;	
-			}
-			memset(np->ifname, 0, sizeof(ifa->ifa_name) + 1);
-			strncpy(np->ifname, ifa->ifa_name, sizeof(ifa->ifa_name));
-			interface_list[j++] = np;
+		close(rsock_fd);
+		return -1;
+	}
+	return rsock_fd;
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: receive_packets					*/
+/*								*/
+/* PURPOSE: Read everything queued on the receive socket of	*/
+/*	    one interface.  Returns 1 once our message is seen.	*/
+/*								*/
+/****************************************************************/
+int receive_packets(struct if_test *t)
+{
+	unsigned char packetbuf[NET_FRAMELEN];
+	struct sockaddr_ll from;
+	socklen_t len;
+	unsigned int seq;
+	int cc;
+
+	for (;;) {
+		len = sizeof(from);
+		cc = recvfrom(t->rsock, packetbuf, sizeof(packetbuf), MSG_TRUNC,
+			      (struct sockaddr *)&from, &len);
+		if (cc < 0)
+			return 0;
+		if (debug)
+			printf("Received %d bytes on %s\n", cc, t->iff->ifname);
+		if (cc == sizeof(packetbuf) &&
+		    net_check_frame(t, packetbuf, cc, &seq) == 0 && seq == 0) {
+			t->rtt = amtu_now() - t->sent;
+			return 1;
 		}
-	}                                                         
+	}
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: socket_test					*/
+/*								*/
+/* PURPOSE: Send a packet containing the random data on each	*/
+/*	    interface and verify the data received.  All	*/
+/*	    interfaces are tested at once: the send and receive	*/
+/*	    sockets are opened, the packets sent, and the	*/
+/*	    replies collected by one epoll loop until a timerfd	*/
+/*	    fires after net_timeout_ms.  Returns the number of	*/
+/*	    interfaces that failed.				*/
+/*								*/
+/****************************************************************/
+int socket_test(struct if_test *tests, int count)
+{
+	struct epoll_event ev, *events;
+	struct if_test *t;
+	struct itimerspec its;
+	int i, n, epfd, tfd, pending = 0, expired = 0;
+	int failures = 0;
+
+	events = calloc(count + 1, sizeof(*events));
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u32 = count;
+	if (events == NULL || epfd < 0 || tfd < 0 ||
+	    epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev) < 0) {
+		perror("networkio:epoll setup failed");
+		if (epfd >= 0)
+			close(epfd);
+		if (tfd >= 0)
+			close(tfd);
+		free(events);
+		return count;
+	}
 
 	/*
- 	 * Step through interface list again and get link address for
- 	 * configured devices in our interface_list.
-	 * Note: For each device, getifaddrs pulls up a list of ip addresses
-	 * configured on the device and the link address. The family
-	 * for link address is AF_PACKET.  
- 	 */
-	
-	for (i = 0; i < j; i++) {
-	                     
-		for (ifa = ifaddrs; ifa != NULL; ifa = ifa->ifa_next) {
-			if ((ifa->ifa_addr->sa_family == AF_PACKET) &&
-			    strncmp(ifa->ifa_name, interface_list[i]->ifname, 
-			     sizeof(ifa->ifa_name))) {
-				/* found the link address, copy it. */
-				memcpy(interface_list[i]->lladdr, ifa->ifa_addr->sa_data, 14);
-				break;
+	 * Open a receive socket on every interface first, so that no
+	 * packet is missed, then send a packet containing the random
+	 * data on each.
+	 */
+	for (i = 0; i < count; i++) {
+		t = &tests[i];
+		t->rsock = open_receiver(t->iff, 0);
+		t->ssock = open_sender(t->iff);
+		if (t->rsock < 0 || t->ssock < 0) {
+			t->failed = 1;
+			continue;
+		}
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.u32 = i;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, t->rsock, &ev) < 0) {
+			perror("networkio:epoll_ctl failed");
+			t->failed = 1;
+		}
+	}
+	for (i = 0; i < count; i++) {
+		t = &tests[i];
+		if (t->failed)
+			continue;
+		if (debug)
+			printf("Sending on %s\n", t->iff->ifname);
+		t->sent = amtu_now();
+		if (send_packet(t) < 0) {
+			t->failed = 1;
+			continue;
+		}
+		pending++;
+	}
+
+	/* Collect the packets until all came back or the timer fires */
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = net_timeout_ms / 1000;
+	its.it_value.tv_nsec = (net_timeout_ms % 1000) * 1000000L + 1;
+	if (timerfd_settime(tfd, 0, &its, NULL) < 0) {
+		perror("networkio:timerfd_settime failed");
+		expired = 1;
+	}
+	while (pending > 0 && !expired) {
+		n = epoll_wait(epfd, events, count + 1, -1);
+		if (n < 0) {
+			perror("networkio:epoll_wait failed");
+			break;
+		}
+		for (i = 0; i < n; i++) {
+			if (events[i].data.u32 == (unsigned int)count) {
+				expired = 1;
+				continue;
 			}
+			t = &tests[events[i].data.u32];
+			if (t->rtt >= 0 || !receive_packets(t))
+				continue;
+			epoll_ctl(epfd, EPOLL_CTL_DEL, t->rsock, NULL);
+			pending--;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		t = &tests[i];
+		if (t->rsock >= 0)
+			close(t->rsock);
+		if (t->ssock >= 0)
+			close(t->ssock);
+		if (!t->failed && t->rtt >= 0) {
+			printf("  %-16s %9.3f ms\n", t->iff->ifname,
+				t->rtt * 1e3);
+			continue;
 		}
-		
-		/* If could not find link address, return with an error. */
-		if (interface_list[i]->lladdr == NULL) {
-			fprintf(stderr, "no link address for %s.\n", interface_list[i]->ifname);
+		if (!t->failed) {
+			printf("  %-16s no reply\n", t->iff->ifname);
+			if(debug)
+				printf("recvfrom failed to receive message on %s\n", 
+					t->iff->ifname);
 #ifdef HAVE_LIBLAUS
-			LAUS_LOG(("amtu failed network I/O test, could not find a link address"));
+			LAUS_LOG(("amtu failed network I/O test in recvfrom"));
 #else
-			AUDIT_LOG("amtu failed network I/O test, could not find a link address", 0);
+			AUDIT_LOG("amtu failed network I/O test in recvfrom", 0);
 #endif
-			freeifaddrs(ifaddrs);
-			return -1;
+		} else {
+			printf("  %-16s failed\n", t->iff->ifname);
 		}
+		failures++;
 	}
-			
-	/* done getting address stuff */
-	freeifaddrs(ifaddrs);
-	return j;
+	close(tfd);
+	close(epfd);
+	free(events);
+	return failures;
 }
 
 /****************************************************************/
@@ -357,18 +940,28 @@ int get_interfaces()
 /* PURPOSE: Send a packet containing some random data to 	*/
 /*	    each configured network device. Open a PF_SOCKET    */
 /*	    to receive the data and verify it is the same data 	*/
-/*	    that was sent.					*/
+/*	    that was sent.  With net_engine 1 net_frames	*/
+/*	    frames are sent and received through packet rings	*/
+/*	    instead (netring.c), with net_engine 3 in batches	*/
+/*	    of sendmmsg() and recvmmsg() on plain sockets, and	*/
+/*	    with net_engine 2 they are timestamped to measure	*/
+/*	    the latency (netlat.c), with net_engine 4 they go	*/
+/*	    through AF_XDP sockets (netxdp.c), and with		*/
+/*	    net_engine 5 they are spread over the RX queues	*/
+/*	    (netfanout.c).					*/
+/*	    With net_veth the test runs on veth pairs in a	*/
+/*	    private network namespace instead (netns.c).	*/
 /*								*/
 /****************************************************************/
 int networkio(int argc, char *argv[])
 {
-	int i, rtn, len, cc, rsock_fd;
-	int count, failures = 0;
-	long int rnd;
-	char c;
-	char packetbuf[MAXMSGSIZE];
-	struct sockaddr_in from;
+	struct if_test *tests;
+	int i, failures = 0;
+	double start;
 	
+	if (net_veth > 0)
+		return netns_run(argc, argv);
+
 	printf("Executing Network I/O Tests...\n");
 
 	/* get a list of interfaces for this machine. */
@@ -386,131 +979,45 @@ int networkio(int argc, char *argv[])
 	if (debug) {
 		printf("\nInterface list to test:\n");
 		for (i = 0; i < ifcount; i++) {
-			printf("   %s\n", interface_list[i]->ifname);
+			printf("   %s\n", interface_list[i].ifname);
 		}
 	}	
 	
-	/* Now get a pseudo-random string to send to each interface. 
+	/* Now get a pseudo-random pattern to send to each interface. 
 	 * This will be the data in the message we send and receive.
 	 */
-	i = 0;
-	srandom(time(NULL));
-	while (i < MSGSIZE) {
-		rnd = random();
-		c = (char)(rnd % 128);
-		if (isprint(c)) {
-			msgstr[i++] = (char) c;
-		}
-	}
+	net_pattern(net_seed ? (unsigned int)net_seed :
+		    (unsigned int)time(NULL) ^ ((unsigned int)getpid() << 16));
 	if (debug)
-		printf("\nmessage string: %s\n", msgstr);
-	
-	
-	/* 
-	 * For each interface in the list, send a packet containing
-	 * the random data. On same interface receive packets. Check
-	 * that we receive a packet containing the randon data sent.
-	 */
+		printf("\npattern seed: 0x%08x\n", msgseed);
 
+	tests = calloc(ifcount, sizeof(*tests));
+	if (tests == NULL) {
+		fprintf(stderr, "networkio: malloc failed\n");
+		cleanup();
+		return -1;
+	}
 	for (i = 0; i < ifcount; i++) {
-
-		struct sockaddr_ll rcv_info;
-		int rcvlen;
-		
-		if (debug)
-			printf("\nBeginning test for %s\n", 
-				interface_list[i]->ifname);
-		
-		/* Setup buffers and sockaddr_ll structure required
-		 * by PF_PACKET for receiving. Also open and bind socket.
-		 */
-		memset(packetbuf, 0, sizeof(packetbuf));
-		memset(&from, 0, sizeof(from));
-		len = sizeof(from);
-		rsock_fd = socket(PF_PACKET, SOCK_DGRAM, htons(ETH_P_LOOP));
-		if (rsock_fd < 0) {
-			perror("networkio:socket() failed");
-#ifdef HAVE_LIBLAUS
-			LAUS_LOG(("amtu failed network I/O tests on creating PF_PACKET socket"));
-#else
-			AUDIT_LOG("amtu failed network I/O tests on creating PF_PACKET socket", 0);
-#endif
-			return(-1) ;
-		}
-		
-		memset(&rcv_info, 0, sizeof(rcv_info));
-		rcv_info.sll_family = AF_PACKET;
-		rcv_info.sll_ifindex = interface_list[i]->ifindex;
-		rcv_info.sll_protocol = htons(ETH_P_ALL);
-		
-		/* bind socket to interface so that we receive packets
-		 * destined only for this interface.
-		 */
-		rcvlen = sizeof(rcv_info);
-		if (bind(rsock_fd, (struct sockaddr *)&rcv_info, rcvlen) < 0) {
-			perror("networkio:bind failed");
-#ifdef HAVE_LIBLAUS
-			LAUS_LOG(("amtu failed network I/O test on bind to socket"));
-#else
-			AUDIT_LOG("amtu failed network I/O test on bind to socket", 0);
-#endif
-			close(rsock_fd);
-			failures++;
-			if (debug)
-				printf("Interface %s failed test.\n",
-					interface_list[i]->ifname);
-			continue;
-		}			
-			
-		/* Now send a packet on this interface. */	
-		
-		rtn = send_packet(interface_list[i]);
-		if (rtn < 0) {
-			failures++;
-			if (debug)
-				printf("Interface %s failed test.\n",
-					interface_list[i]->ifname);
-			continue;
-		}
-		
-		/* Now receive packet. 
-		 * I think there's a chance we could miss our packet...
-		 * Set flag MSG_DONTWAIT in recvfrom so that we do not
-		 * sit and wait. Try MAXTRIES to receive packet with our
-		 * random data.  
-		 */
-		count = 0;	
-		do {
-			len = sizeof(from);
-			cc = recvfrom(rsock_fd, packetbuf, sizeof(packetbuf),
-				MSG_DONTWAIT, (struct sockaddr *)&from, 
-				(socklen_t *)&len);
-			
-			if (debug && (cc > 0))
-				printf("Received: %s\n", packetbuf);
-		} while (cc != -1 && 
-			(strncmp(msgstr, packetbuf, sizeof(msgstr)) != 0) &&
-			   ++count < MAXTRIES);
-			
-		if (cc == -1 || count == MAXTRIES) {
-			if(debug)
-				printf("recvfrom failed to receive message on %s\n", 
-					interface_list[i]->ifname);
-#ifdef HAVE_LIBLAUS
-			LAUS_LOG(("amtu failed network I/O test in recvfrom"));
-#else
-			AUDIT_LOG("amtu failed network I/O test in recvfrom", 0);
-#endif
-			failures++;
-		} else {
-			if (debug)
-				printf("Interface %s passed test.\n", 
-					interface_list[i]->ifname);
-		}	
-
-	}	
+		tests[i].iff = &interface_list[i];
+		tests[i].rsock = -1;
+		tests[i].ssock = -1;
+		tests[i].rtt = -1;
+	}
+	start = amtu_now();
+	if (net_engine == NET_ENGINE_RING || net_engine == NET_ENGINE_MMSG)
+		failures = ring_test(tests, ifcount);
+	else if (net_engine == NET_ENGINE_LATENCY)
+		failures = latency_test(tests, ifcount);
+	else if (net_engine == NET_ENGINE_XDP)
+		failures = xdp_test(tests, ifcount);
+	else if (net_engine == NET_ENGINE_FANOUT)
+		failures = fanout_test(tests, ifcount);
+	else
+		failures = socket_test(tests, ifcount);
+	printf("%d interfaces: %.3f s\n", ifcount, amtu_now() - start);
 
 	/* cleanup before terminating */
+	free(tests);
 	cleanup();
 	if (!failures) {
 		printf("Network I/O Controller Test SUCCESS!\n");	
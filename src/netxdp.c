@@ -0,0 +1,729 @@
+//----------------------------------------------------------------------
+//
+// Module Name:  netxdp.c
+//
+// Include File:  amtu.h
+//
+// Description:   Code for Abstract Machine Test Utility - AF_XDP
+//                engine of the I/O Controller-Network test.
+//
+// Notes:  The packet socket engines see every frame of an interface
+//         pass through the kernel stack.  This module sends and
+//         receives net_frames frames per interface through an AF_XDP
+//         socket instead, bound to queue net_xdp_queue of the
+//         interface: a UMEM area shared with the kernel and its fill,
+//         completion, RX and TX rings.  A small XDP program, attached
+//         through a BPF link that goes away with the socket, redirects
+//         only frames of amtu's test ethertype on that queue to the
+//         socket and passes all other traffic on.  It runs as generic
+//         (SKB) XDP, which also works on veth, unless net_xdp_skb is
+//         0: then it runs in the driver where it can, with zero-copy
+//         where the driver supports it, but many drivers rebuild their
+//         rings to attach it, interrupting all traffic of the
+//         interface for a moment.  On an interface of several RX
+//         queues an ntuple rule steers the test ethertype to the
+//         queue while the test runs, where the driver takes one;
+//         otherwise the frames must be steered there by other means.
+//         An AF_XDP socket only sees what arrives, so the frames of
+//         one interface must reach another interface under test, as
+//         on veth pairs or ports cabled to each other; a frame is
+//         credited to the interface whose address it was sent from.
+//         The return code is the number of interfaces that failed.
+// -----------------------------------------------------------------
+// LANGUAGE:     C
+//
+// Licensed under the Common Public License v. 1.0
+// -----------------------------------------------------------------
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <poll.h>
+#include <syslog.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/if_ether.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <linux/bpf.h>
+#include <linux/sockios.h>
+#include <linux/ethtool.h>
+#include "amtu.h"
+
+#ifndef AF_XDP
+#define AF_XDP		44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP		283
+#endif
+
+#define XSK_FRAME	2048	/* bytes per UMEM frame */
+#define XSK_RING	2048	/* descriptors per ring */
+#define XSK_FRAMES	(2 * XSK_RING)	/* half to receive, half to send */
+#define XSK_LOGSIZE	4096	/* verifier log of a rejected program */
+
+/* One ring shared with the kernel */
+struct xsk_ring {
+	unsigned int *producer;
+	unsigned int *consumer;
+	unsigned int *flags;
+	void *desc;		/* struct xdp_desc, or UMEM addresses */
+	void *map;
+	size_t len;
+};
+
+/* AF_XDP socket of one interface */
+struct xsk {
+	struct net_stream s;	/* the frames sent, and received elsewhere */
+	int fd;
+	int map;		/* XSKMAP holding fd */
+	int prog;		/* XDP program redirecting to the map */
+	int link;		/* BPF link of the program to the interface */
+	int rule;		/* ntuple rule steering to the queue, or -1 */
+	unsigned int rxqueues;	/* RX queues in use, 0 if not known */
+	const char *mode;
+	unsigned char *umem;
+	struct xsk_ring fill, comp, rx, tx;
+	unsigned long long freelist[XSK_RING];	/* TX frames not in use */
+	unsigned int nfree;
+	unsigned long syscalls;	/* send calls */
+};
+
+/* eBPF instructions, the fields of struct bpf_insn in order */
+#define XDP_INSN(code, dst, src, off, imm) \
+	{ (code), (dst), (src), (off), (imm) }
+#define XDP_LDX(size, dst, src, off) \
+	XDP_INSN(BPF_LDX | BPF_MEM | (size), dst, src, off, 0)
+
+static int xdp_bpf(int cmd, union bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: xdp_load						*/
+/*								*/
+/* PURPOSE: Load the XDP program of one interface: a frame	*/
+/*	    of ETH_P_LOOP received on a queue with a socket in	*/
+/*	    the XSKMAP map goes to that socket, anything else	*/
+/*	    is passed on to the stack.				*/
+/*								*/
+/****************************************************************/
+static int xdp_load(int map)
+{
+	struct bpf_insn prog[] = {
+		/* r2 = data, r3 = data_end */
+		XDP_LDX(BPF_W, 2, 1, offsetof(struct xdp_md, data)),
+		XDP_LDX(BPF_W, 3, 1, offsetof(struct xdp_md, data_end)),
+		/* pass what is shorter than an Ethernet header */
+		XDP_INSN(BPF_ALU64 | BPF_MOV | BPF_X, 4, 2, 0, 0),
+		XDP_INSN(BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0, ETH_HLEN),
+		XDP_INSN(BPF_JMP | BPF_JGT | BPF_X, 4, 3, 8, 0),
+		/* and what is not of our ethertype */
+		XDP_LDX(BPF_H, 4, 2, offsetof(struct ethhdr, h_proto)),
+		XDP_INSN(BPF_JMP | BPF_JNE | BPF_K, 4, 0, 6,
+			 htons(ETH_P_LOOP)),
+		/* bpf_redirect_map(map, rx_queue_index, XDP_PASS) */
+		XDP_LDX(BPF_W, 2, 1, offsetof(struct xdp_md, rx_queue_index)),
+		XDP_INSN(BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0,
+			 map),
+		XDP_INSN(0, 0, 0, 0, 0),
+		XDP_INSN(BPF_ALU64 | BPF_MOV | BPF_K, 3, 0, 0, XDP_PASS),
+		XDP_INSN(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map),
+		XDP_INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+		XDP_INSN(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_PASS),
+		XDP_INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+	};
+	static char log[XSK_LOGSIZE];
+	union bpf_attr attr;
+	int fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_XDP;
+	attr.insns = (unsigned long)prog;
+	attr.insn_cnt = sizeof(prog) / sizeof(prog[0]);
+	attr.license = (unsigned long)"CPL";
+	attr.log_buf = (unsigned long)log;
+	attr.log_size = sizeof(log);
+	attr.log_level = 1;
+	fd = xdp_bpf(BPF_PROG_LOAD, &attr);
+	if (fd < 0) {
+		perror("netxdp:BPF_PROG_LOAD failed");
+		if (log[0])
+			fprintf(stderr, "%s", log);
+	}
+	return fd;
+}
+
+/* Map one ring of the socket at page offset pgoff */
+static int xsk_map_ring(int fd, struct xsk_ring *q,
+			struct xdp_ring_offset *off, size_t size, off_t pgoff)
+{
+	unsigned char *map;
+
+	q->len = off->desc + XSK_RING * size;
+	map = mmap(NULL, q->len, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, fd, pgoff);
+	if (map == MAP_FAILED) {
+		perror("netxdp:mmap of a ring failed");
+		return -1;
+	}
+	q->map = map;
+	q->producer = (unsigned int *)(map + off->producer);
+	q->consumer = (unsigned int *)(map + off->consumer);
+	q->flags = (unsigned int *)(map + off->flags);
+	q->desc = map + off->desc;
+	return 0;
+}
+
+/* Insert or delete (cmd) ntuple rule fs of an interface, -1 on error */
+static int xsk_rule(struct interface_info *iff, unsigned int cmd,
+		    struct ethtool_rx_flow_spec *fs)
+{
+	struct ethtool_rxnfc nfc;
+	struct ifreq ifr;
+	int sock, rc;
+
+	sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (sock < 0)
+		return -1;
+	memset(&nfc, 0, sizeof(nfc));
+	nfc.cmd = cmd;
+	nfc.fs = *fs;
+	memset(&ifr, 0, sizeof(ifr));
+	memcpy(ifr.ifr_name, iff->ifname, sizeof(ifr.ifr_name));
+	ifr.ifr_data = (void *)&nfc;
+	rc = ioctl(sock, SIOCETHTOOL, &ifr);
+	close(sock);
+	*fs = nfc.fs;
+	return rc;
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: xsk_steer						*/
+/*								*/
+/* PURPOSE: Steer the frames of our ethertype to queue of an	*/
+/*	    interface with an ntuple rule, unless it has only	*/
+/*	    one RX queue in use.  Returns the location of the	*/
+/*	    rule, or -1 if none was added.			*/
+/*								*/
+/****************************************************************/
+static int xsk_steer(struct interface_info *iff, struct xsk *x,
+		     unsigned int queue)
+{
+	struct ethtool_rx_flow_spec fs;
+
+	x->rxqueues = net_rxqueues(iff->ifname);
+	if (x->rxqueues == 1)
+		return -1;
+	memset(&fs, 0, sizeof(fs));
+	fs.flow_type = ETHER_FLOW;
+	fs.h_u.ether_spec.h_proto = htons(ETH_P_LOOP);
+	fs.m_u.ether_spec.h_proto = 0xffff;
+	fs.ring_cookie = queue;
+	fs.location = RX_CLS_LOC_ANY;
+	if (xsk_rule(iff, ETHTOOL_SRXCLSRLINS, &fs) < 0)
+		return -1;
+	return fs.location;
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: xsk_open						*/
+/*								*/
+/* PURPOSE: Set up the AF_XDP socket of one interface: the	*/
+/*	    UMEM and its rings, the binding to net_xdp_queue,	*/
+/*	    the XDP program steering our frames to it and the	*/
+/*	    ntuple rule steering them to the queue.  The	*/
+/*	    program is attached in the driver if net_xdp_skb	*/
+/*	    is 0 and the driver has XDP.			*/
+/*								*/
+/****************************************************************/
+static int xsk_open(struct if_test *t, struct xsk *x)
+{
+	struct xdp_umem_reg reg;
+	struct xdp_mmap_offsets off;
+	struct xdp_options opt;
+	struct sockaddr_xdp sxdp;
+	union bpf_attr attr;
+	unsigned long long *fill;
+	unsigned int i, size = XSK_RING, queue = net_xdp_queue;
+	socklen_t len;
+
+	x->s.maxlen = t->iff->mtu;
+	if (!net_sweep && x->s.maxlen > NET_FRAMELEN)
+		x->s.maxlen = NET_FRAMELEN;
+	if (x->s.maxlen > XSK_FRAME - XDP_PACKET_HEADROOM - ETH_HLEN)
+		x->s.maxlen = XSK_FRAME - XDP_PACKET_HEADROOM - ETH_HLEN;
+	x->s.seen = calloc(x->s.count, 1);
+	x->umem = mmap(NULL, (size_t)XSK_FRAMES * XSK_FRAME,
+		       PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+		       -1, 0);
+	if (x->s.seen == NULL || x->umem == MAP_FAILED) {
+		x->umem = NULL;
+		fprintf(stderr, "netxdp: malloc failed\n");
+		return -1;
+	}
+
+	x->fd = socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+	if (x->fd < 0) {
+		perror("netxdp:AF_XDP socket failed");
+		return -1;
+	}
+	memset(&reg, 0, sizeof(reg));
+	reg.addr = (unsigned long)x->umem;
+	reg.len = (unsigned long long)XSK_FRAMES * XSK_FRAME;
+	reg.chunk_size = XSK_FRAME;
+	if (setsockopt(x->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0 ||
+	    setsockopt(x->fd, SOL_XDP, XDP_UMEM_FILL_RING, &size,
+		       sizeof(size)) < 0 ||
+	    setsockopt(x->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &size,
+		       sizeof(size)) < 0 ||
+	    setsockopt(x->fd, SOL_XDP, XDP_RX_RING, &size, sizeof(size)) < 0 ||
+	    setsockopt(x->fd, SOL_XDP, XDP_TX_RING, &size, sizeof(size)) < 0) {
+		perror("netxdp:could not set up the UMEM and its rings");
+		return -1;
+	}
+	len = sizeof(off);
+	if (getsockopt(x->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &len) < 0) {
+		perror("netxdp:XDP_MMAP_OFFSETS failed");
+		return -1;
+	}
+	if (xsk_map_ring(x->fd, &x->fill, &off.fr, sizeof(__u64),
+			 XDP_UMEM_PGOFF_FILL_RING) < 0 ||
+	    xsk_map_ring(x->fd, &x->comp, &off.cr, sizeof(__u64),
+			 XDP_UMEM_PGOFF_COMPLETION_RING) < 0 ||
+	    xsk_map_ring(x->fd, &x->rx, &off.rx, sizeof(struct xdp_desc),
+			 XDP_PGOFF_RX_RING) < 0 ||
+	    xsk_map_ring(x->fd, &x->tx, &off.tx, sizeof(struct xdp_desc),
+			 XDP_PGOFF_TX_RING) < 0)
+		return -1;
+
+	/* The first half of the frames is to receive into, the rest to send */
+	fill = x->fill.desc;
+	for (i = 0; i < XSK_RING; i++) {
+		fill[i] = (unsigned long long)i * XSK_FRAME;
+		x->freelist[i] = (unsigned long long)(XSK_RING + i) * XSK_FRAME;
+	}
+	x->nfree = XSK_RING;
+	__sync_synchronize();
+	*x->fill.producer = XSK_RING;
+
+	/* The map and program, attached in the driver if we may */
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = BPF_MAP_TYPE_XSKMAP;
+	attr.key_size = sizeof(int);
+	attr.value_size = sizeof(int);
+	attr.max_entries = queue + 1;
+	x->map = xdp_bpf(BPF_MAP_CREATE, &attr);
+	if (x->map < 0) {
+		perror("netxdp:XSKMAP create failed");
+		return -1;
+	}
+	x->prog = xdp_load(x->map);
+	if (x->prog < 0)
+		return -1;
+	memset(&attr, 0, sizeof(attr));
+	attr.link_create.prog_fd = x->prog;
+	attr.link_create.target_ifindex = t->iff->ifindex;
+	attr.link_create.attach_type = BPF_XDP;
+	attr.link_create.flags = XDP_FLAGS_DRV_MODE;
+	x->link = net_xdp_skb ? -1 : xdp_bpf(BPF_LINK_CREATE, &attr);
+	x->mode = "driver";
+	if (x->link < 0) {
+		attr.link_create.flags = XDP_FLAGS_SKB_MODE;
+		x->link = xdp_bpf(BPF_LINK_CREATE, &attr);
+		x->mode = "generic";
+	}
+	if (x->link < 0) {
+		perror("netxdp:could not attach the XDP program");
+		return -1;
+	}
+
+	memset(&sxdp, 0, sizeof(sxdp));
+	sxdp.sxdp_family = AF_XDP;
+	sxdp.sxdp_ifindex = t->iff->ifindex;
+	sxdp.sxdp_queue_id = queue;
+	sxdp.sxdp_flags = XDP_USE_NEED_WAKEUP;
+	if (attr.link_create.flags == XDP_FLAGS_SKB_MODE)
+		sxdp.sxdp_flags |= XDP_COPY;
+	if (bind(x->fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) < 0) {
+		perror("netxdp:bind of the AF_XDP socket failed");
+		return -1;
+	}
+	len = sizeof(opt);
+	if (getsockopt(x->fd, SOL_XDP, XDP_OPTIONS, &opt, &len) == 0 &&
+	    (opt.flags & XDP_OPTIONS_ZEROCOPY))
+		x->mode = "zero-copy";
+	x->rule = xsk_steer(t->iff, x, queue);
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = x->map;
+	attr.key = (unsigned long)&queue;
+	attr.value = (unsigned long)&x->fd;
+	if (xdp_bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0) {
+		perror("netxdp:could not add the socket to the XSKMAP");
+		return -1;
+	}
+	return 0;
+}
+
+/* Remove the rule, detach the program and free the socket of iff */
+static void xsk_close(struct interface_info *iff, struct xsk *x)
+{
+	struct xsk_ring *q[] = { &x->fill, &x->comp, &x->rx, &x->tx };
+	struct ethtool_rx_flow_spec fs;
+	unsigned int i;
+
+	if (x->rule >= 0) {
+		memset(&fs, 0, sizeof(fs));
+		fs.location = x->rule;
+		if (xsk_rule(iff, ETHTOOL_SRXCLSRLDEL, &fs) < 0)
+			fprintf(stderr, "netxdp: could not remove ntuple rule "
+				"%d of %s\n", x->rule, iff->ifname);
+	}
+	if (x->link >= 0)
+		close(x->link);
+	if (x->prog >= 0)
+		close(x->prog);
+	if (x->map >= 0)
+		close(x->map);
+	for (i = 0; i < sizeof(q) / sizeof(q[0]); i++)
+		if (q[i]->map)
+			munmap(q[i]->map, q[i]->len);
+	if (x->fd >= 0)
+		close(x->fd);
+	if (x->umem)
+		munmap(x->umem, (size_t)XSK_FRAMES * XSK_FRAME);
+	free(x->s.seen);
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: xsk_send						*/
+/*								*/
+/* PURPOSE: Take back the frames the kernel has sent, queue up	*/
+/*	    to net_burst new ones in the TX ring of one		*/
+/*	    interface, and wake the kernel if it asks for it.	*/
+/*	    Returns the number queued, 1 if only the earlier	*/
+/*	    ones were pushed on, 0 if there was nothing to do,	*/
+/*	    or -1 on error.					*/
+/*								*/
+/****************************************************************/
+static int xsk_send(struct if_test *t, struct xsk *x)
+{
+	unsigned long long *comp = x->comp.desc;
+	struct xdp_desc *tx = x->tx.desc, *d;
+	unsigned int cons, prod, n = 0;
+	unsigned char *f;
+	int len;
+
+	prod = *x->comp.producer;
+	__sync_synchronize();
+	for (cons = *x->comp.consumer; cons != prod; cons++)
+		x->freelist[x->nfree++] = comp[cons % XSK_RING];
+	__sync_synchronize();
+	*x->comp.consumer = cons;
+
+	prod = *x->tx.producer;
+	while (n < (unsigned int)x->s.burst && x->nfree > 0 &&
+	       x->s.next < x->s.count) {
+		d = &tx[(prod + n) % XSK_RING];
+		d->addr = x->freelist[--x->nfree];
+		f = x->umem + d->addr;
+		len = net_stream_len(&x->s, x->s.next);
+		memcpy(f, t->iff->lladdr, ETH_ALEN);
+		memcpy(f + ETH_ALEN, t->iff->lladdr, ETH_ALEN);
+		f[2 * ETH_ALEN] = ETH_P_LOOP >> 8;
+		f[2 * ETH_ALEN + 1] = ETH_P_LOOP & 0xff;
+		net_frame(f + ETH_HLEN, x->s.next, len);
+		d->len = ETH_HLEN + len;
+		d->options = 0;
+		if (x->s.next++ == 0)
+			t->sent = amtu_now();
+		n++;
+	}
+	__sync_synchronize();
+	*x->tx.producer = prod + n;
+
+	if (*x->tx.consumer == prod + n)
+		return n;
+	if (!(*x->tx.flags & XDP_RING_NEED_WAKEUP))
+		return n ? (int)n : 1;
+	x->syscalls++;
+	if (sendto(x->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0) {
+		if (errno == EAGAIN || errno == EBUSY || errno == ENOBUFS)
+			return n;
+		perror("netxdp:sendto() failed");
+		return -1;
+	}
+	return n ? (int)n : 1;
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: xsk_receive					*/
+/*								*/
+/* PURPOSE: Verify the frames in the RX ring of interface j,	*/
+/*	    each against the stream of the interface it was	*/
+/*	    sent from, and give their UMEM frames back to the	*/
+/*	    fill ring.						*/
+/*								*/
+/****************************************************************/
+static void xsk_receive(struct if_test *tests, struct xsk *xsks, int count,
+			int j)
+{
+	struct xsk *x = &xsks[j];
+	struct xdp_desc *rx = x->rx.desc, *d;
+	unsigned long long *fill = x->fill.desc;
+	unsigned int cons, prod, fprod;
+	unsigned char *f;
+	int k;
+	double now;
+
+	prod = *x->rx.producer;
+	__sync_synchronize();
+	cons = *x->rx.consumer;
+	if (cons == prod)
+		return;
+	now = amtu_now();
+	fprod = *x->fill.producer;
+	for (; cons != prod; cons++) {
+		d = &rx[cons % XSK_RING];
+		f = x->umem + d->addr;
+		for (k = 0; k < count; k++)
+			if (tests[k].iff->halen == ETH_ALEN && memcmp(f +
+			    ETH_ALEN, tests[k].iff->lladdr, ETH_ALEN) == 0)
+				break;
+		if (d->len < ETH_HLEN || k == count)
+			tests[j].bad++;
+		else
+			net_account(&tests[k], &xsks[k].s, f + ETH_HLEN,
+				    d->len - ETH_HLEN, now);
+		fill[fprod++ % XSK_RING] = d->addr - d->addr % XSK_FRAME;
+	}
+	__sync_synchronize();
+	*x->rx.consumer = cons;
+	*x->fill.producer = fprod;
+}
+
+/****************************************************************/
+/*								*/
+/* FUNCTION: xdp_test						*/
+/*								*/
+/* PURPOSE: Send net_frames frames on every interface through	*/
+/*	    its AF_XDP socket, collect them from the sockets	*/
+/*	    they arrive at until all came back or		*/
+/*	    net_timeout_ms passed after the last was sent, and	*/
+/*	    report each interface.  An interface fails on a	*/
+/*	    corrupted frame or if it lost more than		*/
+/*	    net_loss_ppm frames per million.  Returns the	*/
+/*	    number of interfaces that failed.			*/
+/*								*/
+/****************************************************************/
+int xdp_test(struct if_test *tests, int count)
+{
+	struct epoll_event ev, *events;
+	struct xdp_statistics st;
+	struct itimerspec its;
+	struct pollfd *pfd;
+	struct xsk *xsks, *x;
+	struct if_test *t;
+	socklen_t len;
+	int i, n, epfd, tfd, busy, pending, expired = 0;
+	int burst, failures = 0;
+	unsigned int frames;
+	unsigned long lost;
+	double elapsed;
+
+	net_limits(XSK_RING, &frames, &burst);
+	xsks = calloc(count, sizeof(*xsks));
+	pfd = calloc(count, sizeof(*pfd));
+	events = calloc(count + 1, sizeof(*events));
+	for (i = 0; xsks != NULL && i < count; i++)
+		xsks[i].fd = xsks[i].map = xsks[i].prog = xsks[i].link =
+			xsks[i].rule = -1;
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u32 = count;
+	if (xsks == NULL || pfd == NULL || events == NULL || epfd < 0 ||
+	    tfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev) < 0) {
+		perror("netxdp:setup failed");
+		failures = count;
+		goto out;
+	}
+
+	printf("AF_XDP on queue %d, %d frames per interface in bursts of "
+		"%d:\n", net_xdp_queue, frames, burst);
+	for (i = 0; i < count; i++) {
+		t = &tests[i];
+		x = &xsks[i];
+		x->s.count = frames;
+		x->s.burst = burst;
+		if (xsk_open(t, x) < 0) {
+			t->failed = 1;
+			continue;
+		}
+		printf("  %-16s %s XDP\n", t->iff->ifname, x->mode);
+		if (x->rule >= 0)
+			printf("  %-16s ntuple rule %d steers the frames to "
+				"the queue\n", "", x->rule);
+		else if (x->rxqueues > 1)
+			printf("  %-16s %u RX queues and no ntuple rule, the "
+				"frames must be steered to the queue\n", "",
+				x->rxqueues);
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.u32 = i;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, x->fd, &ev) < 0) {
+			perror("netxdp:epoll_ctl failed");
+			t->failed = 1;
+		}
+	}
+
+	/*
+	 * Send a batch on every interface in turn and drain the RX rings
+	 * in between.  When no TX ring has room, wait until one has; a
+	 * ring that stays full for net_timeout_ms has stalled.
+	 */
+	do {
+		busy = 0;
+		for (i = 0; i < count; i++) {
+			if (tests[i].failed)
+				continue;
+			n = xsk_send(&tests[i], &xsks[i]);
+			if (n < 0)
+				tests[i].failed = 1;
+			else if (n > 0)
+				busy = 1;
+		}
+		for (i = 0; i < count; i++)
+			if (!tests[i].failed)
+				xsk_receive(tests, xsks, count, i);
+		if (busy)
+			continue;
+		for (i = n = 0; i < count; i++) {
+			x = &xsks[i];
+			if (tests[i].failed || (x->s.next == x->s.count &&
+			    *x->tx.consumer == *x->tx.producer))
+				continue;
+			pfd[n].fd = x->fd;
+			pfd[n].events = POLLOUT;
+			pfd[n].revents = 0;
+			n++;
+		}
+		if (n == 0)
+			break;
+		if (poll(pfd, n, net_timeout_ms) <= 0) {
+			for (i = 0; i < count; i++)
+				if (!tests[i].failed &&
+				    xsks[i].s.next < xsks[i].s.count) {
+					fprintf(stderr, "netxdp: TX ring of "
+						"%s stalled\n",
+						tests[i].iff->ifname);
+					tests[i].failed = 1;
+				}
+			break;
+		}
+	} while (1);
+
+	/* Collect the rest until all came back or the timer fires */
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = net_timeout_ms / 1000;
+	its.it_value.tv_nsec = (net_timeout_ms % 1000) * 1000000L + 1;
+	if (timerfd_settime(tfd, 0, &its, NULL) < 0) {
+		perror("netxdp:timerfd_settime failed");
+		expired = 1;
+	}
+	while (!expired) {
+		for (i = pending = 0; i < count; i++)
+			if (!tests[i].failed &&
+			    tests[i].frames < xsks[i].s.next)
+				pending++;
+		if (!pending)
+			break;
+		n = epoll_wait(epfd, events, count + 1, -1);
+		if (n < 0) {
+			perror("netxdp:epoll_wait failed");
+			break;
+		}
+		for (i = 0; i < n; i++) {
+			if (events[i].data.u32 == (unsigned int)count)
+				expired = 1;
+			else if (!tests[events[i].data.u32].failed)
+				xsk_receive(tests, xsks, count,
+					    events[i].data.u32);
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		t = &tests[i];
+		x = &xsks[i];
+		memset(&st, 0, sizeof(st));
+		len = sizeof(st);
+		if (x->fd >= 0)
+			getsockopt(x->fd, SOL_XDP, XDP_STATISTICS, &st, &len);
+		lost = x->s.next - t->frames;
+		if (t->failed) {
+			printf("  %-16s failed\n", t->iff->ifname);
+		} else {
+			elapsed = t->last - t->sent;
+			printf("  %-16s %lu/%u frames of %d-%u bytes, "
+				"%.0f frames/s, %.1f Mbit/s\n", t->iff->ifname,
+				t->frames, x->s.next, net_stream_len(&x->s, 0),
+				x->s.maxlen,
+				elapsed > 0 ? t->frames / elapsed : 0,
+				elapsed > 0 ? t->bytes * 8 / elapsed / 1e6 : 0);
+			printf("  %-16s first %.3f ms, %lu lost (%.4f%%), "
+				"%lu reordered, %lu duplicated, %lu corrupted, "
+				"%llu dropped by the socket\n", "",
+				t->frames ? t->rtt * 1e3 : 0, lost,
+				x->s.next ? 100.0 * lost / x->s.next : 0,
+				t->reordered, t->dups, t->bad,
+				(unsigned long long)(st.rx_dropped +
+				st.rx_ring_full));
+			if (t->syndrome)
+				printf("  %-16s bits 0x%02x differed in the "
+					"corrupted frames\n", "", t->syndrome);
+			printf("  %-16s %lu send calls, %.3f per verified "
+				"frame\n", "", x->syscalls,
+				t->frames ? (double)x->syscalls / t->frames : 0);
+		}
+		if (!t->failed && !t->bad &&
+		    (double)lost * 1e6 <= (double)net_loss_ppm * x->s.next)
+			continue;
+		fprintf(stderr, "AF_XDP test of %s FAILED!\n", t->iff->ifname);
+#ifdef HAVE_LIBLAUS
+		LAUS_LOG(("amtu failed network I/O test on AF_XDP"));
+#else
+		AUDIT_LOG("amtu failed network I/O test on AF_XDP", 0);
+#endif
+		failures++;
+	}
+
+out:
+	for (i = 0; xsks != NULL && i < count; i++)
+		xsk_close(tests[i].iff, &xsks[i]);
+	if (tfd >= 0)
+		close(tfd);
+	if (epfd >= 0)
+		close(epfd);
+	free(events);
+	free(pfd);
+	free(xsks);
+	return failures;
+}
@@ -0,0 +1,755 @@
+//----------------------------------------------------------------------
+//
+// Module Name:  priv.c
+//
+// Include File:  amtu.h
+//
+// Description:   Code for Abstract Machine Test Utility - Supervisor
+//                Mode Instructions Test.
+//
+// Notes:  The machine specific files (amtu-<arch>.c) each provide a
+//         table of privileged instructions, priv_insns[], with a probe
+//         function executing the instruction and the signals it must
+//         raise in user mode.  By default each probe runs in-process
+//         under the trap engine (trap.c), which also checks si_code
+//         and, for probes written in assembler, that the signal was
+//         raised by the first instruction of the probe.  With
+//         priv_inproc=0 this module instead forks one child per
+//         instruction, all at the same time, and reaps them with
+//         waitid().  A child that exits normally executed its
+//         instruction without a fault.  The children keep the default
+//         signal actions and are not dumpable, so a fault kills them
+//         without a core file and nothing runs in signal context.
+//         The tables also hold an expanded catalog, run only where
+//         CPUID/HWCAP report the instruction; in fork mode the whole
+//         catalog shares a single child running it in-process, so it
+//         costs one fork.  Entries the kernel may emulate check what
+//         the emulation returned instead of requiring a fault.
+//         Afterwards each instruction that faulted as expected is run
+//         priv_bench more times in-process to measure what a trap and
+//         the recovery from it cost, in the finest counter we can read
+//         (TSC on x86, the virtual counter on aarch64, else ns).  With
+//         priv_percpu=1 the table is also run on every CPU we may use
+//         at the same time, by one worker process pinned to each, so a
+//         single faulty core cannot hide.  On x86 priv_ioports=1 also
+//         sweeps every I/O port (ioport.c), and priv_fuzz runs the
+//         opcode fuzzer (fuzz.c).  The return codes are as follows:
+//         -1 = failure occurred
+//          0 = success
+// -----------------------------------------------------------------
+// LANGUAGE:     C
+//
+// Licensed under the Common Public License v. 1.0
+// -----------------------------------------------------------------
+
+#define _GNU_SOURCE
+#include "config.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <sched.h>
+#include <syslog.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <sys/mman.h>
+#include "amtu.h"
+
+/* How one probe ended */
+struct priv_result {
+	pid_t pid;		/* probe child, fork mode only */
+	double start;
+	double elapsed;
+	int ran;		/* the probe was run */
+	int sig;		/* signal raised, 0 if none */
+	int code;		/* its si_code, if trapped */
+	void *pc;		/* where it was raised, if trapped */
+	int trapped;		/* run under the trap engine */
+	int skipped;		/* not available on this CPU */
+	int wrong;		/* completed, but insn->verify() failed */
+};
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: priv_signame                                               */
+/*                                                                      */
+/* PURPOSE: Short name of a fault signal for the report.                */
+/*                                                                      */
+/************************************************************************/
+static const char *priv_signame(int sig)
+{
+	switch (sig) {
+	case 0:		return "executed";
+	case SIGSEGV:	return "SIGSEGV";
+	case SIGBUS:	return "SIGBUS";
+	case SIGILL:	return "SIGILL";
+	case SIGFPE:	return "SIGFPE";
+	case SIGTRAP:	return "SIGTRAP";
+	default:	return "signal";
+	}
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: priv_child                                                 */
+/*                                                                      */
+/* PURPOSE: Body of a probe child: restore the default action of the    */
+/*          fault signals, which the tests may have caught, and execute */
+/*          the instruction.  Only returns if it did not fault.         */
+/*                                                                      */
+/************************************************************************/
+static void priv_child(const struct priv_insn *insn)
+{
+	static const int sigs[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGTRAP };
+	unsigned int i;
+
+	prctl(PR_SET_DUMPABLE, 0);
+	for (i = 0; i < sizeof(sigs) / sizeof(sigs[0]); i++)
+		signal(sigs[i], SIG_DFL);
+	insn->probe();
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: priv_run                                                   */
+/*                                                                      */
+/* PURPOSE: Run one probe in this thread under the trap engine, which   */
+/*          records signal, si_code and faulting PC and resumes here.   */
+/*          trap_init() must have been called.                          */
+/*                                                                      */
+/************************************************************************/
+static void priv_run(const struct priv_insn *insn, struct priv_result *r)
+{
+	struct trap_info ti;
+
+	if (insn->available && !insn->available()) {
+		r->skipped = 1;
+		return;
+	}
+	if (debug)
+		printf("%s test\n", insn->name);
+	r->start = amtu_now();
+	trap_call(insn->probe, &ti);
+	r->elapsed = amtu_now() - r->start;
+	r->ran = 1;
+	r->trapped = 1;
+	r->sig = ti.sig;
+	r->code = ti.code;
+	r->pc = ti.pc;
+	if (ti.sig == 0 && insn->verify)
+		r->wrong = insn->verify() != 0;
+}
+
+/* Entries run by the catalog child in fork mode */
+#define PRIV_BATCHED(insn)	(((insn)->flags & PRIV_BATCH) || (insn)->verify)
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: priv_batch                                                 */
+/*                                                                      */
+/* PURPOSE: Fork the one child running every batched entry in-process,  */
+/*          with its results in shared memory.  Returns its pid, 0 if   */
+/*          there is nothing to batch, or -1.                           */
+/*                                                                      */
+/************************************************************************/
+static pid_t priv_batch(struct priv_result *shared, int n)
+{
+	pid_t pid;
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (PRIV_BATCHED(&priv_insns[i]))
+			break;
+	if (i == n)
+		return 0;
+	pid = fork();
+	if (pid == 0) {
+		prctl(PR_SET_DUMPABLE, 0);
+		if (trap_init() < 0)
+			_exit(1);
+		for (i = 0; i < n; i++)
+			if (PRIV_BATCHED(&priv_insns[i]))
+				priv_run(&priv_insns[i], &shared[i]);
+		_exit(0);
+	}
+	if (pid == -1)
+		perror("amtu_priv: fork failed");
+	return pid;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: priv_fork                                                  */
+/*                                                                      */
+/* PURPOSE: Run every probe in its own child, all at once, and reap     */
+/*          them in the order they finish.  The batched entries share   */
+/*          one child.                                                  */
+/*                                                                      */
+/************************************************************************/
+static void priv_fork(struct priv_result *res, int n)
+{
+	struct priv_result *shared;
+	siginfo_t si;
+	double now;
+	pid_t batch = -1;
+	int i, running = 0;
+
+	shared = mmap(NULL, n * sizeof(*shared), PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	fflush(stdout);
+	if (shared != MAP_FAILED) {
+		batch = priv_batch(shared, n);
+		if (batch > 0)
+			running++;
+	}
+	for (i = 0; i < n; i++) {
+		if (PRIV_BATCHED(&priv_insns[i]))
+			continue;
+		if (priv_insns[i].available && !priv_insns[i].available()) {
+			res[i].skipped = 1;
+			continue;
+		}
+		if (debug)
+			printf("%s test\n", priv_insns[i].name);
+		res[i].start = amtu_now();
+		res[i].pid = fork();
+		if (res[i].pid == 0) {
+			priv_child(&priv_insns[i]);
+			_exit(0);
+		} else if (res[i].pid == -1) {
+			perror("amtu_priv: fork failed");
+			continue;
+		}
+		running++;
+	}
+
+	while (running > 0) {
+		memset(&si, 0, sizeof(si));
+		if (waitid(P_ALL, 0, &si, WEXITED) < 0)
+			break;
+		now = amtu_now();
+		if (si.si_pid == batch) {
+			running--;
+			continue;
+		}
+		for (i = 0; i < n; i++) {
+			if (res[i].pid != si.si_pid)
+				continue;
+			res[i].elapsed = now - res[i].start;
+			res[i].ran = 1;
+			if (si.si_code == CLD_KILLED ||
+			    si.si_code == CLD_DUMPED)
+				res[i].sig = si.si_status;
+			running--;
+		}
+	}
+
+	// A batched entry the child did not get to stays "not run"
+	if (shared == MAP_FAILED)
+		return;
+	for (i = 0; i < n; i++)
+		if (PRIV_BATCHED(&priv_insns[i]))
+			res[i] = shared[i];
+	munmap(shared, n * sizeof(*shared));
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: priv_inprocess                                             */
+/*                                                                      */
+/* PURPOSE: Run every probe in this thread under the trap engine.      */
+/*                                                                      */
+/************************************************************************/
+static void priv_inprocess(struct priv_result *res, int n)
+{
+	int i;
+
+	if (trap_init() < 0)
+		return;
+	for (i = 0; i < n; i++)
+		priv_run(&priv_insns[i], &res[i]);
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: priv_verify                                                */
+/*                                                                      */
+/* PURPOSE: Returns NULL if the instruction raised one of the expected  */
+/*          signals and, if trapped, did so with the expected si_code   */
+/*          at the expected instruction, or was emulated with a result  */
+/*          that passed its check; else what went wrong.                */
+/*                                                                      */
+/************************************************************************/
+static const char *priv_verify(const struct priv_insn *insn,
+			       struct priv_result *r)
+{
+	if ((insn->flags & PRIV_IGNORE) || r->skipped)
+		return NULL;
+	if (!r->ran)
+		return "not run";
+	if (r->sig == 0 && insn->verify)
+		return r->wrong ? "wrong emulated result" : NULL;
+	if (r->sig == 0)
+		return "no fault";
+	if (r->sig >= 32 || !(insn->signals & PRIV_SIG(r->sig)))
+		return "wrong signal";
+	if (r->trapped && insn->code != PRIV_ANYCODE && r->code != insn->code)
+		return "wrong si_code";
+	if (r->trapped && (insn->flags & PRIV_PC) &&
+	    r->pc != (void *)insn->probe)
+		return "wrong instruction";
+	return NULL;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: priv_check                                                 */
+/*                                                                      */
+/* PURPOSE: Print the result of one instruction.  Returns -1 if it did  */
+/*          not pass priv_verify().                                     */
+/*                                                                      */
+/************************************************************************/
+static int priv_check(const struct priv_insn *insn, struct priv_result *r)
+{
+	const char *why;
+	char msg[100];
+
+	if (r->skipped) {
+		printf("  %-12s not available\n", insn->name);
+		return 0;
+	}
+	if (priv_inproc)
+		printf("  %-12s %-10s %4d %9.3f us%s\n", insn->name,
+			r->ran ? priv_signame(r->sig) : "not run", r->code,
+			r->elapsed * 1e6,
+			insn->flags & PRIV_IGNORE ? " (not checked)" : "");
+	else
+		printf("  %-12s %-10s %9.3f ms%s\n", insn->name,
+			r->ran ? priv_signame(r->sig) : "not run",
+			r->elapsed * 1e3,
+			insn->flags & PRIV_IGNORE ? " (not checked)" : "");
+
+	why = priv_verify(insn, r);
+	if (why == NULL)
+		return 0;
+	if (r->trapped && r->sig)
+		fprintf(stderr, "%s raised signal %d si_code %d at %p, "
+			"expected si_code %d at %p\n", insn->name, r->sig,
+			r->code, r->pc, insn->code, (void *)insn->probe);
+
+	fprintf(stderr, "Privilege Separation Test FAILED on %s (%s)!\n",
+		insn->name, why);
+	snprintf(msg, sizeof(msg), "amtu failed privilege separation on %s",
+		insn->name);
+#ifdef HAVE_LIBLAUS
+	LAUS_LOG((msg))
+#else
+	AUDIT_LOG(msg, 0)
+#endif
+	return -1;
+}
+
+/* Result of the table on one CPU, in shared memory */
+struct cpu_result {
+	int cpu;
+	int state;		/* CPU_* below */
+	int failed;		/* instructions that failed */
+	int first;		/* index of the first one */
+	const char *why;	/* and what went wrong */
+	double elapsed;
+};
+
+#define CPU_NOT_RUN	0
+#define CPU_DONE	1
+#define CPU_OFFLINE	2
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: priv_on_cpu                                                */
+/*                                                                      */
+/* PURPOSE: Body of a per-CPU worker: pin to the CPU and run the whole  */
+/*          table there.  A CPU that went offline is marked so.         */
+/*                                                                      */
+/************************************************************************/
+static int priv_on_cpu(struct cpu_result *c, int n)
+{
+	struct priv_result *res;
+	const char *why;
+	cpu_set_t set;
+	double start;
+	int i;
+
+	CPU_ZERO(&set);
+	CPU_SET(c->cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set) < 0 ||
+	    sched_getcpu() != c->cpu) {
+		c->state = CPU_OFFLINE;
+		return 0;
+	}
+	res = calloc(n, sizeof(*res));
+	if (res == NULL)
+		return 1;
+
+	start = amtu_now();
+	if (priv_inproc)
+		priv_inprocess(res, n);
+	else
+		priv_fork(res, n);
+	c->elapsed = amtu_now() - start;
+
+	c->first = -1;
+	for (i = 0; i < n; i++) {
+		why = priv_verify(&priv_insns[i], &res[i]);
+		if (why == NULL)
+			continue;
+		if (c->failed++ == 0) {
+			c->first = i;
+			c->why = why;
+		}
+	}
+	c->state = CPU_DONE;
+	free(res);
+	return c->failed ? 1 : 0;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: priv_percpu_run                                            */
+/*                                                                      */
+/* PURPOSE: Run the table on every CPU we may use at the same time, one */
+/*          pinned worker process per CPU, and report each CPU.         */
+/*          Returns -1 if any CPU failed.                               */
+/*                                                                      */
+/************************************************************************/
+static int priv_percpu_run(int n)
+{
+	struct cpu_result *cpus, *c;
+	cpu_set_t set;
+	pid_t *pids;
+	char msg[100];
+	double start;
+	int i, ncpus = 0, offline = 0, stat, rc = 0;
+
+	if (sched_getaffinity(0, sizeof(set), &set) < 0) {
+		perror("amtu_priv: sched_getaffinity failed");
+		return -1;
+	}
+	cpus = mmap(NULL, CPU_SETSIZE * sizeof(*cpus), PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	pids = calloc(CPU_SETSIZE, sizeof(*pids));
+	if (cpus == MAP_FAILED || pids == NULL) {
+		fprintf(stderr, "Could not allocate memory\n");
+		if (cpus != MAP_FAILED)
+			munmap(cpus, CPU_SETSIZE * sizeof(*cpus));
+		free(pids);
+		return -1;
+	}
+
+	fflush(stdout);
+	start = amtu_now();
+	for (i = 0; i < CPU_SETSIZE; i++) {
+		if (!CPU_ISSET(i, &set))
+			continue;
+		c = &cpus[ncpus];
+		c->cpu = i;
+		pids[ncpus] = fork();
+		if (pids[ncpus] == 0)
+			_exit(priv_on_cpu(c, n));
+		if (pids[ncpus] == -1) {
+			perror("amtu_priv: fork failed");
+			rc = -1;
+			break;
+		}
+		ncpus++;
+	}
+	for (i = 0; i < ncpus; i++)
+		waitpid(pids[i], &stat, 0);
+
+	for (i = 0; i < ncpus; i++) {
+		c = &cpus[i];
+		if (c->state == CPU_OFFLINE) {
+			printf("  cpu %-4d skipped, offline\n", c->cpu);
+			offline++;
+		} else if (c->state == CPU_NOT_RUN) {
+			fprintf(stderr, "Worker for CPU %d died\n", c->cpu);
+			rc = -1;
+		} else if (c->failed) {
+			fprintf(stderr, "Privilege Separation Test FAILED on "
+				"CPU %d: %d instructions, first %s (%s)!\n",
+				c->cpu, c->failed,
+				priv_insns[c->first].name, c->why);
+			snprintf(msg, sizeof(msg), "amtu failed privilege "
+				"separation on CPU %d", c->cpu);
+#ifdef HAVE_LIBLAUS
+			LAUS_LOG((msg))
+#else
+			AUDIT_LOG(msg, 0)
+#endif
+			rc = -1;
+		} else {
+			printf("  cpu %-4d %d instructions passed %9.3f ms\n",
+				c->cpu, n, c->elapsed * 1e3);
+		}
+	}
+	printf("%d CPUs (%d skipped) of %ld configured: %.3f s\n", ncpus,
+		offline, sysconf(_SC_NPROCESSORS_CONF), amtu_now() - start);
+
+	munmap(cpus, CPU_SETSIZE * sizeof(*cpus));
+	free(pids);
+	return rc;
+}
+
+/*
+ * Counter used for the trap latency benchmark.  The TSC and the
+ * aarch64 virtual counter are read without a system call; lfence/isb
+ * keep the read from moving around the probe.
+ */
+#if defined(HAVE_X86_64) || defined(HAVE_I86)
+#define BENCH_UNIT	"cycles"
+static inline uint64_t bench_ticks(void)
+{
+	uint32_t lo, hi;
+
+	__asm__ volatile ("lfence\n\trdtsc" : "=a" (lo), "=d" (hi));
+	return ((uint64_t)hi << 32) | lo;
+}
+#elif defined(HAVE_AARCH64)
+#define BENCH_UNIT	"ticks"
+static inline uint64_t bench_ticks(void)
+{
+	uint64_t v;
+
+	__asm__ volatile ("isb\n\tmrs %0, cntvct_el0" : "=r" (v));
+	return v;
+}
+#else
+#define BENCH_UNIT	"ns"
+static inline uint64_t bench_ticks(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+#define BENCH_BUCKETS	64	/* log2 histogram */
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: bench_ticks_per_ns                                         */
+/*                                                                      */
+/* PURPOSE: Rate of bench_ticks().  The TSC is measured against the     */
+/*          monotonic clock for 20 ms; aarch64 reports its frequency.   */
+/*                                                                      */
+/************************************************************************/
+static double bench_ticks_per_ns(void)
+{
+#if defined(HAVE_X86_64) || defined(HAVE_I86)
+	double t0 = amtu_now(), t1;
+	uint64_t c0 = bench_ticks();
+
+	do {
+		t1 = amtu_now();
+	} while (t1 - t0 < 0.02);
+	return (bench_ticks() - c0) / ((t1 - t0) * 1e9);
+#elif defined(HAVE_AARCH64)
+	uint64_t freq;
+
+	__asm__ volatile ("mrs %0, cntfrq_el0" : "=r" (freq));
+	return freq / 1e9;
+#else
+	return 1;
+#endif
+}
+
+static int cmp_ticks(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: trap_bench                                                 */
+/*                                                                      */
+/* PURPOSE: Trap each instruction that passed priv_bench times in a     */
+/*          tight loop and report min, median, 99th percentile and max  */
+/*          cost with a log2 histogram.  Returns -1 if a median is      */
+/*          above priv_bench_max_ns.                                    */
+/*                                                                      */
+/************************************************************************/
+static int trap_bench(const int *passed, int n)
+{
+	struct trap_info ti;
+	uint64_t *samples, t0;
+	unsigned long hist[BENCH_BUCKETS];
+	double per_ns, median_ns;
+	int i, k, b, iters = priv_bench, rc = 0;
+
+	samples = calloc(iters, sizeof(*samples));
+	if (samples == NULL || trap_init() < 0) {
+		free(samples);
+		return -1;
+	}
+	per_ns = bench_ticks_per_ns();
+	printf("Trap latency over %d iterations, in %s (%.3f per ns):\n",
+		iters, BENCH_UNIT, per_ns);
+
+	for (i = 0; i < n; i++) {
+		if (!passed[i])
+			continue;
+		for (k = 0; k < iters; k++) {
+			t0 = bench_ticks();
+			trap_call(priv_insns[i].probe, &ti);
+			samples[k] = bench_ticks() - t0;
+		}
+		qsort(samples, iters, sizeof(*samples), cmp_ticks);
+		median_ns = samples[iters / 2] / per_ns;
+		printf("  %-12s min %llu median %llu p99 %llu max %llu, "
+			"%.0f ns\n", priv_insns[i].name,
+			(unsigned long long)samples[0],
+			(unsigned long long)samples[iters / 2],
+			(unsigned long long)samples[iters * 99 / 100],
+			(unsigned long long)samples[iters - 1], median_ns);
+
+		memset(hist, 0, sizeof(hist));
+		for (k = 0; k < iters; k++) {
+			for (b = 0; b < BENCH_BUCKETS - 1 &&
+			     (samples[k] >> (b + 1)); b++)
+				;
+			hist[b]++;
+		}
+		printf("  %-12s", "");
+		for (b = 0; b < BENCH_BUCKETS; b++)
+			if (hist[b])
+				printf(" 2^%d:%lu", b, hist[b]);
+		printf("\n");
+
+		if (priv_bench_max_ns > 0 && median_ns > priv_bench_max_ns) {
+			fprintf(stderr, "Trap latency of %s is %.0f ns, above "
+				"%d ns\n", priv_insns[i].name, median_ns,
+				priv_bench_max_ns);
+			rc = -1;
+		}
+	}
+	free(samples);
+	return rc;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: trap_bench_child                                           */
+/*                                                                      */
+/* PURPOSE: Run trap_bench() in a child, so that with priv_inproc 0     */
+/*          no probe runs in the amtu process itself.                   */
+/*                                                                      */
+/************************************************************************/
+static int trap_bench_child(const int *passed, int n)
+{
+	pid_t pid;
+	int stat = 0;
+
+	fflush(stdout);
+	pid = fork();
+	if (pid == 0) {
+		prctl(PR_SET_DUMPABLE, 0);
+		stat = trap_bench(passed, n);
+		fflush(stdout);
+		_exit(stat < 0 ? 1 : 0);
+	}
+	if (pid == -1) {
+		perror("amtu_priv: fork failed");
+		return -1;
+	}
+	if (waitpid(pid, &stat, 0) < 0 ||
+	    !(WIFEXITED(stat) && WEXITSTATUS(stat) == 0)) {
+		if (WIFSIGNALED(stat))
+			fprintf(stderr, "Trap benchmark child killed by "
+				"signal %d\n", WTERMSIG(stat));
+		return -1;
+	}
+	return 0;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: amtu_priv                                                  */
+/*                                                                      */
+/* PURPOSE: Execute privileged instructions to ensure that they cannot  */
+/*	    legitimately be run in user mode.                           */
+/*                                                                      */
+/************************************************************************/
+int amtu_priv(int argc, char *argv[])
+{
+	struct priv_result *res;
+	int *passed;
+	double start;
+	int i, n, skipped = 0, rc = 0;
+
+	printf("Executing Supervisor Mode Instructions Test...\n");
+
+	for (n = 0; priv_insns[n].name; n++)
+		;
+	res = calloc(n, sizeof(*res));
+	passed = calloc(n, sizeof(*passed));
+	if (res == NULL || passed == NULL) {
+		fprintf(stderr, "Could not allocate memory\n");
+		free(res);
+		free(passed);
+		return -1;
+	}
+
+	start = amtu_now();
+	if (priv_inproc)
+		priv_inprocess(res, n);
+	else
+		priv_fork(res, n);
+
+	for (i = 0; i < n; i++) {
+		if (priv_check(&priv_insns[i], &res[i]) < 0)
+			rc = -1;
+		else if (!(priv_insns[i].flags & PRIV_IGNORE) &&
+			 !res[i].skipped)
+			passed[i] = 1;
+		skipped += res[i].skipped;
+	}
+	printf("%d instructions (%d not available) %s: %.3f s\n", n,
+		skipped, priv_inproc ? "in-process" : "in child processes",
+		amtu_now() - start);
+
+	// Try every I/O port
+	if (priv_ioports)
+		rc |= ioport_sweep();
+
+	// Fuzz the system opcode space
+	if (priv_fuzz > 0)
+		rc |= priv_fuzz_run();
+
+	// Run the table on every CPU at once
+	if (priv_percpu)
+		rc |= priv_percpu_run(n);
+
+	// Measure the cost of the traps, in a child in fork mode
+	if (priv_bench > 0)
+		rc |= priv_inproc ? trap_bench(passed, n) :
+			trap_bench_child(passed, n);
+	free(res);
+	free(passed);
+
+	if (rc != 0)
+		return -1;
+
+#ifdef HAVE_LIBLAUS
+	LAUS_LOG(("amtu - Privileged Instruction Test succeeded"))
+#else
+	AUDIT_LOG("amtu - Privileged Instruction Test succeeded", 1)
+#endif
+	printf("Privileged Instruction Test SUCCESS!\n");
+	return(0);
+}
@@ -0,0 +1,423 @@
+//----------------------------------------------------------------------
+//
+// Module Name:  procsep.c
+//
+// Include File:  none
+//
+// Description:   Code for Abstract Machine Test Utility - Cross-Process
+//                Memory Separation Test.
+//
+// Notes:  This module starts victim processes that fill memory with a
+//         known canary, then tries to reach that memory as the
+//         unprivileged user nobody through /proc/PID/mem,
+//         process_vm_readv() and ptrace attach.  Every attempt must be
+//         denied and the canaries must be intact when the victims
+//         exit.  The victims are amtu itself, re-executed through
+//         posix_spawn() as "amtu --helper=victim".  The return codes
+//         are as follows:
+//         -1 = failure occurred
+//          0 = success
+// -----------------------------------------------------------------
+// LANGUAGE:     C
+//
+// Licensed under the Common Public License v. 1.0
+// -----------------------------------------------------------------
+
+#define _GNU_SOURCE
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <grp.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/ptrace.h>
+#include <sys/prctl.h>
+#include "amtu.h"
+
+#define CANARY		0x414d5455	/* "AMTU" */
+
+extern char **environ;
+
+/* What a victim reports once its canary is in place */
+struct victim_info {
+	uintptr_t addr;
+	size_t size;
+};
+
+struct victim {
+	pid_t pid;
+	int in_fd;		/* victim's stdin, closed to release it */
+	int out_fd;		/* victim's stdout, carries victim_info */
+	struct victim_info info;
+};
+
+/* Results of one attacker, in shared memory */
+struct attack_stats {
+	unsigned long mem;		/* /proc/PID/mem attempts */
+	unsigned long vm_readv;		/* process_vm_readv attempts */
+	unsigned long ptrace;		/* ptrace attach attempts */
+	unsigned long breaches;		/* attempts that were not denied */
+};
+
+struct spawn_job {
+	struct victim *victims;
+	int nvictims;
+	int id;
+	int nthreads;
+	int failed;
+};
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: procsep_victim                                             */
+/*                                                                      */
+/* PURPOSE: Body of a victim process: fill memory with the canary,      */
+/*          report where it is on stdout and wait for stdin to close.   */
+/*          Exits 1 if the canary changed in the meantime.  A victim    */
+/*          that changed its uid is made dumpable again, so that only   */
+/*          the uid keeps the attacker out.                             */
+/*                                                                      */
+/************************************************************************/
+int procsep_victim(int argc, char *argv[])
+{
+	struct victim_info info;
+	unsigned int *mem;
+	size_t i, n;
+	char c;
+	int uid;
+
+	if (argc < 3)
+		return 2;
+	info.size = strtoul(argv[1], NULL, 0) * 1024;
+	uid = atoi(argv[2]);
+	if (uid >= 0 && (setresuid(uid, uid, uid) < 0 ||
+			 prctl(PR_SET_DUMPABLE, 1, 0, 0, 0) < 0))
+		return 2;
+
+	mem = mmap(NULL, info.size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED)
+		return 2;
+	n = info.size / sizeof(*mem);
+	for (i = 0; i < n; i++)
+		mem[i] = CANARY ^ i;
+
+	info.addr = (uintptr_t)mem;
+	if (write(1, &info, sizeof(info)) != sizeof(info))
+		return 2;
+	while (read(0, &c, 1) > 0)
+		;
+
+	for (i = 0; i < n; i++)
+		if (mem[i] != (CANARY ^ i))
+			return 1;
+	return 0;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: spawn_victim                                               */
+/*                                                                      */
+/* PURPOSE: posix_spawn() one victim with pipes on its stdin and        */
+/*          stdout.  Our ends of the pipes are close-on-exec so the     */
+/*          other victims do not inherit them.                          */
+/*                                                                      */
+/************************************************************************/
+static int spawn_victim(struct victim *v)
+{
+	posix_spawn_file_actions_t fa;
+	char kb[32], uid[32];
+	char *args[] = { "amtu", "--helper=victim", kb, uid, NULL };
+	int in[2], out[2];
+	int rc;
+
+	snprintf(kb, sizeof(kb), "%d", procsep_kb);
+	snprintf(uid, sizeof(uid), "%d", procsep_uid);
+	if (pipe2(in, O_CLOEXEC) < 0)
+		return -1;
+	if (pipe2(out, O_CLOEXEC) < 0) {
+		close(in[0]);
+		close(in[1]);
+		return -1;
+	}
+
+	posix_spawn_file_actions_init(&fa);
+	posix_spawn_file_actions_adddup2(&fa, in[0], 0);
+	posix_spawn_file_actions_adddup2(&fa, out[1], 1);
+	rc = posix_spawn(&v->pid, "/proc/self/exe", &fa, NULL, args,
+			 environ);
+	posix_spawn_file_actions_destroy(&fa);
+	close(in[0]);
+	close(out[1]);
+	if (rc != 0) {
+		errno = rc;
+		close(in[1]);
+		close(out[0]);
+		return -1;
+	}
+	v->in_fd = in[1];
+	v->out_fd = out[0];
+
+	if (read(v->out_fd, &v->info, sizeof(v->info)) != sizeof(v->info))
+		return -1;
+	return 0;
+}
+
+static void *spawn_thread(void *arg)
+{
+	struct spawn_job *job = arg;
+	int i;
+
+	for (i = job->id; i < job->nvictims; i += job->nthreads) {
+		if (spawn_victim(&job->victims[i]) < 0) {
+			perror("procsep: could not start victim");
+			job->failed = 1;
+		}
+	}
+	return NULL;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: drop_privileges                                            */
+/*                                                                      */
+/* PURPOSE: Become nobody for real: ptrace and process_vm_readv check   */
+/*          the real uid, so seteuid() alone is not enough.             */
+/*                                                                      */
+/************************************************************************/
+static int drop_privileges(struct passwd *pwd)
+{
+	if (setgroups(0, NULL) < 0 ||
+	    setresgid(pwd->pw_gid, pwd->pw_gid, pwd->pw_gid) < 0 ||
+	    setresuid(pwd->pw_uid, pwd->pw_uid, pwd->pw_uid) < 0)
+		return -1;
+	return 0;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: attack_victim                                              */
+/*                                                                      */
+/* PURPOSE: Try once each way to read a victim's canary.  Anything not  */
+/*          denied is counted as a breach.                              */
+/*                                                                      */
+/************************************************************************/
+static void attack_victim(struct victim *v, struct attack_stats *st)
+{
+	char path[64];
+	unsigned int buf[4];
+	struct iovec local, remote;
+	int fd;
+
+	snprintf(path, sizeof(path), "/proc/%d/mem", v->pid);
+	fd = open(path, O_RDONLY);
+	st->mem++;
+	if (fd >= 0) {
+		if (pread(fd, buf, sizeof(buf), v->info.addr) > 0) {
+			if (debug)
+				printf("read %08x from %s\n", buf[0], path);
+			st->breaches++;
+		}
+		close(fd);
+	}
+
+	local.iov_base = buf;
+	local.iov_len = sizeof(buf);
+	remote.iov_base = (void *)v->info.addr;
+	remote.iov_len = sizeof(buf);
+	st->vm_readv++;
+	if (process_vm_readv(v->pid, &local, 1, &remote, 1, 0) > 0) {
+		if (debug)
+			printf("process_vm_readv read %08x from %d\n",
+				buf[0], v->pid);
+		st->breaches++;
+	}
+
+	st->ptrace++;
+	if (ptrace(PTRACE_ATTACH, v->pid, NULL, NULL) == 0) {
+		if (debug)
+			printf("ptrace attached to %d\n", v->pid);
+		st->breaches++;
+		waitpid(v->pid, NULL, __WALL);
+		ptrace(PTRACE_DETACH, v->pid, NULL, NULL);
+	}
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: procsep                                                    */
+/*                                                                      */
+/* PURPOSE: Execute Cross-Process Memory Separation Test.               */
+/*                                                                      */
+/************************************************************************/
+int procsep(int argc, char *argv[])
+{
+	struct passwd *pwd;
+	struct victim *victims;
+	struct attack_stats *stats, total;
+	struct spawn_job jobs[MAXTHREADS];
+	pthread_t tids[MAXTHREADS];
+	pid_t attackers[MAXTHREADS];
+	int nvictims = procsep_victims > 0 ? procsep_victims : 1;
+	int nworkers = amtu_nthreads();
+	int i, j, r, stat, nattackers = 0, rc = 0;
+	double start, elapsed;
+	pid_t pid;
+
+	printf("Executing Cross-Process Memory Separation Test...\n");
+
+	/* Only root can start the attackers as nobody */
+	if (geteuid() != 0) {
+		printf("Cross-Process Memory Separation Test skipped: it must "
+			"run as root to attack as user nobody\n");
+		return 0;
+	}
+
+	pwd = getpwnam("nobody");
+	if (pwd == NULL) {
+		fprintf(stderr, "Could not obtain info for user nobody\n");
+#ifdef HAVE_LIBLAUS
+		LAUS_LOG(("amtu cross-process memory separation test: could"
+			" not obtain info for user nobody"))
+#else
+		AUDIT_LOG("amtu cross-process memory separation test: could"
+			" not obtain info for user nobody", 0)
+#endif
+		return -1;
+	}
+	if (procsep_uid >= 0 && (uid_t)procsep_uid == pwd->pw_uid) {
+		fprintf(stderr, "Victims must not run as user nobody\n");
+		return -1;
+	}
+
+	victims = calloc(nvictims, sizeof(*victims));
+	stats = mmap(NULL, nworkers * sizeof(*stats), PROT_READ | PROT_WRITE,
+		     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (victims == NULL || stats == MAP_FAILED) {
+		fprintf(stderr, "Could not allocate memory\n");
+		free(victims);
+		return -1;
+	}
+	for (i = 0; i < nvictims; i++)
+		victims[i].in_fd = victims[i].out_fd = -1;
+
+	// Start the victims in parallel
+	fflush(stdout);
+	start = amtu_now();
+	for (i = 0; i < nworkers; i++) {
+		jobs[i].victims = victims;
+		jobs[i].nvictims = nvictims;
+		jobs[i].id = i;
+		jobs[i].nthreads = nworkers;
+		jobs[i].failed = 0;
+		if (pthread_create(&tids[i], NULL, spawn_thread, &jobs[i]))
+			break;
+	}
+	for (j = 0; j < i; j++) {
+		pthread_join(tids[j], NULL);
+		rc |= jobs[j].failed ? -1 : 0;
+	}
+	if (i < nworkers)
+		rc = -1;
+	if (debug)
+		printf("Started %d victims in %.3f s\n", nvictims,
+			amtu_now() - start);
+
+	// Attack them as nobody, each attacker taking every
+	// nworkers-th victim
+	start = amtu_now();
+	for (i = 0; rc == 0 && i < nworkers; i++) {
+		pid = fork();
+		if (pid > 0)
+			attackers[nattackers++] = pid;
+		if (pid == 0) {
+			if (drop_privileges(pwd) < 0) {
+				perror("procsep: could not become nobody");
+				_exit(2);
+			}
+			for (r = 0; r < procsep_rounds; r++)
+				for (j = i; j < nvictims; j += nworkers)
+					attack_victim(&victims[j], &stats[i]);
+			_exit(stats[i].breaches ? 1 : 0);
+		} else if (pid == -1) {
+			perror("procsep: fork failed");
+			rc = -1;
+		}
+	}
+	for (i = 0; i < nattackers; i++) {
+		if (waitpid(attackers[i], &stat, 0) < 0 ||
+		    !(WIFEXITED(stat) && (WEXITSTATUS(stat) == 0)))
+			rc = -1;
+	}
+	elapsed = amtu_now() - start;
+
+	// Release the victims and check their canaries
+	for (i = 0; i < nvictims; i++) {
+		if (victims[i].in_fd >= 0)
+			close(victims[i].in_fd);
+		if (victims[i].out_fd >= 0)
+			close(victims[i].out_fd);
+	}
+	for (i = 0; i < nvictims; i++) {
+		if (victims[i].pid <= 0)
+			continue;
+		if (waitpid(victims[i].pid, &stat, 0) < 0 ||
+		    !(WIFEXITED(stat) && (WEXITSTATUS(stat) == 0))) {
+			fprintf(stderr, "Victim %d did not exit cleanly, its "
+				"canary may have been modified\n",
+				victims[i].pid);
+			rc = -1;
+		}
+	}
+
+	memset(&total, 0, sizeof(total));
+	for (i = 0; i < nworkers; i++) {
+		total.mem += stats[i].mem;
+		total.vm_readv += stats[i].vm_readv;
+		total.ptrace += stats[i].ptrace;
+		total.breaches += stats[i].breaches;
+	}
+	printf("%d victims, %lu /proc/PID/mem, %lu process_vm_readv and %lu "
+		"ptrace attempts: %.3f s, %.0f attempts/s\n", nvictims,
+		total.mem, total.vm_readv, total.ptrace, elapsed,
+		elapsed > 0 ? (total.mem + total.vm_readv + total.ptrace) /
+		elapsed : 0);
+	if (total.breaches) {
+		fprintf(stderr, "%lu attempts were not denied\n",
+			total.breaches);
+		rc = -1;
+	}
+
+	munmap(stats, nworkers * sizeof(*stats));
+	free(victims);
+
+	if (rc != 0) {
+		fprintf(stderr, "Cross-Process Memory Separation Test FAILED!\n");
+#ifdef HAVE_LIBLAUS
+		LAUS_LOG(("amtu failed cross-process memory separation test"))
+#else
+		AUDIT_LOG("amtu failed cross-process memory separation test", 0)
+#endif
+		return -1;
+	}
+
+	fprintf(stderr, "Cross-Process Memory Separation Test SUCCESS!\n");
+#ifdef HAVE_LIBLAUS
+	LAUS_LOG(("amtu - Cross-Process Memory Separation Test succeeded"))
+#else
+	AUDIT_LOG("amtu - Cross-Process Memory Separation Test succeeded", 1)
+#endif
+	return 0;
+}
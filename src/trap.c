@@ -0,0 +1,182 @@
+//----------------------------------------------------------------------
+//
+// Module Name:  trap.c
+//
+// Include File:  amtu.h
+//
+// Description:   In-process fault trapping for the Abstract Machine
+//                Test Utility.
+//
+// Notes:  The tests originally forked a child for every access that
+//         was expected to fault and let the child's signal handler
+//         exit.  This module lets a probe run in the calling thread
+//         instead: the access is armed with sigsetjmp(), the handler
+//         records signal, si_code, si_addr and faulting PC, and
+//         siglongjmp()s back.  State is thread local, so several
+//         threads can probe at the same time.  The return codes are
+//         as follows:
+//          1 = the access faulted
+//          0 = the access completed
+//         -1 = handlers could not be installed (trap_init)
+// -----------------------------------------------------------------
+// LANGUAGE:     C
+//
+// Licensed under the Common Public License v. 1.0
+// -----------------------------------------------------------------
+
+#define _GNU_SOURCE
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <ucontext.h>
+#include "amtu.h"
+
+static __thread sigjmp_buf trap_env;
+static __thread volatile sig_atomic_t trap_armed;
+static __thread struct trap_info *trap_cur;
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: trap_pc                                                    */
+/*                                                                      */
+/* PURPOSE: Return the program counter saved in a signal context, or    */
+/*          NULL where we do not know the layout of mcontext.           */
+/*                                                                      */
+/************************************************************************/
+static void *trap_pc(void *ctx)
+{
+	ucontext_t *uc = ctx;
+
+#if defined(HAVE_X86_64)
+	return (void *)uc->uc_mcontext.gregs[REG_RIP];
+#elif defined(HAVE_I86)
+	return (void *)uc->uc_mcontext.gregs[REG_EIP];
+#elif defined(HAVE_AARCH64)
+	return (void *)uc->uc_mcontext.pc;
+#elif defined(HAVE_PPC64)
+	return (void *)uc->uc_mcontext.gp_regs[32];	/* PT_NIP */
+#elif defined(HAVE_PPC)
+	return (void *)uc->uc_mcontext.uc_regs->gregs[32];	/* PT_NIP */
+#elif defined(HAVE_S390)
+	return (void *)uc->uc_mcontext.psw.addr;
+#else
+	(void)uc;
+	return NULL;
+#endif
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: trap_handler                                               */
+/*                                                                      */
+/* PURPOSE: Record the fault taken by an armed probe and resume the     */
+/*          probe function.  A fault outside of a probe is a real bug,  */
+/*          so the default action is restored and the access retried.  */
+/*                                                                      */
+/************************************************************************/
+static void trap_handler(int sig, siginfo_t *si, void *ctx)
+{
+	if (!trap_armed) {
+		signal(sig, SIG_DFL);
+		return;
+	}
+	trap_armed = 0;
+	trap_cur->sig = sig;
+	trap_cur->code = si->si_code;
+	trap_cur->addr = si->si_addr;
+	trap_cur->pc = trap_pc(ctx);
+	siglongjmp(trap_env, 1);
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: trap_init                                                  */
+/*                                                                      */
+/* PURPOSE: Install the trap handler for the synchronous fault signals. */
+/*          SA_NODEFER keeps the signal unblocked, so the probes can    */
+/*          use sigsetjmp() without the cost of saving the mask.        */
+/*                                                                      */
+/************************************************************************/
+int trap_init(void)
+{
+	static const int sigs[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGTRAP };
+	struct sigaction sig;
+	unsigned int i;
+
+	memset(&sig, 0, sizeof(sig));
+	sig.sa_sigaction = trap_handler;
+	sig.sa_flags = SA_SIGINFO | SA_NODEFER;
+	sigemptyset(&sig.sa_mask);
+	for (i = 0; i < sizeof(sigs) / sizeof(sigs[0]); i++) {
+		if (sigaction(sigs[i], &sig, NULL) < 0) {
+			perror("trap_init: sigaction failed");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: trap_load                                                  */
+/*                                                                      */
+/* PURPOSE: Read an int from ptr.  The value read is stored in val      */
+/*          (if not NULL) when the access did not fault.                */
+/*                                                                      */
+/************************************************************************/
+int trap_load(const volatile int *ptr, int *val, struct trap_info *ti)
+{
+	int v;
+
+	memset(ti, 0, sizeof(*ti));
+	trap_cur = ti;
+	if (sigsetjmp(trap_env, 0))
+		return 1;
+	trap_armed = 1;
+	v = *ptr;
+	trap_armed = 0;
+	if (val)
+		*val = v;
+	return 0;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: trap_store                                                 */
+/*                                                                      */
+/* PURPOSE: Write val to ptr.                                           */
+/*                                                                      */
+/************************************************************************/
+int trap_store(volatile int *ptr, int val, struct trap_info *ti)
+{
+	memset(ti, 0, sizeof(*ti));
+	trap_cur = ti;
+	if (sigsetjmp(trap_env, 0))
+		return 1;
+	trap_armed = 1;
+	*ptr = val;
+	trap_armed = 0;
+	return 0;
+}
+
+/************************************************************************/
+/*                                                                      */
+/* FUNCTION: trap_call                                                  */
+/*                                                                      */
+/* PURPOSE: Call fn, which may live in memory that is not executable.   */
+/*                                                                      */
+/************************************************************************/
+int trap_call(void (*fn)(void), struct trap_info *ti)
+{
+	memset(ti, 0, sizeof(*ti));
+	trap_cur = ti;
+	if (sigsetjmp(trap_env, 0))
+		return 1;
+	trap_armed = 1;
+	fn();
+	trap_armed = 0;
+	return 0;
+}